@@ -0,0 +1,92 @@
+// headless benchmark runtime
+// - stands in for the browser client (client/config.js and client/client.js) in
+//   the bench builds: provides runtime_config, and reports results at exit
+// - loaded as a --pre-js after usb-sim.js, and configured by the "usb" section of
+//   the BENCH_CONFIG environment variable (see run-bench.js)
+// - with "record_path", the USB traffic is recorded to a trace file at exit, and with
+//   "replay_path", a recorded trace replaces the simulator (see webusb-trace.js)
+// - "files" are created in MEMFS before main() runs, as { path, size, marker } where the
+//   file holds size random bytes, starting with the marker string (if any)
+// - main() runs on the main thread in Asyncify builds, as in the browser, since the
+//   WebUSB devices are only reachable from the thread that enumerated them
+
+var bench_config = JSON.parse(process.env.BENCH_CONFIG || "{}");
+var runtime_config = {
+  usb: Object.assign({ vid: 0x1d50, pid: 0x6089, batch_control: false, record: bench_config.record_path !== undefined },
+                     bench_config.usb),
+};
+
+if(bench_config.replay_path !== undefined) {
+  _set_replay_trace(new Uint8Array(require("fs").readFileSync(bench_config.replay_path)), bench_config.replay_speed);
+}
+
+
+// create the input files
+Module.preRun = [].concat(Module.preRun || [], () => {
+  for(let file of bench_config.files || []) {
+    let data = require("crypto").randomBytes(file.size);
+    if(file.marker !== undefined) data.write(file.marker, 0, "latin1");
+    FS.mkdirTree(file.path.substr(0, file.path.lastIndexOf("/")) || "/");
+    FS.writeFile(file.path, data);
+  }
+});
+
+
+// time from process start to the runtime being ready (loading, compiling and instantiating the module)
+var runtime_ready_ms = undefined;
+var bench_reported = false;
+Module.noInitialRun = true;
+Module.onRuntimeInitialized = () => {
+  runtime_ready_ms = performance.now();
+  bench_run_main(process.argv.slice(1));
+};
+
+
+// run main() the way the browser client does (see run_main in client/client.js), so the
+// WebUSB devices, the transfer engine and the statistics all live on the main thread
+// - Asyncify/JSPI builds run main on the main thread, suspending it around USB calls
+// - futex builds (no Asyncify) block in USB calls, so main runs on a pthread via callMain
+// - args[0] is the loader path, which the multi-call module dispatches on
+function bench_run_main(args) {
+  Module.onExit = bench_report;
+  if(typeof Asyncify === "undefined") {
+    Module.callMain(args.slice(1));
+    return;
+  }
+
+  // write the arguments to the heap
+  let argv = Module._malloc(args.length * 4);
+  for(let x = 0; x < args.length; x++) {
+    let length = Module.lengthBytesUTF8(args[x]) + 1;
+    let ptr = Module._malloc(length);
+    Module.stringToUTF8(args[x], ptr, length);
+    Module.setValue(argv + x * 4, ptr, "i32");
+  }
+  Module.ccall("main", "number", ["number", "number"], [args.length, argv], { async: true }).then((status) => {
+    bench_report(status);
+    process.exit(status);
+  });
+}
+
+
+// report the results as a single tagged JSON line on stderr, once main() exits
+// - CPU time covers all threads of the process (the pthreads are worker_threads)
+function bench_report(status) {
+  if(bench_reported) return;
+  bench_reported = true;
+  let usage = process.cpuUsage();
+  let result = {
+    status: status,
+    wall_ms: performance.now(),
+    runtime_ready_ms: runtime_ready_ms,
+    cpu_user_ms: usage.user / 1000,
+    cpu_system_ms: usage.system / 1000,
+    sim: (trace_replay === undefined) ? navigator.usb.device.stats : null,
+    device_scans: device_scans,
+    endpoints: _export_transfer_stats(),
+  };
+  if(trace_recorder !== undefined) {
+    require("fs").writeFileSync(bench_config.record_path, trace_recorder.bytes());
+  }
+  require("fs").writeSync(2, `BENCH_RESULT ${JSON.stringify(result)}\n`);
+}
@@ -0,0 +1,90 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libusb.h>
+
+// bulk IN streaming benchmark
+// - keeps a fixed number of bulk IN transfers of a given size in flight on the
+//   simulated device's IN endpoint until the requested number of bytes is received,
+//   resubmitting each transfer from its callback (as libhackrf does)
+// - throughput and latency are reported by bench-runtime.js from the shim's transfer
+//   statistics, so results for different transfer sizes compare like for like
+//
+// usage: bulk-bench [-s <transfer size>] [-d <transfers in flight>] [-b <total bytes>]
+
+#define VENDOR_ID 0x1d50
+#define PRODUCT_ID 0x6089
+#define ENDPOINT_IN 0x81
+
+long long bytes_wanted = 64 << 20;
+long long bytes_received = 0;
+int transfers_pending = 0;
+bool failed = false;
+
+
+void LIBUSB_CALL transfer_callback(struct libusb_transfer *transfer)
+{
+  transfers_pending--;
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+    fprintf(stderr, "bulk-bench: transfer failed (status %d)\n", transfer->status);
+    failed = true;
+    return;
+  }
+
+  // resubmit until enough transfers are pending to receive the remaining bytes
+  bytes_received += transfer->actual_length;
+  if(bytes_received + (long long)transfers_pending * transfer->length >= bytes_wanted) return;
+  if(libusb_submit_transfer(transfer) < 0) failed = true;
+  else transfers_pending++;
+}
+
+
+int main(int argc, char **argv)
+{
+  int transfer_size = 16384;
+  int depth = 16;
+  int opt;
+  while((opt = getopt(argc, argv, "s:d:b:")) != -1) {
+    switch(opt) {
+      case 's': transfer_size = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 'b': bytes_wanted = atoll(optarg); break;
+      default:
+        fprintf(stderr, "usage: bulk-bench [-s <transfer size>] [-d <transfers in flight>] [-b <total bytes>]\n");
+        return 1;
+    }
+  }
+
+  if(libusb_init(NULL) < 0) return 1;
+  libusb_device_handle * handle = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+  if(handle == NULL || libusb_set_configuration(handle, 1) < 0 || libusb_claim_interface(handle, 0) < 0) {
+    fprintf(stderr, "bulk-bench: could not open the device\n");
+    return 1;
+  }
+
+  // start the transfers
+  struct libusb_transfer ** transfers = calloc(depth, sizeof(struct libusb_transfer *));
+  for(int x = 0; x < depth; x++) {
+    transfers[x] = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(transfers[x], handle, ENDPOINT_IN, malloc(transfer_size), transfer_size,
+                              transfer_callback, NULL, 1000);
+    if(libusb_submit_transfer(transfers[x]) < 0) return 1;
+    transfers_pending++;
+  }
+
+  // run until every transfer has completed
+  while(transfers_pending > 0) {
+    if(libusb_handle_events(NULL) < 0) break;
+  }
+
+  for(int x = 0; x < depth; x++) {
+    free(transfers[x]->buffer);
+    libusb_free_transfer(transfers[x]);
+  }
+  free(transfers);
+  libusb_release_interface(handle, 0);
+  libusb_close(handle);
+  libusb_exit(NULL);
+  return failed ? 1 : 0;
+}
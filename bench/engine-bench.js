@@ -0,0 +1,875 @@
+// transfer engine benchmark
+// - runs the WebUSB transfer engine (src/webusb-io.js) against the simulated device in
+//   usb-sim.js directly under Node.js, so it needs no Emscripten build
+// - the main thread runs the engine and the simulator, as the browser main thread does,
+//   and the libusb side is emulated on a worker_thread, as the pthread that handles
+//   events in the shim: it posts transfers to the submission ring, blocks on the
+//   completion ring tail with Atomics.wait (as emscripten_futex_wait does), and runs
+//   each completed transfer's callback, which usually resubmits it
+// - the transfers, rings and statistics block live in a shared wasm memory, laid out
+//   as the shim lays them out (see init_webusb in webusb.c)
+// - each scenario runs in its own process, and reports throughput, WebUSB calls,
+//   engine and callback latency, completion order, CPU time, garbage collections and
+//   the bytes allocated on the engine's thread per transfer (which includes the
+//   simulator's own result objects, as a browser's WebUSB allocates them too)
+// - with --out <file>, the results are merged into a JSON file by scenario name, so a
+//   filtered run only replaces its own scenarios
+//
+// usage: node bench/engine-bench.js [--filter <name>] [--out <file>]
+
+const child_process = require("child_process");
+const fs = require("fs");
+const path = require("path");
+const v8 = require("v8");
+const vm = require("vm");
+const worker_threads = require("worker_threads");
+
+
+// libusb_transfer field offsets in wasm32, behind a 16-byte emulated shim header
+const TRANSFER_LAYOUT = {
+  device_id: -16,
+  stats_slot: -12,
+  submit_time: -8,
+  endpoint: 5,
+  type: 6,
+  timeout: 8,
+  status: 12,
+  length: 16,
+  actual_length: 20,
+  buffer: 32,
+  num_iso_packets: 36,
+  iso_packet_desc: 40,
+  iso_packet_size: 12,
+  iso_length: 0,
+  iso_actual_length: 4,
+  iso_status: 8,
+};
+
+// shared memory layout
+// - rings as struct transfer_ring, statistics as struct endpoint_stats (see webusb.h)
+const MEMORY_PAGES = 2048;
+const RING_SIZE = 1024;
+const SUBMISSION_RING = 0x1000;
+const COMPLETION_RING = 0x2000 + RING_SIZE * 4;
+const STATS = 0x8000;
+const STATS_SLOTS = 32;
+const STATS_VALUES = 17;
+const STATS_HISTOGRAM_BUCKETS = 96;
+const STATS_SIZE = STATS_VALUES * 8 + STATS_HISTOGRAM_BUCKETS * 4;
+const TRANSFERS = 0x10000;
+const TRANSFER_SIZE = 1024;
+
+// offset in each transfer's slot (past struct libusb_transfer) where the bench stamps
+// the time its completion was posted, for the client's wakeup latency
+const COMPLETION_TIME = 512;
+const BUFFERS = 0x200000;
+
+const STAT_KEY = 0;
+const STAT_SUBMITTED = 1;
+const STAT_CALLBACK_MS = 2;
+
+const TRANSFER_TYPE_ISOCHRONOUS = 1;
+const TRANSFER_TYPE_BULK = 2;
+const TRANSFER_TYPE_INTERRUPT = 3;
+const TRANSFER_COMPLETED = 0;
+const TRANSFER_ERROR = 1;
+const TRANSFER_TIMED_OUT = 2;
+const TRANSFER_CANCELLED = 3;
+
+const SIM_DEVICE_ID = 0;
+const ENDPOINT_IN = 0x81;
+const ENDPOINT_OUT = 0x02;
+const ENDPOINT_INTERRUPT = 0x83;
+const ENDPOINT_ISO_IN = 0x84;
+const ENDPOINT_ISO_OUT = 0x05;
+
+// per-scenario timeout
+const SCENARIO_TIMEOUT_MS = 120000;
+
+
+// the libusb side of the transfer rings, run on a worker_thread
+// - mirrors libusb_submit_transfer, libusb_cancel_transfer and
+//   libusb_handle_events_timeout_completed in libusb.c
+class EmulatedLibusb {
+
+  constructor(buffer) {
+    this.heap_u8 = new Uint8Array(buffer);
+    this.heap_i32 = new Int32Array(buffer);
+    this.heap_f64 = new Float64Array(buffer);
+    this.transfers = new Map();
+    this.next_transfer = TRANSFERS;
+    this.next_buffer = BUFFERS;
+    this.completion_head = 0;
+    this.callback_latency_us = [];
+    this.wakeup_latency_us = [];
+  }
+
+  // allocate a transfer and its buffer
+  alloc_transfer(endpoint, type, length, timeout, callback) {
+    let ptr = this.next_transfer;
+    this.next_transfer += TRANSFER_SIZE;
+    let t = {
+      ptr: ptr,
+      endpoint: endpoint,
+      length: length,
+      buffer: this.next_buffer,
+      callback: callback,
+      submit_time: 0,
+      pending: false,
+    };
+    this.next_buffer += (length + 7) & ~7;
+    this.heap_i32[(ptr + TRANSFER_LAYOUT.device_id) >> 2] = SIM_DEVICE_ID;
+    this.heap_u8[ptr + TRANSFER_LAYOUT.endpoint] = endpoint;
+    this.heap_u8[ptr + TRANSFER_LAYOUT.type] = type;
+    this.heap_i32[(ptr + TRANSFER_LAYOUT.timeout) >> 2] = timeout;
+    this.heap_i32[(ptr + TRANSFER_LAYOUT.length) >> 2] = length;
+    this.heap_i32[(ptr + TRANSFER_LAYOUT.buffer) >> 2] = t.buffer;
+    this.transfers.set(ptr, t);
+    return t;
+  }
+
+  // split a transfer into isochronous packets of packet_size bytes
+  // - the packet descriptors must end before COMPLETION_TIME
+  set_iso_packets(t, count, packet_size) {
+    let l = TRANSFER_LAYOUT;
+    this.heap_i32[(t.ptr + l.num_iso_packets) >> 2] = count;
+    for(let x = 0; x < count; x++) {
+      this.heap_i32[(t.ptr + l.iso_packet_desc + x * l.iso_packet_size + l.iso_length) >> 2] = packet_size;
+    }
+  }
+
+  // get the actual length and status of a transfer's isochronous packet
+  iso_packet(t, index) {
+    let l = TRANSFER_LAYOUT;
+    let packet = t.ptr + l.iso_packet_desc + index * l.iso_packet_size;
+    return { actual_length: this.heap_i32[(packet + l.iso_actual_length) >> 2],
+             status: this.heap_i32[(packet + l.iso_status) >> 2] };
+  }
+
+  // find or claim the statistics slot of an endpoint (see endpoint_stats_slot)
+  stats_slot(endpoint) {
+    let key = (SIM_DEVICE_ID << 8) | endpoint;
+    for(let slot = 0; slot < STATS_SLOTS; slot++) {
+      let values = (STATS + slot * STATS_SIZE) >> 3;
+      if(this.heap_f64[values + STAT_KEY] == key) return slot;
+      if(this.heap_f64[values + STAT_KEY] < 0) {
+        this.heap_f64[values + STAT_KEY] = key;
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  submit(t) {
+    let slot = this.stats_slot(t.endpoint);
+    t.pending = true;
+    t.submit_time = performance.timeOrigin + performance.now();
+    this.heap_i32[(t.ptr + TRANSFER_LAYOUT.stats_slot) >> 2] = slot;
+    this.heap_f64[(t.ptr + TRANSFER_LAYOUT.submit_time) >> 3] = t.submit_time;
+    this.heap_i32[(t.ptr + TRANSFER_LAYOUT.status) >> 2] = -1;
+    if(slot >= 0) this.heap_f64[((STATS + slot * STATS_SIZE) >> 3) + STAT_SUBMITTED]++;
+    this.post(t.ptr);
+  }
+
+  cancel(t) {
+    this.post(t.ptr | 1);
+  }
+
+  // post a submission ring entry, and wake the dispatcher
+  post(entry) {
+    let tail = Atomics.load(this.heap_i32, (SUBMISSION_RING + 4) >> 2);
+    this.heap_i32[((SUBMISSION_RING + 8) >> 2) + (tail & (RING_SIZE - 1))] = entry;
+    Atomics.store(this.heap_i32, (SUBMISSION_RING + 4) >> 2, (tail + 1) | 0);
+    Atomics.notify(this.heap_i32, (SUBMISSION_RING + 4) >> 2);
+  }
+
+  // run the callbacks of the posted completions, blocking up to timeout_ms for one
+  // - returns the number of transfers completed
+  handle_events(timeout_ms) {
+    let count = this.process_completions();
+    if(count > 0) return count;
+    let tail = Atomics.load(this.heap_i32, (COMPLETION_RING + 4) >> 2);
+    if(tail == this.completion_head) Atomics.wait(this.heap_i32, (COMPLETION_RING + 4) >> 2, tail, timeout_ms);
+    return this.process_completions();
+  }
+
+  process_completions() {
+    let count = 0;
+    let tail = Atomics.load(this.heap_i32, (COMPLETION_RING + 4) >> 2);
+    while(this.completion_head != tail) {
+      let ptr = this.heap_i32[((COMPLETION_RING + 8) >> 2) + (this.completion_head & (RING_SIZE - 1))];
+      this.completion_head = (this.completion_head + 1) | 0;
+      Atomics.store(this.heap_i32, COMPLETION_RING >> 2, this.completion_head);
+
+      let t = this.transfers.get(ptr);
+      t.pending = false;
+      let now = performance.timeOrigin + performance.now();
+      this.callback_latency_us.push((now - t.submit_time) * 1000);
+      this.wakeup_latency_us.push((now - this.heap_f64[(ptr + COMPLETION_TIME) >> 3]) * 1000);
+      t.callback(t, this.heap_i32[(ptr + TRANSFER_LAYOUT.status) >> 2],
+                    this.heap_i32[(ptr + TRANSFER_LAYOUT.actual_length) >> 2]);
+      let slot = this.heap_i32[(ptr + TRANSFER_LAYOUT.stats_slot) >> 2];
+      let elapsed = performance.timeOrigin + performance.now() - now;
+      if(slot >= 0) this.heap_f64[((STATS + slot * STATS_SIZE) >> 3) + STAT_CALLBACK_MS] += elapsed;
+      count++;
+    }
+    return count;
+  }
+}
+
+
+// stream bulk transfers on an endpoint, resubmitting each from its callback (as
+// libhackrf and bench/bulk-bench.c do) until args.bytes have been transferred
+// - completions on an endpoint must arrive in submission order
+// - with args.spin, events are polled without blocking (a zero timeout)
+// - with args.work_ms, each callback spends that long processing its data first (as an
+//   application does), and each of the first transfers that long being prepared, which
+//   paces the stream when it's longer than a transfer takes
+function stream_client(libusb, args) {
+  let result = { bytes: 0, transfers: 0, statuses: {}, ordered: true, short: 0 };
+  let pending = 0;
+  let next_sequence = 0;
+  let expected_sequence = 0;
+  let start = performance.now();
+  let work = () => {
+    let work_start = performance.now();
+    while(performance.now() - work_start < (args.work_ms ?? 0));
+  };
+
+  let callback = (t, status, actual_length) => {
+    pending--;
+    result.transfers++;
+    result.statuses[status] = (result.statuses[status] || 0) + 1;
+    if(t.sequence != expected_sequence) result.ordered = false;
+    expected_sequence = t.sequence + 1;
+    result.bytes += actual_length;
+    if(status == TRANSFER_COMPLETED && actual_length < t.length) result.short++;
+    work();
+    if(status != TRANSFER_COMPLETED && args.stop_on_error !== false) return;
+    if(result.bytes + pending * t.length >= args.bytes) return;
+    t.sequence = next_sequence++;
+    libusb.submit(t);
+    pending++;
+  };
+
+  for(let x = 0; x < args.depth; x++) {
+    let t = libusb.alloc_transfer(args.endpoint, TRANSFER_TYPE_BULK, args.size, args.timeout ?? 1000, callback);
+    if(x > 0) work();
+    t.sequence = next_sequence++;
+    libusb.submit(t);
+    pending++;
+  }
+  while(pending > 0) libusb.handle_events(args.spin ? 0 : 1000);
+
+  result.elapsed_ms = performance.now() - start;
+  result.bytes_per_second = result.bytes / (result.elapsed_ms / 1000);
+  return result;
+}
+
+
+// stream isochronous transfers of args.packets packets of args.packet_size bytes on an
+// endpoint, resubmitting each from its callback, until args.total_packets packets have
+// been transferred
+// - every packet's descriptor must report it complete, in full
+function iso_client(libusb, args) {
+  let result = { bytes: 0, transfers: 0, statuses: {}, ordered: true, packets: 0, bad_packets: 0 };
+  let pending = 0;
+  let submitted = 0;
+  let next_sequence = 0;
+  let expected_sequence = 0;
+  let start = performance.now();
+
+  let submit = (t) => {
+    t.sequence = next_sequence++;
+    libusb.submit(t);
+    pending++;
+    submitted += args.packets;
+  };
+  let callback = (t, status, actual_length) => {
+    pending--;
+    result.transfers++;
+    result.statuses[status] = (result.statuses[status] || 0) + 1;
+    if(t.sequence != expected_sequence) result.ordered = false;
+    expected_sequence = t.sequence + 1;
+    result.bytes += actual_length;
+    for(let x = 0; x < args.packets; x++) {
+      let packet = libusb.iso_packet(t, x);
+      if(packet.status != TRANSFER_COMPLETED || packet.actual_length != args.packet_size) result.bad_packets++;
+    }
+    result.packets += args.packets;
+    if(status == TRANSFER_COMPLETED && submitted < args.total_packets) submit(t);
+  };
+
+  for(let x = 0; x < args.depth; x++) {
+    let t = libusb.alloc_transfer(args.endpoint, TRANSFER_TYPE_ISOCHRONOUS, args.packets * args.packet_size, 1000, callback);
+    libusb.set_iso_packets(t, args.packets, args.packet_size);
+    submit(t);
+  }
+  while(pending > 0) libusb.handle_events(1000);
+
+  result.elapsed_ms = performance.now() - start;
+  result.bytes_per_second = result.bytes / (result.elapsed_ms / 1000);
+  result.packets_per_second = result.packets / (result.elapsed_ms / 1000);
+  return result;
+}
+
+
+// stream bulk transfers for args.stream_ms, then stop by cancelling them all (as
+// hackrf_stop_rx does), or only the first args.cancel of them, and time how long the
+// cancelled transfers take to complete
+// - the transfers that weren't cancelled must stay pending: their WebUSB transfers are
+//   aborted along with the cancelled ones, and issued again
+function stop_client(libusb, args) {
+  const DEADLINE_MS = 5000;
+  let result = { bytes: 0, transfers: 0, statuses: {}, ordered: true };
+  let pending = new Set();
+  let stopping = false;
+  let next_sequence = 0;
+  let expected_sequence = 0;
+
+  let callback = (t, status, actual_length) => {
+    pending.delete(t);
+    result.transfers++;
+    result.statuses[status] = (result.statuses[status] || 0) + 1;
+    if(t.sequence != expected_sequence) result.ordered = false;
+    expected_sequence = t.sequence + 1;
+    result.bytes += actual_length;
+    if(stopping || status != TRANSFER_COMPLETED) return;
+    t.sequence = next_sequence++;
+    libusb.submit(t);
+    pending.add(t);
+  };
+  let wait_for = (transfers) => {
+    let start = performance.now();
+    while(transfers.some((t) => pending.has(t)) && performance.now() - start < DEADLINE_MS) libusb.handle_events(100);
+    return performance.now() - start;
+  };
+
+  let start = performance.now();
+  for(let x = 0; x < args.depth; x++) {
+    let t = libusb.alloc_transfer(args.endpoint, TRANSFER_TYPE_BULK, args.size, 0, callback);
+    t.sequence = next_sequence++;
+    libusb.submit(t);
+    pending.add(t);
+  }
+  while(performance.now() - start < args.stream_ms) libusb.handle_events(10);
+
+  // cancel the first transfers, then the rest, so the run ends
+  stopping = true;
+  let transfers = [...pending].sort((a, b) => a.sequence - b.sequence);
+  let cancelled = transfers.slice(0, args.cancel ?? transfers.length);
+  for(let t of cancelled) libusb.cancel(t);
+  result.stop_ms = wait_for(cancelled);
+  let settle_start = performance.now();
+  while(performance.now() - settle_start < (args.settle_ms ?? 0)) libusb.handle_events(10);
+  result.still_pending = [...pending].filter((t) => !cancelled.includes(t)).length;
+  result.stopped = cancelled.every((t) => !pending.has(t));
+  let rest = [...pending];
+  for(let t of rest) libusb.cancel(t);
+  wait_for(rest);
+
+  result.elapsed_ms = performance.now() - start;
+  result.bytes_per_second = result.bytes / (result.elapsed_ms / 1000);
+  return result;
+}
+
+
+// read interrupt IN reports one transfer at a time, spending args.work_ms between reads
+// (as an application handling each report does), and measure the age of each report
+// when its callback runs
+// - reports read ahead of the application would be delivered stale
+function interrupt_client(libusb, args) {
+  const AGE_BUCKETS_MS = [1, 2, 4, 8, 16, 32, 64, 128, 256, Infinity];
+  let result = { bytes: 0, transfers: 0, statuses: {}, ordered: true };
+  let ages = [];
+  let completed = false;
+
+  let t = libusb.alloc_transfer(ENDPOINT_INTERRUPT, TRANSFER_TYPE_INTERRUPT, 64, 1000, (t, status, actual_length) => {
+    result.transfers++;
+    result.statuses[status] = (result.statuses[status] || 0) + 1;
+    result.bytes += actual_length;
+    if(status == TRANSFER_COMPLETED) ages.push(performance.timeOrigin + performance.now() - libusb.heap_f64[t.buffer >> 3]);
+    completed = true;
+  });
+
+  let start = performance.now();
+  for(let x = 0; x < args.reports; x++) {
+    completed = false;
+    libusb.submit(t);
+    while(!completed) libusb.handle_events(1000);
+    let work_start = performance.now();
+    while(performance.now() - work_start < args.work_ms);
+  }
+
+  result.elapsed_ms = performance.now() - start;
+  result.bytes_per_second = result.bytes / (result.elapsed_ms / 1000);
+  result.report_age_ms = percentiles(ages);
+  result.report_age_histogram = AGE_BUCKETS_MS.map((limit, x) => ({
+    below_ms: (limit == Infinity) ? "inf" : limit,
+    count: ages.filter((a) => a < limit && (x == 0 || a >= AGE_BUCKETS_MS[x - 1])).length,
+  }));
+  return result;
+}
+
+
+// sustained throughput against usb.queue_depth (the WebUSB transfers kept in flight per
+// endpoint), with more libusb transfers submitted than the deepest queue keeps in flight,
+// on a bus whose round trip latency the queue has to cover
+function queue_depth_scenarios() {
+  return [1, 2, 4, 8, 16, 32].map((depth) => ({
+    name: `rx_16k_queue_depth_${depth}`,
+    sim: { bandwidth: 40e6, latency_ms: 1 },
+    usb: { queue_depth: depth },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 48, bytes: 32 << 20 },
+  }));
+}
+
+
+// isochronous packet rate scenarios, IN and OUT, with 8 and 32 packets per transfer (each
+// transfer is one WebUSB call), at the high-speed microframe rate (8000 packets/s), and on
+// an unthrottled bus, where the engine bounds the rate
+function iso_scenarios() {
+  let scenarios = [];
+  for(let [direction, endpoint] of [["in", ENDPOINT_ISO_IN], ["out", ENDPOINT_ISO_OUT]]) {
+    for(let packets of [8, 32]) {
+      for(let unthrottled of [false, true]) {
+        scenarios.push({
+          name: `iso_${direction}_${packets}x1024${unthrottled ? "_unthrottled" : ""}`,
+          sim: { iso_interval_ms: unthrottled ? 0 : 0.125, latency_ms: unthrottled ? 0 : 0.125 },
+          client: iso_client,
+          args: { endpoint: endpoint, packets: packets, packet_size: 1024, depth: 4,
+                  total_packets: unthrottled ? 400000 : 16000 },
+          check: (r) => r.bad_packets > 0 ? `${r.bad_packets} packets incomplete` : undefined,
+        });
+      }
+    }
+  }
+  return scenarios;
+}
+
+
+// benchmark scenarios
+// - sim: simulator options (see USB_SIM_DEFAULTS in usb-sim.js)
+// - usb: runtime_config.usb options (see client/config.js)
+// - ui_load: synthetic UI work, block_ms of it every interval_ms, on the engine's thread
+//   (as when the engine runs on the UI thread), or with io_worker on another thread (as
+//   with usb.io_worker, where the engine runs in its own worker)
+// - control: control transfers run on the engine's thread during the client's run (see
+//   run_control_transfers)
+// - client: the libusb-side workload, run with args on the worker_thread
+// - check: returns an error for a result that libusb semantics don't allow
+const SCENARIOS = [
+  {
+    // hackrf_transfer -r at 20 Msps: four 256 KiB transfers in flight
+    name: "rx_256k",
+    sim: { bandwidth: 40e6 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 256 << 20 },
+  },
+  {
+    // hackrf_transfer -t at 10 Msps
+    name: "tx_256k",
+    sim: { bandwidth: 20e6 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_OUT, size: 262144, depth: 4, bytes: 128 << 20 },
+  },
+  {
+    // TX on a bus fast enough that staging the outgoing data bounds the rate
+    name: "tx_256k_fast_bus",
+    sim: { bandwidth: 2e9, latency_ms: 0 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_OUT, size: 262144, depth: 4, bytes: 1 << 30 },
+  },
+  {
+    name: "rx_256k_faults",
+    sim: { bandwidth: 40e6, error_rate: 0.002, stall_rate: 0.002 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 128 << 20, stop_on_error: false },
+  },
+  {
+    // transfers that never complete (until the endpoint's halt is cleared) are timed out,
+    // and the stream carries on past them: clearing the halt aborts the WebUSB transfers
+    // queued behind a hung one, which must be issued again, not fail
+    // - the application's 20 ms per callback paces the stream, so a transfer submitted
+    //   after a hung one has time to be issued again before its own timeout
+    name: "rx_256k_hangs",
+    sim: { bandwidth: 40e6, hang_rate: 0.005 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 64 << 20, timeout: 100, stop_on_error: false,
+            work_ms: 20 },
+    check: (r, sim) => sim.faults == 0 ? "no transfers hung" :
+                       (r.statuses[TRANSFER_ERROR] ?? 0) > 0 ? `${r.statuses[TRANSFER_ERROR]} transfers failed` :
+                       (r.statuses[TRANSFER_TIMED_OUT] ?? 0) != sim.faults ?
+                         `${r.statuses[TRANSFER_TIMED_OUT] ?? 0} transfers timed out, expected the ${sim.faults} that hung` :
+                         undefined,
+  },
+  {
+    // 16 KiB transfers on a bus with a fixed cost per WebUSB transfer (as bulk_in_16k in
+    // run-bench.js), without and with coalescing
+    name: "rx_16k",
+    sim: { bandwidth: 40e6, overhead_ms: 0.1 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 16, bytes: 64 << 20 },
+  },
+  {
+    name: "rx_16k_coalesced",
+    sim: { bandwidth: 40e6, overhead_ms: 0.1 },
+    usb: { coalesce: true },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 16, bytes: 64 << 20 },
+  },
+  {
+    // a short packet ends a merged transfer early: the transfers it didn't reach must
+    // still complete in submission order, ahead of the next merged transfer's
+    name: "rx_16k_coalesced_short",
+    sim: { bandwidth: 40e6, overhead_ms: 0.1, short_rate: 0.05 },
+    usb: { coalesce: true },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 16, bytes: 16 << 20 },
+    check: (r, sim) => sim.short_packets == 0 ? "no short packets were simulated" :
+                       Object.keys(r.statuses).some((s) => s != TRANSFER_COMPLETED) ?
+                         `unexpected transfer statuses ${JSON.stringify(r.statuses)}` : undefined,
+  },
+  {
+    // a 2 Msps stream, with the event thread blocking in handle_events until a completion
+    // is posted, and (for comparison) polling it without blocking, as it did before
+    // libusb_handle_events_timeout blocked: compare CPU time and wakeup latency
+    name: "rx_2msps",
+    sim: { bandwidth: 4e6 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 4, bytes: 8 << 20 },
+  },
+  {
+    name: "rx_2msps_polling",
+    sim: { bandwidth: 4e6 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 4, bytes: 8 << 20, spin: true },
+  },
+  {
+    // a 20 Msps stream while the UI is busy for 30 ms of every 100 ms, with the engine
+    // on the UI thread, and in an I/O worker: compare completion latency and throughput
+    name: "rx_256k_ui_load",
+    sim: { bandwidth: 40e6 },
+    ui_load: { block_ms: 30, interval_ms: 100 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 128 << 20 },
+  },
+  {
+    name: "rx_256k_ui_load_io_worker",
+    sim: { bandwidth: 40e6 },
+    ui_load: { block_ms: 30, interval_ms: 100, io_worker: true },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 128 << 20 },
+  },
+  {
+    // stop a 20 Msps stream: cancel every transfer in flight
+    name: "rx_stop",
+    sim: { bandwidth: 40e6 },
+    client: stop_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, stream_ms: 500 },
+    check: (r) => !r.stopped ? "cancelled transfers didn't complete" :
+                  r.stop_ms > 50 ? `stopping took ${r.stop_ms.toFixed(1)} ms` : undefined,
+  },
+  {
+    // cancel one of several transfers on an endpoint whose transfers never complete:
+    // it must complete right away, its WebUSB transfer must be aborted (clearing the
+    // endpoint's halt), and the others must stay pending, issued again
+    name: "rx_cancel_one_hung",
+    sim: { bandwidth: 40e6, hang_rate: 1 },
+    client: stop_client,
+    args: { endpoint: ENDPOINT_IN, size: 16384, depth: 4, stream_ms: 50, cancel: 1, settle_ms: 50 },
+    check: (r, sim) => !r.stopped ? "the cancelled transfer didn't complete" :
+                  r.stop_ms > 50 ? `cancelling took ${r.stop_ms.toFixed(1)} ms` :
+                  sim.clear_halts < 1 ? "the cancelled transfer wasn't aborted" :
+                  sim.transfers < 7 ? `${sim.transfers} WebUSB transfers, expected 4 and 3 issued again` :
+                  r.still_pending != 3 ? `${r.still_pending} other transfers still pending, expected 3` :
+                  Object.keys(r.statuses).some((s) => s != TRANSFER_CANCELLED) ?
+                    `unexpected transfer statuses ${JSON.stringify(r.statuses)}` : undefined,
+  },
+  {
+    // an application handling each 8 ms report for 20 ms: every report it gets should
+    // be the device's latest, less than a report interval (plus timer slack) old
+    name: "interrupt_report_age",
+    sim: { report_interval_ms: 8 },
+    client: interrupt_client,
+    args: { reports: 100, work_ms: 20 },
+    check: (r) => r.report_age_ms.p99 > 16 ? `p99 report age ${r.report_age_ms.p99.toFixed(1)} ms` : undefined,
+  },
+  {
+    // control transfers that stall, babble and hang while a 20 Msps stream runs: they must
+    // return LIBUSB_ERROR_PIPE, LIBUSB_ERROR_OVERFLOW and LIBUSB_ERROR_TIMEOUT, the device
+    // reset after the timeout must issue the stream's aborted transfers again (not fail
+    // them), and the device must work afterwards
+    name: "control_faults",
+    sim: { bandwidth: 40e6, control_faults: ["stall", "babble", "hang"] },
+    control: { transfers: ["out", "in", "out", "in"], length: 16, timeout: 100, start_ms: 200 },
+    client: stream_client,
+    args: { endpoint: ENDPOINT_IN, size: 262144, depth: 4, bytes: 64 << 20, timeout: 0 },
+    check: (r, sim) => {
+      let expected = [LIBUSB_ERROR_PIPE, LIBUSB_ERROR_OVERFLOW, LIBUSB_ERROR_TIMEOUT, 16];
+      if(JSON.stringify(r.control_results) != JSON.stringify(expected)) {
+        return `control transfers returned ${JSON.stringify(r.control_results)}, expected ${JSON.stringify(expected)}`;
+      }
+      if(sim.resets != 1) return `${sim.resets} device resets, expected 1`;
+      if(Object.keys(r.statuses).some((s) => s != TRANSFER_COMPLETED)) {
+        return `unexpected transfer statuses ${JSON.stringify(r.statuses)}`;
+      }
+      return undefined;
+    },
+  },
+  ...queue_depth_scenarios(),
+  ...iso_scenarios(),
+];
+
+
+// check the completions of a scenario against libusb semantics
+function check_result(scenario, result, sim) {
+  if(result.ordered === false) return "completions arrived out of submission order";
+  if(scenario.check !== undefined) return scenario.check(result, sim);
+  let failed = Object.keys(result.statuses || {}).some((s) => s != TRANSFER_COMPLETED);
+  let faults = ["error_rate", "stall_rate", "hang_rate"].some((f) => scenario.sim[f] !== undefined);
+  if(failed && !faults) {
+    return `unexpected transfer statuses ${JSON.stringify(result.statuses)}`;
+  }
+  return undefined;
+}
+
+
+// run a scenario's control transfers (see SCENARIOS) one after another, control.start_ms
+// into the run, on the engine's thread (as libusb_control_transfer runs them on the main
+// thread)
+// - returns each transfer's bytes transferred or libusb error
+async function run_control_transfers(device, control) {
+  await new Promise((resolve) => setTimeout(resolve, control.start_ms));
+  let results = [];
+  for(let direction of control.transfers) {
+    let setup = { requestType: "vendor", recipient: "device", request: 0, value: 0, index: 0 };
+    let result = (direction == "in") ? await _control_transfer_in(device, setup, control.length, control.timeout)
+                                     : await _control_transfer_out(device, setup, new Uint8Array(control.length), control.timeout);
+    results.push((typeof result == "number") ? result : result.byteLength);
+  }
+  return results;
+}
+
+
+// load the simulator and the transfer engine into this thread's global scope
+function load_engine() {
+  for(let file of ["usb-sim.js", "../src/webusb-io.js"]) {
+    let filename = path.join(__dirname, file);
+    vm.runInThisContext(fs.readFileSync(filename, "utf8"), { filename: filename });
+  }
+}
+
+
+// run block_ms of busy work every interval_ms on this thread, until stopped
+function run_ui_load(load) {
+  let timer = setInterval(() => {
+    let start = performance.now();
+    while(performance.now() - start < load.block_ms);
+  }, load.interval_ms);
+  return () => clearInterval(timer);
+}
+
+
+// start a scenario's UI load, returning a function that stops it
+function start_ui_load(load) {
+  if(load === undefined) return () => {};
+  if(load.io_worker !== true) return run_ui_load(load);
+  let worker = new worker_threads.Worker(__filename, { workerData: { ui_load: load } });
+  return () => worker.terminate();
+}
+
+
+// get latency percentiles (in microseconds) from a list of samples
+function percentiles(samples) {
+  let sorted = Float64Array.from(samples).sort();
+  let at = (p) => sorted.length > 0 ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] : 0;
+  return { p50: at(0.5), p90: at(0.9), p99: at(0.99), max: at(1) };
+}
+
+
+// run a scenario in this process: the engine on this thread, the client on a worker_thread
+async function run_scenario_here(scenario) {
+  let memory = new WebAssembly.Memory({ initial: MEMORY_PAGES, maximum: MEMORY_PAGES, shared: true });
+  globalThis.wasmMemory = memory;
+  globalThis.webusb_devices = [];
+  globalThis.runtime_config = { usb: Object.assign({}, scenario.usb) };
+  load_engine();
+
+  // stamp each completion with the time it's posted (see COMPLETION_TIME)
+  let heap_f64 = new Float64Array(memory.buffer);
+  let post_completion = _post_completion;
+  globalThis._post_completion = (r, status, actual_length) => {
+    if(!r.completed) heap_f64[(r.transfer + COMPLETION_TIME) >> 3] = performance.timeOrigin + performance.now();
+    post_completion(r, status, actual_length);
+  };
+
+  // open the simulated device, and start the engine on the shared rings
+  let usb = new SimulatedUSB(scenario.sim);
+  let device = usb.device;
+  await device.open();
+  await device.selectConfiguration(1);
+  await device.claimInterface(0);
+  webusb_devices[SIM_DEVICE_ID] = device;
+
+  let l = TRANSFER_LAYOUT;
+  _set_transfer_layout(l.device_id, l.stats_slot, l.submit_time, l.endpoint, l.type, l.status, l.length,
+                       l.actual_length, l.buffer, l.timeout, l.num_iso_packets, l.iso_packet_desc,
+                       l.iso_packet_size, l.iso_length, l.iso_actual_length, l.iso_status);
+  _set_transfer_stats(STATS, STATS_SLOTS, STATS_SIZE, STATS_VALUES * 8, STATS_HISTOGRAM_BUCKETS, 4);
+  for(let slot = 0; slot < STATS_SLOTS; slot++) heap_f64[((STATS + slot * STATS_SIZE) >> 3) + STAT_KEY] = -1;
+  _set_transfer_rings(SUBMISSION_RING, COMPLETION_RING, 0, 4, 8, RING_SIZE);
+  _run_transfer_dispatcher();
+
+  // count garbage collections on this thread (the engine's allocations)
+  let gc = { count: 0, ms: 0 };
+  let observer = new PerformanceObserver((list) => {
+    for(let entry of list.getEntries()) {
+      gc.count++;
+      gc.ms += entry.duration;
+    }
+  });
+  observer.observe({ entryTypes: ["gc"] });
+
+  // count the bytes allocated on this thread: the heap's growth, plus what each
+  // collection freed
+  let heap_start = v8.getHeapStatistics().used_heap_size;
+  let profiler = new v8.GCProfiler();
+  profiler.start();
+
+  // run the client
+  let stop_ui_load = start_ui_load(scenario.ui_load);
+  let cpu = process.cpuUsage();
+  let control = (scenario.control !== undefined) ? run_control_transfers(device, scenario.control) : undefined;
+  let client = await new Promise((resolve, reject) => {
+    let worker = new worker_threads.Worker(__filename, { workerData: { scenario: scenario.name, buffer: memory.buffer } });
+    worker.on("message", resolve);
+    worker.on("error", reject);
+  });
+  if(control !== undefined) client.control_results = await control;
+  cpu = process.cpuUsage(cpu);
+  stop_ui_load();
+  let allocated = v8.getHeapStatistics().used_heap_size - heap_start;
+  for(let c of profiler.stop().statistics) {
+    allocated += c.beforeGC.heapStatistics.usedHeapSize - c.afterGC.heapStatistics.usedHeapSize;
+  }
+  await new Promise((resolve) => setImmediate(resolve));
+  observer.disconnect();
+
+  let endpoints = _export_transfer_stats();
+  let error = check_result(scenario, client, device.stats);
+  let result = {
+    name: scenario.name,
+    ok: error === undefined,
+    error: error,
+    bytes_per_second: client.bytes_per_second,
+    transfers: client.transfers,
+    webusb_transfers: device.stats.transfers,
+    transfers_per_webusb_transfer: client.transfers / Math.max(device.stats.transfers, 1),
+    cpu_ms: (cpu.user + cpu.system) / 1000,
+    cpu_ms_per_mb: client.bytes > 0 ? (cpu.user + cpu.system) / 1000 / (client.bytes / 1e6) : null,
+    gc_count: gc.count,
+    gc_ms: gc.ms,
+    gc_per_1k_transfers: gc.count / Math.max(client.transfers, 1) * 1000,
+    allocated_bytes_per_transfer: allocated / Math.max(client.transfers, 1),
+    client: client,
+    sim: device.stats,
+    endpoints: endpoints.map((e) => ({
+      endpoint: e.endpoint,
+      completed: e.completed,
+      errors: e.errors,
+      cancelled: e.cancelled,
+      dropped: e.dropped,
+      max_in_flight: e.max_in_flight,
+      mean_dispatch_ms: e.mean_dispatch_ms,
+      mean_webusb_ms: e.mean_webusb_ms,
+      mean_copy_ms: e.mean_copy_ms,
+      latency_us: e.latency_us,
+    })),
+  };
+  return result;
+}
+
+
+// run the client side of a scenario on this worker_thread
+function run_client() {
+  let { scenario: name, buffer } = worker_threads.workerData;
+  let scenario = SCENARIOS.find((s) => s.name == name);
+  let libusb = new EmulatedLibusb(buffer);
+  let result = scenario.client(libusb, scenario.args);
+  result.callback_latency_us = percentiles(libusb.callback_latency_us);
+  result.wakeup_latency_us = percentiles(libusb.wakeup_latency_us);
+  worker_threads.parentPort.postMessage(result);
+}
+
+
+// run a scenario in a child process, returning its result
+function run_scenario(scenario) {
+  let run = child_process.spawnSync(process.execPath, [__filename, "--run", scenario.name], {
+    encoding: "utf8",
+    timeout: SCENARIO_TIMEOUT_MS,
+    maxBuffer: 64 * 1024 * 1024,
+  });
+  let line = (run.stdout || "").split("\n").find((l) => l.startsWith("ENGINE_RESULT "));
+  if(line === undefined) {
+    return { name: scenario.name, ok: false, error: run.error ? `${run.error}` : `no result (exit ${run.status})`,
+             stderr: (run.stderr || "").slice(-2000) };
+  }
+  return JSON.parse(line.substr("ENGINE_RESULT ".length));
+}
+
+
+// parse the command line options
+function parse_args(argv) {
+  let options = { filter: undefined, out: undefined, run: undefined };
+  for(let x = 0; x < argv.length; x++) {
+    switch(argv[x]) {
+      case "--filter": options.filter = argv[++x]; break;
+      case "--out":    options.out = argv[++x]; break;
+      case "--run":    options.run = argv[++x]; break;
+      default: throw `unknown option '${argv[x]}'`;
+    }
+  }
+  return options;
+}
+
+
+async function main() {
+  let options = parse_args(process.argv.slice(2));
+
+  // child process: run one scenario
+  if(options.run !== undefined) {
+    let result = await run_scenario_here(SCENARIOS.find((s) => s.name == options.run));
+    fs.writeSync(1, `ENGINE_RESULT ${JSON.stringify(result)}\n`);
+    process.exit(0);
+  }
+
+  let results = [];
+  for(let scenario of SCENARIOS.filter((s) => options.filter === undefined || s.name.includes(options.filter))) {
+    console.error(`running ${scenario.name}`);
+    results.push(run_scenario(scenario));
+  }
+  console.log(JSON.stringify(results, null, 2));
+
+  // merge the results into the output file
+  if(options.out !== undefined) {
+    let merged = fs.existsSync(options.out) ? JSON.parse(fs.readFileSync(options.out, "utf8")) : [];
+    for(let r of results) {
+      let index = merged.findIndex((m) => m.name == r.name);
+      if(index >= 0) merged[index] = r;
+      else merged.push(r);
+    }
+    merged.sort((a, b) => SCENARIOS.findIndex((s) => s.name == a.name) - SCENARIOS.findIndex((s) => s.name == b.name));
+    fs.writeFileSync(options.out, JSON.stringify(merged, null, 2) + "\n");
+  }
+
+  let failed = results.filter((r) => !r.ok);
+  for(let f of failed) console.error(`${f.name}: failed (${f.error})`);
+  process.exit(failed.length > 0 ? 1 : 0);
+}
+
+
+if(worker_threads.isMainThread) main();
+else if(worker_threads.workerData.ui_load !== undefined) run_ui_load(worker_threads.workerData.ui_load);
+else run_client();
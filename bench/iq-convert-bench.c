@@ -0,0 +1,87 @@
+#include <emscripten.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iq-convert.h"
+
+// IQ conversion kernel microbenchmark
+// - converts HackRF-sized buffers with the scalar and SIMD paths of iq-convert.c,
+//   checks that they agree, and prints the throughput of each as JSON
+// - built with -msimd128 by the Makefile bench-iq-convert target
+
+#define BUFFER_SIZE 262144 // libhackrf's transfer size
+#define ITERATIONS 400
+
+typedef size_t (*convert_fn)(struct iq_converter *c, const int8_t *input, size_t length, void *output);
+
+struct kernel_config {
+  const char * name;
+  enum iq_format format;
+  bool dc_removal;
+  int decimation;
+};
+
+const struct kernel_config CONFIGS[] = {
+  { "s16",          IQ_FORMAT_S16, false, 1 },
+  { "f32",          IQ_FORMAT_F32, false, 1 },
+  { "f32_dc",       IQ_FORMAT_F32, true,  1 },
+  { "f32_dc_dec4",  IQ_FORMAT_F32, true,  4 },
+  { "s16_dc_dec10", IQ_FORMAT_S16, true,  10 },
+};
+
+
+// run a kernel over the input, returning its throughput in input bytes per second
+double run_kernel(const struct kernel_config *config, convert_fn convert, const int8_t *input, uint8_t *output)
+{
+  struct iq_converter c;
+  iq_converter_init(&c, config->format, config->dc_removal, config->decimation);
+
+  double start = emscripten_get_now();
+  for(int x = 0; x < ITERATIONS; x++) convert(&c, input, BUFFER_SIZE, output);
+  double elapsed = emscripten_get_now() - start;
+  return (double)BUFFER_SIZE * ITERATIONS / (elapsed / 1000);
+}
+
+
+int main(int argc, char **argv)
+{
+  int8_t * input = malloc(BUFFER_SIZE);
+  srand(1);
+  for(int x = 0; x < BUFFER_SIZE; x++) input[x] = (int8_t)(rand() & 0xff);
+
+  int count = sizeof(CONFIGS) / sizeof(CONFIGS[0]);
+  int mismatches = 0;
+  printf("[\n");
+  for(int x = 0; x < count; x++) {
+    const struct kernel_config * config = &CONFIGS[x];
+    struct iq_converter c;
+    iq_converter_init(&c, config->format, config->dc_removal, config->decimation);
+    size_t size = iq_output_size(&c, BUFFER_SIZE);
+    uint8_t * scalar_output = malloc(size);
+    uint8_t * simd_output = malloc(size);
+
+    // both paths must produce the same samples
+    struct iq_converter a, b;
+    iq_converter_init(&a, config->format, config->dc_removal, config->decimation);
+    iq_converter_init(&b, config->format, config->dc_removal, config->decimation);
+    size_t scalar_length = iq_convert_scalar(&a, input, BUFFER_SIZE, scalar_output);
+    size_t simd_length = iq_convert(&b, input, BUFFER_SIZE, simd_output);
+    bool match = scalar_length == simd_length && memcmp(scalar_output, simd_output, scalar_length) == 0;
+    if(!match) mismatches++;
+
+    double scalar = run_kernel(config, iq_convert_scalar, input, scalar_output);
+    double simd = run_kernel(config, iq_convert, input, simd_output);
+    printf("  { \"name\": \"%s\", \"scalar_mb_per_second\": %.1f, \"simd_mb_per_second\": %.1f, "
+           "\"speedup\": %.2f, \"match\": %s }%s\n",
+           config->name, scalar / 1e6, simd / 1e6, simd / scalar, match ? "true" : "false",
+           (x < count - 1) ? "," : "");
+
+    free(scalar_output);
+    free(simd_output);
+  }
+  printf("]\n");
+
+  free(input);
+  return mismatches > 0 ? 1 : 0;
+}
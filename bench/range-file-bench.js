@@ -0,0 +1,282 @@
+// lazily-fetched input file benchmark
+// - serves generated input files with run-web-server.sh (which handles range requests),
+//   and reads them through client/range-file.js under Node.js, with a stub Emscripten FS,
+//   as hackrf_transfer -t reads its input with fread
+// - the synchronous XHR range-file.js falls back to on a cache miss is emulated by a
+//   helper thread that fetches the range while this thread blocks in Atomics.wait
+// - reports the time to the first sample (which shouldn't depend on the file size),
+//   read throughput, how many chunks had to be fetched synchronously, and peak memory;
+//   the run fails if any data read doesn't match the file
+// - with --out <file>, the results are merged into a JSON file by scenario name
+//
+// usage: node bench/range-file-bench.js [--filter <name>] [--out <file>]
+
+const child_process = require("child_process");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+const vm = require("vm");
+const worker_threads = require("worker_threads");
+
+
+// the server run-web-server.sh starts
+const SERVER_URL = "http://127.0.0.1:8000";
+const SERVER_START_TIMEOUT_MS = 10000;
+
+// largest range the synchronous XHR stub can return (range-file.js's chunk size)
+const SYNC_FETCH_MAX_BYTES = 4 * 1024 * 1024;
+
+
+// benchmark scenarios: read a file of file_size bytes in read_size reads, at up to
+// bytes_per_second (or as fast as possible)
+const SCENARIOS = [
+  {
+    // hackrf_transfer -t at 10 Msps, from a 64 MiB and a 1 GiB file
+    name: "range_file_64m_10msps",
+    file_size: 64 << 20,
+    read_size: 262144,
+    bytes_per_second: 20e6,
+    read_bytes: 64 << 20,
+  },
+  {
+    name: "range_file_1g_10msps",
+    file_size: 1 << 30,
+    read_size: 262144,
+    bytes_per_second: 20e6,
+    read_bytes: 64 << 20,
+  },
+  {
+    // the whole 1 GiB file, as fast as it can be read
+    name: "range_file_1g_unpaced",
+    file_size: 1 << 30,
+    read_size: 262144,
+    read_bytes: 1 << 30,
+  },
+];
+
+
+// byte of the generated input files at an offset
+// - varies with the offset's high bits too, so a misplaced chunk is caught
+function file_byte(offset) {
+  return (offset * 7 + Math.floor(offset / 4096) * 13) & 0xff;
+}
+
+
+// write a generated input file
+function write_input_file(filename, size) {
+  let block = Buffer.alloc(1 << 20);
+  let fd = fs.openSync(filename, "w");
+  for(let offset = 0; offset < size; offset += block.length) {
+    for(let x = 0; x < block.length; x++) block[x] = file_byte(offset + x);
+    fs.writeSync(fd, block, 0, Math.min(block.length, size - offset));
+  }
+  fs.closeSync(fd);
+}
+
+
+// start run-web-server.sh, serving dir/build
+async function start_server(dir) {
+  let server = child_process.spawn("bash", [path.join(__dirname, "../run-web-server.sh")],
+                                   { cwd: dir, stdio: "ignore", detached: true });
+  let start = performance.now();
+  while(performance.now() - start < SERVER_START_TIMEOUT_MS) {
+    try {
+      await fetch(SERVER_URL, { method: "HEAD" });
+      return server;
+    } catch (error) {
+      await new Promise((resolve) => setTimeout(resolve, 100));
+    }
+  }
+  process.kill(-server.pid);
+  throw "run-web-server.sh didn't start";
+}
+
+
+// emulated synchronous XHR, fetching on a helper thread (see run_fetch_helper)
+// - only what range-file.js's range_file_fetch_sync uses
+function make_sync_xhr(stats) {
+  let shared = new SharedArrayBuffer(8 + SYNC_FETCH_MAX_BYTES);
+  let header = new Int32Array(shared, 0, 2);
+  let body = new Uint8Array(shared, 8);
+  let helper = new worker_threads.Worker(__filename, { workerData: { fetch_helper: shared } });
+  helper.unref();
+
+  class XMLHttpRequest {
+    open(method, url) { this.url = url; this.headers = {}; }
+    setRequestHeader(name, value) { this.headers[name] = value; }
+    overrideMimeType() {}
+    send() {
+      stats.sync_fetches++;
+      Atomics.store(header, 0, 0);
+      helper.postMessage({ url: this.url, headers: this.headers });
+      Atomics.wait(header, 0, 0);
+      this.status = Atomics.load(header, 0);
+      let length = header[1];
+      let text = "";
+      for(let x = 0; x < length; x += 65536) {
+        text += String.fromCharCode.apply(null, body.subarray(x, Math.min(x + 65536, length)));
+      }
+      this.responseText = text;
+    }
+  }
+  return { XMLHttpRequest: XMLHttpRequest, stop: () => helper.terminate() };
+}
+
+
+// fetch ranges for make_sync_xhr, on a helper thread
+function run_fetch_helper(shared) {
+  let header = new Int32Array(shared, 0, 2);
+  let body = new Uint8Array(shared, 8);
+  worker_threads.parentPort.on("message", async (request) => {
+    let status = 599;
+    try {
+      let res = await fetch(request.url, { headers: request.headers });
+      let data = new Uint8Array(await res.arrayBuffer());
+      body.set(data.subarray(0, SYNC_FETCH_MAX_BYTES));
+      header[1] = Math.min(data.length, SYNC_FETCH_MAX_BYTES);
+      status = res.status;
+    } catch (error) {
+      header[1] = 0;
+    }
+    Atomics.store(header, 0, status);
+    Atomics.notify(header, 0);
+  });
+}
+
+
+// run a scenario against a fresh copy of range-file.js
+async function run_scenario(scenario, dir) {
+  let filename = `input-${scenario.file_size}.iq`;
+  let url = `${SERVER_URL}/${filename}`;
+  let stats = { sync_fetches: 0, range_requests: 0 };
+  let xhr = make_sync_xhr(stats);
+
+  // stub Emscripten FS: records the registered device
+  let devices = new Map();
+  let nodes = new Map();
+  let context = vm.createContext({
+    fetch: (url, options) => {
+      stats.range_requests++;
+      return fetch(url, options);
+    },
+    XMLHttpRequest: xhr.XMLHttpRequest,
+    FS: {
+      makedev: (major, minor) => (major << 8) | minor,
+      registerDevice: (dev, ops) => devices.set(dev, ops),
+      mkdev: (path, mode, dev) => nodes.set(path, dev),
+      ErrnoError: class extends Error {},
+    },
+    ERRNO_CODES: { EIO: 5, EINVAL: 22, EROFS: 30 },
+    console: console,
+  });
+  let source = path.join(__dirname, "../client/range-file.js");
+  vm.runInContext(fs.readFileSync(source, "utf8"), context, { filename: source });
+
+  // open the file and read its first samples
+  let heap = new Uint8Array(scenario.read_size);
+  let start = performance.now();
+  if(!await context.create_range_file(url, "/transmit.iq")) throw "the server doesn't support range requests";
+  let ops = devices.get(nodes.get("/transmit.iq"));
+  let stream = {};
+  ops.open(stream);
+
+  // read the file, letting prefetches progress between reads (as the browser's event
+  // loop does between proxied reads), and check what's read
+  let first_sample_ms = undefined;
+  let mismatches = 0;
+  let position = 0;
+  let peak = { array_buffers: 0, rss: 0 };
+  while(position < scenario.read_bytes) {
+    let length = ops.read(stream, heap, 0, Math.min(scenario.read_size, scenario.read_bytes - position), position);
+    if(length == 0) break;
+    if(first_sample_ms === undefined) first_sample_ms = performance.now() - start;
+    for(let x = 0; x < length; x += 4093) {
+      if(heap[x] != file_byte(position + x)) mismatches++;
+    }
+    position += length;
+
+    let usage = process.memoryUsage();
+    peak.array_buffers = Math.max(peak.array_buffers, usage.arrayBuffers);
+    peak.rss = Math.max(peak.rss, usage.rss);
+    let due = (scenario.bytes_per_second !== undefined) ? start + position / scenario.bytes_per_second * 1000 : 0;
+    await new Promise((resolve) => setTimeout(resolve, Math.max(0, due - performance.now())));
+  }
+  let elapsed_ms = performance.now() - start;
+  xhr.stop();
+
+  let error = position != scenario.read_bytes ? `read ${position} of ${scenario.read_bytes} bytes` :
+              mismatches > 0 ? `${mismatches} bytes read didn't match the file` : undefined;
+  return {
+    name: scenario.name,
+    ok: error === undefined,
+    error: error,
+    file_size: scenario.file_size,
+    bytes_read: position,
+    first_sample_ms: first_sample_ms,
+    bytes_per_second: position / (elapsed_ms / 1000),
+    range_requests: stats.range_requests,
+    sync_fetches: stats.sync_fetches,
+    peak_array_buffers: peak.array_buffers,
+    peak_rss: peak.rss,
+  };
+}
+
+
+// parse the command line options
+function parse_args(argv) {
+  let options = { filter: undefined, out: undefined };
+  for(let x = 0; x < argv.length; x++) {
+    switch(argv[x]) {
+      case "--filter": options.filter = argv[++x]; break;
+      case "--out":    options.out = argv[++x]; break;
+      default: throw `unknown option '${argv[x]}'`;
+    }
+  }
+  return options;
+}
+
+
+async function main() {
+  let options = parse_args(process.argv.slice(2));
+  let scenarios = SCENARIOS.filter((s) => options.filter === undefined || s.name.includes(options.filter));
+
+  // generate the input files, and serve them
+  let dir = fs.mkdtempSync(path.join(os.tmpdir(), "range-file-bench-"));
+  fs.mkdirSync(path.join(dir, "build"));
+  for(let size of new Set(scenarios.map((s) => s.file_size))) {
+    write_input_file(path.join(dir, "build", `input-${size}.iq`), size);
+  }
+  let server = await start_server(dir);
+
+  let results = [];
+  try {
+    for(let scenario of scenarios) {
+      console.error(`running ${scenario.name}`);
+      results.push(await run_scenario(scenario, dir));
+    }
+  } finally {
+    process.kill(-server.pid);
+    fs.rmSync(dir, { recursive: true });
+  }
+  console.log(JSON.stringify(results, null, 2));
+
+  // merge the results into the output file
+  if(options.out !== undefined) {
+    let merged = fs.existsSync(options.out) ? JSON.parse(fs.readFileSync(options.out, "utf8")) : [];
+    for(let r of results) {
+      let index = merged.findIndex((m) => m.name == r.name);
+      if(index >= 0) merged[index] = r;
+      else merged.push(r);
+    }
+    merged.sort((a, b) => SCENARIOS.findIndex((s) => s.name == a.name) - SCENARIOS.findIndex((s) => s.name == b.name));
+    fs.writeFileSync(options.out, JSON.stringify(merged, null, 2) + "\n");
+  }
+
+  let failed = results.filter((r) => !r.ok);
+  for(let f of failed) console.error(`${f.name}: failed (${f.error})`);
+  process.exit(failed.length > 0 ? 1 : 0);
+}
+
+
+if(worker_threads.isMainThread) main();
+else run_fetch_helper(worker_threads.workerData.fetch_helper);
@@ -0,0 +1,263 @@
+// headless benchmark runner
+// - runs the Node.js builds of the hackrf tools (see the Makefile bench target)
+//   against the simulated WebUSB device in usb-sim.js, and prints the results as JSON
+// - with --baseline <file>, compares throughput (or wall time, for scenarios without
+//   bulk transfers) against an earlier run and exits non-zero if any scenario
+//   regressed by more than --tolerance (default 0.1)
+// - with --multicall, runs the hackrf tools through the multi-call module (hackrf.js), and
+//   skips the other scenarios
+// - with --record <dir>, saves each scenario's USB traffic as <dir>/<name>.bin, and with
+//   --replay <dir>, replays those traces instead of the simulator, at recorded speed, or
+//   as fast as possible with --replay-speed max
+//
+// usage: node bench/run-bench.js [--build <dir>] [--filter <name>] [--baseline <file>] [--tolerance <fraction>]
+//                                [--record <dir> | --replay <dir> [--replay-speed recorded|max]] [--multicall]
+
+const child_process = require("child_process");
+const fs = require("fs");
+const path = require("path");
+
+
+// firmware image for the SPI flash scenarios
+// - random data, with the platform marker hackrf_spiflash looks for before writing
+const SPIFLASH_IMAGE = { path: "/firmware.bin", size: 256 * 1024, marker: "HACKRF_ONE" };
+
+
+// bulk IN streaming scenarios (bench/bulk-bench.c), for each transfer size, with and
+// without coalescing (see usb.coalesce in client/config.js)
+// - the simulated bus charges a fixed cost per WebUSB transfer, which coalescing amortizes
+function bulk_scenarios() {
+  let scenarios = [];
+  for(let size of [16384, 32768, 65536]) {
+    for(let coalesce of [false, true]) {
+      scenarios.push({
+        name: `bulk_in_${size / 1024}k${coalesce ? "_coalesced" : ""}`,
+        tool: "bulk-bench",
+        args: ["-s", `${size}`, "-d", "16", "-b", `${64 << 20}`],
+        sim: { bandwidth: 40e6, overhead_ms: 0.1 },
+        usb: { coalesce: coalesce },
+      });
+    }
+  }
+  return scenarios;
+}
+
+
+// synchronous transfer round-trip scenarios (bench/sync-latency.c), waiting from main()
+// (the main thread in Asyncify builds) and from a pthread
+function sync_latency_scenarios() {
+  return [false, true].map((pthread) => ({
+    name: `sync_round_trip${pthread ? "_pthread" : ""}`,
+    tool: "sync-latency",
+    args: ["-n", "10000", "-s", "64", ...(pthread ? ["-p"] : [])],
+    sim: { latency_ms: 0 },
+  }));
+}
+
+
+// startup scenarios, one per hackrf tool
+// - each tool only prints its usage, so the run measures loading, compiling and
+//   instantiating the module (runtime_ready_ms) and the tool's exit
+function startup_scenarios() {
+  return ["hackrf_info", "hackrf_clock", "hackrf_transfer", "hackrf_spiflash"].map((tool) => ({
+    name: `startup_${tool}`,
+    tool: tool,
+    args: ["-h"],
+    allow_failure: true,
+  }));
+}
+
+
+// benchmark scenarios
+// - sim: simulator options (see USB_SIM_DEFAULTS in usb-sim.js)
+// - usb: runtime_config.usb options (see client/config.js)
+// - files: input files created before the tool runs (see bench-runtime.js)
+// - allow_failure: the tool may exit with an error (e.g. on injected faults)
+const SCENARIOS = [
+  {
+    name: "hackrf_info",
+    tool: "hackrf_info",
+    args: [],
+  },
+  ...startup_scenarios(),
+  {
+    name: "hackrf_info_slow_enumeration",
+    tool: "hackrf_info",
+    args: [],
+    sim: { enumerate_ms: 50 },
+  },
+  {
+    // 1024 256-byte SPI flash writes, sent as batches of pipelined control transfers
+    name: "spiflash_write",
+    tool: "hackrf_spiflash",
+    args: ["-w", "/firmware.bin"],
+    files: [SPIFLASH_IMAGE],
+    usb: { batch_control: true },
+  },
+  {
+    name: "spiflash_write_unbatched",
+    tool: "hackrf_spiflash",
+    args: ["-w", "/firmware.bin"],
+    files: [SPIFLASH_IMAGE],
+  },
+  {
+    name: "rx_20msps",
+    tool: "hackrf_transfer",
+    args: ["-r", "/dev/null", "-f", "915000000", "-s", "20000000", "-n", "100000000"],
+    sim: { bandwidth: 40e6 },
+  },
+  {
+    name: "rx_20msps_high_latency",
+    tool: "hackrf_transfer",
+    args: ["-r", "/dev/null", "-f", "915000000", "-s", "20000000", "-n", "100000000"],
+    sim: { bandwidth: 40e6, latency_ms: 2 },
+  },
+  {
+    name: "rx_20msps_f32_dc",
+    tool: "hackrf_transfer",
+    args: ["-r", "/dev/null", "-f", "915000000", "-s", "20000000", "-n", "100000000"],
+    sim: { bandwidth: 40e6 },
+    usb: { iq_conversion: { format: "f32", dc_removal: true } },
+  },
+  {
+    name: "tx_10msps",
+    tool: "hackrf_transfer",
+    args: ["-t", "/dev/urandom", "-f", "915000000", "-s", "10000000", "-n", "50000000"],
+    sim: { bandwidth: 20e6 },
+  },
+  ...bulk_scenarios(),
+  {
+    name: "rx_10msps_faults",
+    tool: "hackrf_transfer",
+    args: ["-r", "/dev/null", "-f", "915000000", "-s", "10000000", "-n", "50000000"],
+    sim: { bandwidth: 20e6, error_rate: 0.001, stall_rate: 0.001 },
+    allow_failure: true,
+  },
+  ...sync_latency_scenarios(),
+];
+
+
+// per-scenario timeout
+const SCENARIO_TIMEOUT_MS = 120000;
+
+
+// parse the command line options
+function parse_args(argv) {
+  let options = { build: "build-bench", filter: undefined, baseline: undefined, tolerance: 0.1,
+                  record: undefined, replay: undefined, replay_speed: "recorded", multicall: false };
+  for(let x = 0; x < argv.length; x++) {
+    switch(argv[x]) {
+      case "--build":     options.build = argv[++x]; break;
+      case "--filter":    options.filter = argv[++x]; break;
+      case "--baseline":  options.baseline = argv[++x]; break;
+      case "--tolerance": options.tolerance = parseFloat(argv[++x]); break;
+      case "--record":    options.record = argv[++x]; break;
+      case "--replay":    options.replay = argv[++x]; break;
+      case "--replay-speed": options.replay_speed = argv[++x]; break;
+      case "--multicall": options.multicall = true; break;
+      default: throw `unknown option '${argv[x]}'`;
+    }
+  }
+  return options;
+}
+
+
+// run a scenario, returning its result
+function run_scenario(scenario, options) {
+  let module = options.multicall ? "hackrf" : scenario.tool;
+  let args = options.multicall ? [scenario.tool, ...scenario.args] : scenario.args;
+  let loader = path.join(options.build, `${module}.js`);
+  let config = { sim: scenario.sim || {}, usb: scenario.usb || {}, files: scenario.files || [] };
+  if(options.record !== undefined) {
+    fs.mkdirSync(options.record, { recursive: true });
+    config.record_path = path.join(options.record, `${scenario.name}.bin`);
+  }
+  if(options.replay !== undefined) {
+    config.replay_path = path.join(options.replay, `${scenario.name}.bin`);
+    config.replay_speed = options.replay_speed;
+  }
+  let started = process.hrtime.bigint();
+  let run = child_process.spawnSync(process.execPath, [loader, ...args], {
+    env: Object.assign({}, process.env, { BENCH_CONFIG: JSON.stringify(config) }),
+    encoding: "utf8",
+    timeout: SCENARIO_TIMEOUT_MS,
+    maxBuffer: 64 * 1024 * 1024,
+  });
+  let elapsed_ms = Number(process.hrtime.bigint() - started) / 1e6;
+
+  // find the result line written by bench-runtime.js
+  let line = (run.stderr || "").split("\n").find((l) => l.startsWith("BENCH_RESULT "));
+  if(line === undefined) {
+    return { name: scenario.name, ok: false, error: run.error ? `${run.error}` : `no result (exit ${run.status})`,
+             stderr: (run.stderr || "").slice(-2000) };
+  }
+  let result = JSON.parse(line.substr("BENCH_RESULT ".length));
+
+  // summarize the transfer statistics across endpoints
+  let summary = { name: scenario.name, ok: result.status == 0 || scenario.allow_failure === true, elapsed_ms: elapsed_ms };
+  Object.assign(summary, result);
+  let bytes = result.endpoints.reduce((a, e) => a + e.bytes, 0);
+  summary.bytes_per_second = result.endpoints.reduce((a, e) => a + e.bytes_per_second, 0);
+  summary.p99_latency_us = result.endpoints.reduce((a, e) => Math.max(a, e.latency_us.p99), 0);
+  summary.cpu_ms_per_mb = bytes > 0 ? (result.cpu_user_ms + result.cpu_system_ms) / (bytes / 1e6) : null;
+  summary.control_transfers_per_second = result.sim ? result.sim.control_transfers / (result.wall_ms / 1000) : null;
+  summary.metrics = parse_metrics(run.stdout || "");
+  summary.wasm_bytes = fs.statSync(path.join(options.build, `${module}.wasm`), { throwIfNoEntry: false })?.size;
+  return summary;
+}
+
+
+// collect the "BENCH_METRIC <name> <value>" lines printed by the bench tools
+function parse_metrics(stdout) {
+  let metrics = {};
+  for(let line of stdout.split("\n")) {
+    let fields = line.split(" ");
+    if(fields.length == 3 && fields[0] == "BENCH_METRIC") metrics[fields[1]] = parseFloat(fields[2]);
+  }
+  return metrics;
+}
+
+
+// compare results against a baseline, returning the list of regressions
+function find_regressions(results, baseline, tolerance) {
+  let regressions = [];
+  for(let r of results) {
+    let b = baseline.find((x) => x.name == r.name);
+    if(b === undefined || !b.ok || !r.ok) continue;
+    if(b.bytes_per_second > 0 && r.bytes_per_second < b.bytes_per_second * (1 - tolerance)) {
+      regressions.push(`${r.name}: throughput ${(r.bytes_per_second / 1e6).toFixed(2)} MB/s, ` +
+                       `baseline ${(b.bytes_per_second / 1e6).toFixed(2)} MB/s`);
+    }
+
+    // scenarios without bulk transfers (hackrf_info) measure startup and enumeration time
+    if(b.bytes_per_second == 0 && r.wall_ms > b.wall_ms * (1 + tolerance)) {
+      regressions.push(`${r.name}: wall time ${r.wall_ms.toFixed(1)} ms, baseline ${b.wall_ms.toFixed(1)} ms`);
+    }
+  }
+  return regressions;
+}
+
+
+function main() {
+  let options = parse_args(process.argv.slice(2));
+  let scenarios = SCENARIOS.filter((s) => options.filter === undefined || s.name.includes(options.filter))
+                           .filter((s) => !options.multicall || s.tool.startsWith("hackrf_"));
+
+  let results = [];
+  for(let scenario of scenarios) {
+    console.error(`running ${scenario.name}`);
+    results.push(run_scenario(scenario, options));
+  }
+  console.log(JSON.stringify(results, null, 2));
+
+  // check for regressions
+  let failed = results.filter((r) => !r.ok).map((r) => `${r.name}: failed (${r.error || `status ${r.status}`})`);
+  if(options.baseline !== undefined) {
+    let baseline = JSON.parse(fs.readFileSync(options.baseline, "utf8"));
+    failed = failed.concat(find_regressions(results, baseline, options.tolerance));
+  }
+  for(let f of failed) console.error(f);
+  process.exit(failed.length > 0 ? 1 : 0);
+}
+
+main();
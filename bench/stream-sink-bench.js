@@ -0,0 +1,211 @@
+// streaming output sink benchmark
+// - runs client/stream-sink.js under Node.js, with a stub Emscripten FS and a stub OPFS
+//   writable stream (which only counts and spot-checks what it's given), and writes a
+//   multi-GB synthetic capture through the sink's FS device, as hackrf_transfer -r does
+//   with fwrite
+// - memory is sampled as the capture is written, and the run fails if the JS heap or
+//   array buffer memory at the end of the capture is larger than at its start
+// - with --out <file>, the results are merged into a JSON file by scenario name
+//
+// usage: node bench/stream-sink-bench.js [--filter <name>] [--out <file>]
+
+const fs = require("fs");
+const path = require("path");
+const vm = require("vm");
+
+
+// size of the simulated wasm heap the capture is written from
+const HEAP_SIZE = 16 << 20;
+
+// memory samples taken over a capture
+const SAMPLES = 64;
+
+// growth in memory use tolerated between the start and end of a capture
+const GROWTH_TOLERANCE_BYTES = 16 << 20;
+
+// time allowed for the sink to finish writing once the capture ends
+const FINISH_TIMEOUT_MS = 10000;
+
+
+// benchmark scenarios: capture bytes written in write_size chunks
+const SCENARIOS = [
+  {
+    // a 4 GiB capture, written in hackrf_transfer's 256 KiB transfers
+    name: "stream_sink_4g",
+    bytes: 4 * 1024 * 1024 * 1024,
+    write_size: 262144,
+  },
+  {
+    // the same capture, written in stdio-sized chunks
+    name: "stream_sink_4g_small_writes",
+    bytes: 4 * 1024 * 1024 * 1024,
+    write_size: 4096,
+  },
+];
+
+
+// stub OPFS writable stream, checking each chunk's first byte against the pattern
+// written at its offset
+class StubWritable {
+
+  constructor(heap) {
+    this.heap = heap;
+    this.bytes = 0;
+    this.writes = 0;
+    this.mismatches = 0;
+    this.closed = false;
+  }
+
+  async write(chunk) {
+    if(chunk[0] != this.heap[this.bytes % HEAP_SIZE]) this.mismatches++;
+    this.bytes += chunk.length;
+    this.writes++;
+  }
+
+  async close() {
+    this.closed = true;
+  }
+}
+
+
+// get the memory in use
+function memory_usage() {
+  let usage = process.memoryUsage();
+  return { heap_used: usage.heapUsed, array_buffers: usage.arrayBuffers, rss: usage.rss };
+}
+
+
+// run a scenario against a fresh copy of stream-sink.js
+async function run_scenario(scenario) {
+
+  // simulated wasm heap, holding a synthetic capture pattern
+  let heap = new Int8Array(HEAP_SIZE);
+  for(let x = 0; x < HEAP_SIZE; x++) heap[x] = (x * 7) & 0xff;
+  let writable = new StubWritable(heap);
+
+  // stub Emscripten FS: records the registered device
+  let devices = new Map();
+  let nodes = new Map();
+  let context = vm.createContext({
+    navigator: {
+      storage: {
+        getDirectory: async () => ({
+          getFileHandle: async () => ({ createWritable: async () => writable, getFile: async () => ({}) }),
+        }),
+      },
+    },
+    FS: {
+      makedev: (major, minor) => (major << 8) | minor,
+      registerDevice: (dev, ops) => devices.set(dev, ops),
+      mkdev: (path, mode, dev) => nodes.set(path, dev),
+    },
+    print_error: (msg) => console.error(msg),
+    print_info: (msg) => console.error(msg),
+    emit_blob: () => {},
+  });
+  let filename = path.join(__dirname, "../client/stream-sink.js");
+  vm.runInContext(fs.readFileSync(filename, "utf8"), context, { filename: filename });
+
+  await context.create_stream_sink("/receive.iq");
+  let ops = devices.get(nodes.get("/receive.iq"));
+  let stream = {};
+  ops.open(stream);
+
+  // write the capture, letting the writable stream drain between writes, as the
+  // browser's event loop does between proxied writes
+  global.gc?.();
+  let start = performance.now();
+  let samples = [];
+  let sample_every = scenario.bytes / SAMPLES;
+  let max_backlog = 0;
+  let written = 0;
+  while(written < scenario.bytes) {
+    let offset = written % HEAP_SIZE;
+    let length = Math.min(scenario.write_size, HEAP_SIZE - offset, scenario.bytes - written);
+    ops.write(stream, heap, offset, length, written);
+    written += length;
+    max_backlog = Math.max(max_backlog, context.stream_sinks.get("/receive.iq").backlog);
+    if(written % (1 << 20) < length) await new Promise((resolve) => setImmediate(resolve));
+    if(written >= (samples.length + 1) * sample_every) samples.push(memory_usage());
+  }
+  let finished = await Promise.race([
+    context.emit_stream_sink("/receive.iq").then(() => true),
+    new Promise((resolve) => setTimeout(resolve, FINISH_TIMEOUT_MS, false)),
+  ]);
+  let elapsed_ms = performance.now() - start;
+
+  // compare the memory in use over the first and last eighths of the capture
+  let eighth = Math.max(1, Math.floor(samples.length / 8));
+  let peak = (list, key) => Math.max(...list.map((s) => s[key]));
+  let first = samples.slice(0, eighth);
+  let last = samples.slice(-eighth);
+  let result = {
+    name: scenario.name,
+    bytes: written,
+    write_size: scenario.write_size,
+    elapsed_ms: elapsed_ms,
+    bytes_per_second: written / (elapsed_ms / 1000),
+    bytes_stored: writable.bytes,
+    mismatched_chunks: writable.mismatches,
+    max_backlog_bytes: max_backlog,
+    first_heap_used: peak(first, "heap_used"),
+    last_heap_used: peak(last, "heap_used"),
+    first_array_buffers: peak(first, "array_buffers"),
+    last_array_buffers: peak(last, "array_buffers"),
+    first_rss: peak(first, "rss"),
+    last_rss: peak(last, "rss"),
+  };
+
+  let error = undefined;
+  if(!finished) error = "the sink didn't finish writing";
+  else if(writable.bytes != written || !writable.closed) error = `${writable.bytes} of ${written} bytes stored`;
+  else if(writable.mismatches > 0) error = `${writable.mismatches} chunks stored out of order`;
+  else if(result.last_heap_used > result.first_heap_used + GROWTH_TOLERANCE_BYTES) error = "the JS heap grew";
+  else if(result.last_array_buffers > result.first_array_buffers + GROWTH_TOLERANCE_BYTES) error = "array buffer memory grew";
+  return Object.assign({ name: scenario.name, ok: error === undefined, error: error }, result);
+}
+
+
+// parse the command line options
+function parse_args(argv) {
+  let options = { filter: undefined, out: undefined };
+  for(let x = 0; x < argv.length; x++) {
+    switch(argv[x]) {
+      case "--filter": options.filter = argv[++x]; break;
+      case "--out":    options.out = argv[++x]; break;
+      default: throw `unknown option '${argv[x]}'`;
+    }
+  }
+  return options;
+}
+
+
+async function main() {
+  let options = parse_args(process.argv.slice(2));
+
+  let results = [];
+  for(let scenario of SCENARIOS.filter((s) => options.filter === undefined || s.name.includes(options.filter))) {
+    console.error(`running ${scenario.name}`);
+    results.push(await run_scenario(scenario));
+  }
+  console.log(JSON.stringify(results, null, 2));
+
+  // merge the results into the output file
+  if(options.out !== undefined) {
+    let merged = fs.existsSync(options.out) ? JSON.parse(fs.readFileSync(options.out, "utf8")) : [];
+    for(let r of results) {
+      let index = merged.findIndex((m) => m.name == r.name);
+      if(index >= 0) merged[index] = r;
+      else merged.push(r);
+    }
+    merged.sort((a, b) => SCENARIOS.findIndex((s) => s.name == a.name) - SCENARIOS.findIndex((s) => s.name == b.name));
+    fs.writeFileSync(options.out, JSON.stringify(merged, null, 2) + "\n");
+  }
+
+  let failed = results.filter((r) => !r.ok);
+  for(let f of failed) console.error(`${f.name}: failed (${f.error})`);
+  process.exit(failed.length > 0 ? 1 : 0);
+}
+
+
+main();
@@ -0,0 +1,97 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <emscripten.h>
+#include <libusb.h>
+
+// synchronous transfer round-trip latency microbenchmark
+// - times back-to-back small libusb_bulk_transfer calls on the simulated device's IN
+//   endpoint, from main() (the browser main thread in Asyncify/JSPI builds, which waits
+//   by suspending) or, with -p, from a pthread (which waits on a futex)
+// - results are printed as "BENCH_METRIC <name> <value>" lines (see run-bench.js)
+//
+// usage: sync-latency [-n <transfers>] [-s <transfer size>] [-p]
+
+#define VENDOR_ID 0x1d50
+#define PRODUCT_ID 0x6089
+#define ENDPOINT_IN 0x81
+
+libusb_device_handle * handle = NULL;
+int transfer_count = 10000;
+int transfer_size = 64;
+double * round_trips_us = NULL;
+bool failed = false;
+
+
+void * run_transfers(void *arg)
+{
+  unsigned char * data = malloc(transfer_size);
+  for(int x = 0; x < transfer_count; x++) {
+    int actual = 0;
+    double start = emscripten_get_now();
+    if(libusb_bulk_transfer(handle, ENDPOINT_IN, data, transfer_size, &actual, 1000) < 0) {
+      fprintf(stderr, "sync-latency: transfer failed\n");
+      failed = true;
+      break;
+    }
+    round_trips_us[x] = (emscripten_get_now() - start) * 1000.0;
+  }
+  free(data);
+  return NULL;
+}
+
+
+int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+int main(int argc, char **argv)
+{
+  bool on_pthread = false;
+  int opt;
+  while((opt = getopt(argc, argv, "n:s:p")) != -1) {
+    switch(opt) {
+      case 'n': transfer_count = atoi(optarg); break;
+      case 's': transfer_size = atoi(optarg); break;
+      case 'p': on_pthread = true; break;
+      default:
+        fprintf(stderr, "usage: sync-latency [-n <transfers>] [-s <transfer size>] [-p]\n");
+        return 1;
+    }
+  }
+
+  if(libusb_init(NULL) < 0) return 1;
+  handle = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+  if(handle == NULL || libusb_set_configuration(handle, 1) < 0 || libusb_claim_interface(handle, 0) < 0) {
+    fprintf(stderr, "sync-latency: could not open the device\n");
+    return 1;
+  }
+
+  round_trips_us = calloc(transfer_count, sizeof(double));
+  if(on_pthread) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_transfers, NULL);
+    pthread_join(thread, NULL);
+  } else {
+    run_transfers(NULL);
+  }
+
+  qsort(round_trips_us, transfer_count, sizeof(double), compare_doubles);
+  double total = 0;
+  for(int x = 0; x < transfer_count; x++) total += round_trips_us[x];
+  printf("BENCH_METRIC mean_round_trip_us %.1f\n", total / transfer_count);
+  printf("BENCH_METRIC p50_round_trip_us %.1f\n", round_trips_us[transfer_count / 2]);
+  printf("BENCH_METRIC p99_round_trip_us %.1f\n", round_trips_us[transfer_count * 99 / 100]);
+  printf("BENCH_METRIC max_round_trip_us %.1f\n", round_trips_us[transfer_count - 1]);
+
+  free(round_trips_us);
+  libusb_release_interface(handle, 0);
+  libusb_close(handle);
+  libusb_exit(NULL);
+  return failed ? 1 : 0;
+}
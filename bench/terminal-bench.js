@@ -0,0 +1,237 @@
+// terminal rendering benchmark
+// - runs client/terminal.js under Node.js against a stub DOM, with its synthetic print
+//   load (terminal_start_stress), batched and rendered per line (terminal_config.batched)
+// - requestAnimationFrame is driven by an emulated 60 Hz display: each frame runs the
+//   callbacks requested since the last one, and a frame is dropped when the main thread
+//   is still busy (with output or rendering) past its deadline, so the display skips it
+// - reports the main thread time spent per frame (frame time), dropped frames and DOM
+//   writes per frame, along with terminal_export_stats
+// - the stub DOM has no layout or paint, so the frame times only cover terminal.js
+//   itself; the DOM writes per frame are what a browser would lay out and paint on top
+// - with --out <file>, the results are merged into a JSON file by scenario name
+//
+// usage: node bench/terminal-bench.js [--filter <name>] [--out <file>]
+
+const fs = require("fs");
+const path = require("path");
+const vm = require("vm");
+
+
+// emulated display refresh interval, and the timer lateness not counted as a missed frame
+const FRAME_MS = 1000 / 60;
+const TIMER_SLACK_MS = 1;
+
+// visible terminal height, in pixels, and the stub's fixed line height
+const VIEW_HEIGHT = 600;
+const LINE_HEIGHT = 16;
+
+
+// benchmark scenarios: a print load in lines/s, for stress_ms, batched or per line
+const SCENARIOS = [];
+for(let rate of [2000, 20000, 100000]) {
+  for(let batched of [true, false]) {
+    SCENARIOS.push({
+      name: `terminal_${rate / 1000}k_lines${batched ? "" : "_per_line"}`,
+      lines_per_second: rate,
+      batched: batched,
+      stress_ms: 3000,
+    });
+  }
+}
+
+
+// minimal DOM element, counting the writes a browser would have to lay out
+class StubElement {
+
+  constructor(dom, id) {
+    this.dom = dom;
+    this.id = id;
+    this.children = [];
+    this.style = {};
+    this._text = "";
+    this._class = "";
+    this._scroll_top = 0;
+  }
+
+  get childElementCount() { return this.children.length; }
+  get lastChild() { return this.children[this.children.length - 1]; }
+  get offsetHeight() { return LINE_HEIGHT; }
+
+  appendChild(child) { this.dom.writes++; this.children.push(child); return child; }
+  removeChild(child) { this.dom.writes++; this.children.splice(this.children.indexOf(child), 1); return child; }
+  setAttribute(name, value) { if(name == "class") this.className = value; }
+  addEventListener() {}
+
+  get textContent() { return this._text; }
+  set textContent(text) { this.dom.writes++; this._text = text; }
+  get className() { return this._class; }
+  set className(value) { if(value !== this._class) this.dom.writes++; this._class = value; }
+
+  // scrolling, for the history element (sized by the spacer's height)
+  get clientHeight() { return VIEW_HEIGHT; }
+  get scrollHeight() { return Math.max(VIEW_HEIGHT, parseInt(this.dom.elements["terminal-spacer"].style.height) || 0); }
+  get scrollTop() { return this._scroll_top; }
+  set scrollTop(value) {
+    this.dom.writes++;
+    this._scroll_top = Math.max(0, Math.min(value, this.scrollHeight - VIEW_HEIGHT));
+  }
+}
+
+
+// emulated display: runs the animation frame callbacks every FRAME_MS, and measures
+// the main thread time between frames
+class EmulatedDisplay {
+
+  constructor(dom) {
+    this.dom = dom;
+    this.callbacks = [];
+    this.frame_ms = [];
+    this.frame_writes = [];
+    this.dropped = 0;
+    this.busy_ms = 0;
+    this.writes_at_frame = 0;
+    this.timer = undefined;
+  }
+
+  requestAnimationFrame(callback) {
+    this.callbacks.push(callback);
+  }
+
+  // time main thread work (timer and frame callbacks)
+  timed(callback) {
+    let start = performance.now();
+    try {
+      callback();
+    } finally {
+      this.busy_ms += performance.now() - start;
+    }
+  }
+
+  start() {
+    this.next_frame = performance.now() + FRAME_MS;
+    let tick = () => {
+
+      // frames whose deadline passed while the main thread was busy were dropped
+      let now = performance.now();
+      let late = Math.ceil((now - this.next_frame - TIMER_SLACK_MS) / FRAME_MS);
+      if(late > 0) {
+        this.dropped += late;
+        this.next_frame += late * FRAME_MS;
+      }
+
+      let callbacks = this.callbacks;
+      this.callbacks = [];
+      this.timed(() => { for(let c of callbacks) c(now); });
+      this.frame_ms.push(this.busy_ms);
+      this.frame_writes.push(this.dom.writes - this.writes_at_frame);
+      this.busy_ms = 0;
+      this.writes_at_frame = this.dom.writes;
+
+      this.next_frame += FRAME_MS;
+      this.timer = setTimeout(tick, Math.max(0, this.next_frame - performance.now()));
+    };
+    this.timer = setTimeout(tick, FRAME_MS);
+  }
+
+  stop() {
+    clearTimeout(this.timer);
+  }
+}
+
+
+// get percentiles from a list of samples
+function percentiles(samples) {
+  let sorted = Float64Array.from(samples).sort();
+  let at = (p) => sorted.length > 0 ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] : 0;
+  return { mean: sorted.reduce((a, s) => a + s, 0) / Math.max(sorted.length, 1),
+           p50: at(0.5), p99: at(0.99), max: at(1) };
+}
+
+
+// run a scenario against a fresh copy of terminal.js
+async function run_scenario(scenario) {
+  let dom = { elements: {}, writes: 0 };
+  for(let id of ["terminal-history", "terminal-spacer", "terminal-view"]) dom.elements[id] = new StubElement(dom, id);
+  let display = new EmulatedDisplay(dom);
+
+  // the terminal's print load runs on timers, timed as main thread work
+  let context = vm.createContext({
+    document: {
+      getElementById: (id) => dom.elements[id] || null,
+      createElement: () => new StubElement(dom),
+    },
+    window: { addEventListener() {} },
+    performance: performance,
+    requestAnimationFrame: (callback) => display.requestAnimationFrame(callback),
+    setInterval: (callback, ms) => setInterval(() => display.timed(callback), ms),
+    clearInterval: clearInterval,
+    terminal_config: {
+      batched: scenario.batched,
+      max_lines: 10000,
+      stress_lines_per_second: scenario.lines_per_second,
+    },
+  });
+  let filename = path.join(__dirname, "../client/terminal.js");
+  vm.runInContext(fs.readFileSync(filename, "utf8"), context, { filename: filename });
+
+  vm.runInContext("terminal_init('0px')", context);
+  display.start();
+  vm.runInContext("terminal_start_stress()", context);
+  await new Promise((resolve) => setTimeout(resolve, scenario.stress_ms));
+  vm.runInContext("terminal_stop_stress()", context);
+  display.stop();
+
+  let frames = display.frame_ms.length + display.dropped;
+  return {
+    name: scenario.name,
+    lines_per_second: scenario.lines_per_second,
+    batched: scenario.batched,
+    frames: frames,
+    dropped_frames: display.dropped,
+    dropped_frame_ratio: display.dropped / Math.max(frames, 1),
+    frame_ms: percentiles(display.frame_ms),
+    dom_writes_per_frame: percentiles(display.frame_writes),
+    terminal: vm.runInContext("terminal_export_stats()", context),
+  };
+}
+
+
+// parse the command line options
+function parse_args(argv) {
+  let options = { filter: undefined, out: undefined };
+  for(let x = 0; x < argv.length; x++) {
+    switch(argv[x]) {
+      case "--filter": options.filter = argv[++x]; break;
+      case "--out":    options.out = argv[++x]; break;
+      default: throw `unknown option '${argv[x]}'`;
+    }
+  }
+  return options;
+}
+
+
+async function main() {
+  let options = parse_args(process.argv.slice(2));
+
+  let results = [];
+  for(let scenario of SCENARIOS.filter((s) => options.filter === undefined || s.name.includes(options.filter))) {
+    console.error(`running ${scenario.name}`);
+    results.push(await run_scenario(scenario));
+  }
+  console.log(JSON.stringify(results, null, 2));
+
+  // merge the results into the output file
+  if(options.out !== undefined) {
+    let merged = fs.existsSync(options.out) ? JSON.parse(fs.readFileSync(options.out, "utf8")) : [];
+    for(let r of results) {
+      let index = merged.findIndex((m) => m.name == r.name);
+      if(index >= 0) merged[index] = r;
+      else merged.push(r);
+    }
+    merged.sort((a, b) => SCENARIOS.findIndex((s) => s.name == a.name) - SCENARIOS.findIndex((s) => s.name == b.name));
+    fs.writeFileSync(options.out, JSON.stringify(merged, null, 2) + "\n");
+  }
+}
+
+
+main();
@@ -0,0 +1,419 @@
+// simulated WebUSB device for headless benchmarks
+// - implements the subset of navigator.usb and USBDevice used by the shim, for a
+//   HackRF-like device with one bulk IN and one bulk OUT endpoint, plus an interrupt
+//   IN endpoint producing timestamped reports
+// - models a shared bus bandwidth, a fixed per-transfer latency and injected faults
+// - as in WebUSB, clearHalt aborts every transfer on the endpoint whose promise hasn't
+//   settled, and reset (or closing the device) every transfer on the device
+// - loaded as a --pre-js by the bench builds, and configured by the "sim" section
+//   of the BENCH_CONFIG environment variable (see run-bench.js)
+
+
+// default simulator options
+const USB_SIM_DEFAULTS = {
+  vendor_id: 0x1d50,
+  product_id: 0x6089,
+  bandwidth: 40e6,       // bus bandwidth, in bytes/s
+  latency_ms: 0.125,     // added to every transfer
+  overhead_ms: 0,        // bus time taken by every transfer (models the browser's fixed per-transfer cost)
+  stall_rate: 0,         // probability of a transfer completing with a "stall" status
+  error_rate: 0,         // probability of a transfer failing with a NetworkError
+  hang_rate: 0,          // probability of a transfer never completing (until clearHalt or reset)
+  control_faults: [],    // faults of successive control transfers ("stall", "babble", "hang" or null), before the rates apply
+  short_rate: 0,         // probability of a bulk IN transfer ending early, with a short packet
+  enumerate_ms: 0,       // added to every getDevices() call
+  report_interval_ms: 8, // interval between interrupt IN reports
+  iso_interval_ms: 0.125, // bus time taken by each isochronous packet (a high-speed microframe)
+  flash_size: 1 << 20,   // SPI flash size, in bytes
+  seed: 1,               // fault injection PRNG seed
+};
+
+
+// HackRF vendor requests answered with specific data (see libhackrf's hackrf_vendor_request)
+// - other IN requests are answered with 0x01 bytes, which libhackrf reads as success
+const HACKRF_VENDOR_REQUEST_BOARD_ID_READ = 14;
+const HACKRF_VENDOR_REQUEST_VERSION_STRING_READ = 15;
+const HACKRF_VENDOR_REQUEST_BOARD_PARTID_SERIALNO_READ = 18;
+const HACKRF_VENDOR_REQUEST_OPERACAKE_GET_BOARDS = 27;
+const HACKRF_VENDOR_REQUEST_BOARD_REV_READ = 45;
+const HACKRF_VENDOR_REQUEST_SUPPORTED_PLATFORM_READ = 46;
+
+// SPI flash requests, addressed by (wValue << 16) | wIndex (see libhackrf's hackrf_spiflash_*)
+const HACKRF_VENDOR_REQUEST_SPIFLASH_ERASE = 10;
+const HACKRF_VENDOR_REQUEST_SPIFLASH_WRITE = 11;
+const HACKRF_VENDOR_REQUEST_SPIFLASH_READ = 12;
+const HACKRF_VENDOR_REQUEST_SPIFLASH_STATUS = 33;
+const HACKRF_VENDOR_REQUEST_SPIFLASH_CLEAR_STATUS = 34;
+
+
+// simulated USBDevice
+class SimulatedUSBDevice {
+
+  constructor(options) {
+    this.options = options;
+    this.stats = { bytes_in: 0, bytes_out: 0, transfers: 0, control_transfers: 0, faults: 0, flash_bytes_written: 0,
+                   clear_halts: 0, resets: 0, short_packets: 0 };
+    this.flash = new Uint8Array(options.flash_size).fill(0xff);
+
+    // device identity (bcdDevice 0x0107 is read by libhackrf as its USB API version)
+    this.vendorId = options.vendor_id;
+    this.productId = options.product_id;
+    this.usbVersionMajor = 2;
+    this.usbVersionMinor = 0;
+    this.usbVersionSubminor = 0;
+    this.deviceClass = 0;
+    this.deviceSubClass = 0;
+    this.deviceProtocol = 0;
+    this.deviceVersionMajor = 1;
+    this.deviceVersionMinor = 0;
+    this.deviceVersionSubminor = 7;
+    this.manufacturerName = "Great Scott Gadgets";
+    this.productName = "HackRF One (simulated)";
+    this.serialNumber = "0000000000000000bench000000000001";
+
+    // one configuration with a vendor-specific interface
+    let alternate = {
+      interfaceNumber: 0,
+      alternateSetting: 0,
+      interfaceClass: 0xff,
+      interfaceSubclass: 0xff,
+      interfaceProtocol: 0xff,
+      interfaceName: null,
+      endpoints: [
+        { endpointNumber: 1, direction: "in", type: "bulk", packetSize: 512 },
+        { endpointNumber: 2, direction: "out", type: "bulk", packetSize: 512 },
+        { endpointNumber: 3, direction: "in", type: "interrupt", packetSize: 64 },
+        { endpointNumber: 4, direction: "in", type: "isochronous", packetSize: 1024 },
+        { endpointNumber: 5, direction: "out", type: "isochronous", packetSize: 1024 },
+      ],
+    };
+    this.configurations = [{
+      configurationValue: 1,
+      configurationName: null,
+      interfaces: [{ interfaceNumber: 0, alternate: alternate, alternates: [alternate], claimed: false }],
+    }];
+    this.configuration = null;
+    this.opened = false;
+
+    this.bus_free_at = 0;
+    this.endpoint_tails = new Map();
+    this.pending = new Set();
+    this.reports_started = performance.now();
+    this.last_report = -1;
+    this.random_state = options.seed >>> 0 || 1;
+  }
+
+  async open() { this.opened = true; }
+  async close() { this.opened = false; this._abort_pending(() => true); }
+
+  async selectConfiguration(value) {
+    this._check_open();
+    let configuration = this.configurations.find((c) => c.configurationValue == value);
+    if(configuration === undefined) throw this._error("NotFoundError", "configuration not found");
+    this.configuration = configuration;
+  }
+
+  async claimInterface(number) { this._check_open(); this._interface(number).claimed = true; }
+  async releaseInterface(number) { this._check_open(); this._interface(number).claimed = false; }
+
+  async clearHalt(direction, endpoint) {
+    this._check_open();
+    this.stats.clear_halts++;
+    this._abort_pending((t) => t.direction == direction && t.endpoint == endpoint);
+  }
+
+  async reset() {
+    this._check_open();
+    this.stats.resets++;
+    this._abort_pending(() => true);
+  }
+
+  async controlTransferIn(setup, length) {
+    this._check_open();
+    let fault = this.options.control_faults[this.stats.control_transfers++];
+    let data = this._control_response(setup, length).slice(0, length);
+    return this._schedule("in", 0, 0, () => ({ status: "ok", data: new DataView(data.buffer) }), undefined, fault);
+  }
+
+  async controlTransferOut(setup, data) {
+    this._check_open();
+    let fault = this.options.control_faults[this.stats.control_transfers++];
+    let length = data === undefined ? 0 : data.byteLength;
+    this._control_write(setup, data);
+    return this._schedule("out", 0, 0, () => ({ status: "ok", bytesWritten: length }), undefined, fault);
+  }
+
+  async transferIn(endpoint, length) {
+    this._check_endpoint(endpoint, "in");
+    if(endpoint == 3) return this._interrupt_report(length);
+    if(this.options.short_rate > 0 && this._random() < this.options.short_rate) {
+      this.stats.short_packets++;
+      length = Math.floor(this._random() * length);
+    }
+    return this._schedule("in", endpoint, length, () => {
+      this.stats.bytes_in += length;
+      return { status: "ok", data: new DataView(new ArrayBuffer(length)) };
+    });
+  }
+
+  async transferOut(endpoint, data) {
+    this._check_endpoint(endpoint, "out");
+    return this._schedule("out", endpoint, data.byteLength, () => {
+      this.stats.bytes_out += data.byteLength;
+      return { status: "ok", bytesWritten: data.byteLength };
+    });
+  }
+
+  // isochronous packets each take one iso_interval_ms of bus time, and always complete
+  // in full (as a device streaming at its full rate)
+  async isochronousTransferIn(endpoint, packet_lengths) {
+    this._check_endpoint(endpoint, "in");
+    let length = packet_lengths.reduce((a, l) => a + l, 0);
+    return this._schedule("in", endpoint, length, () => {
+      this.stats.bytes_in += length;
+      let buffer = new ArrayBuffer(length);
+      let offset = 0;
+      let packets = packet_lengths.map((l) => {
+        offset += l;
+        return { status: "ok", data: new DataView(buffer, offset - l, l) };
+      });
+      return { data: new DataView(buffer), packets: packets };
+    }, packet_lengths.length * this.options.iso_interval_ms);
+  }
+
+  async isochronousTransferOut(endpoint, data, packet_lengths) {
+    this._check_endpoint(endpoint, "out");
+    return this._schedule("out", endpoint, data.byteLength, () => {
+      this.stats.bytes_out += data.byteLength;
+      return { packets: packet_lengths.map((l) => ({ status: "ok", bytesWritten: l })) };
+    }, packet_lengths.length * this.options.iso_interval_ms);
+  }
+
+
+  // complete a transfer once the bus has moved its data and the latency has passed,
+  // unless a fault is injected
+  // - bus_ms is the bus time the transfer takes, by default its data at the bus bandwidth
+  // - fault forces a fault ("stall", "babble" or "hang"), instead of drawing one from the rates
+  // - transfers on an endpoint settle in order (timers alone can reorder them), and stay
+  //   pending (abortable, see _abort_pending) until they do
+  _schedule(direction, endpoint, length, complete, bus_ms, fault) {
+    let options = this.options;
+    let now = performance.now();
+    if(bus_ms === undefined) bus_ms = options.overhead_ms + length / options.bandwidth * 1000;
+    this.bus_free_at = Math.max(now, this.bus_free_at) + bus_ms;
+    let delay = this.bus_free_at + options.latency_ms - now;
+    this.stats.transfers++;
+
+    let draw = this._random();
+    if(fault === undefined || fault === null) {
+      fault = (draw < options.hang_rate) ? "hang" :
+              (draw < options.hang_rate + options.error_rate) ? "error" :
+              (draw < options.hang_rate + options.error_rate + options.stall_rate) ? "stall" : undefined;
+    }
+    let transfer = { direction: direction, endpoint: endpoint, aborted: false, reject: undefined, timer: undefined };
+    let result = new Promise((resolve, reject) => {
+      transfer.reject = reject;
+      if(fault !== undefined) this.stats.faults++;
+      if(fault == "hang") return;
+      transfer.timer = setTimeout(() => {
+        if(fault == "error") {
+          reject(this._error("NetworkError", "simulated transfer error"));
+        } else if(fault == "stall") {
+          resolve(direction == "in" ? { status: "stall", data: new DataView(new ArrayBuffer(0)) }
+                                    : { status: "stall", bytesWritten: 0 });
+        } else if(fault == "babble") {
+          resolve({ status: "babble", data: complete().data });
+        } else {
+          resolve(complete());
+        }
+      }, delay);
+    });
+
+    // settle after the endpoint's previous transfer, as WebUSB does
+    // (result is only awaited once that settles, so its rejection is handled up front)
+    result.catch(() => {});
+    this.pending.add(transfer);
+    let key = `${direction}${endpoint}`;
+    let previous = this.endpoint_tails.get(key) || Promise.resolve();
+    let ordered = previous.then(() => transfer.aborted ? Promise.reject(this._error("AbortError", "transfer aborted")) : result);
+    ordered.then(() => this.pending.delete(transfer), () => this.pending.delete(transfer));
+    this.endpoint_tails.set(key, ordered.catch(() => {}));
+    return ordered;
+  }
+
+  // answer an interrupt IN transfer with the device's latest unread report, or wait for
+  // the next one
+  // - a report is produced every report_interval_ms, and holds the time it was produced
+  //   (performance.timeOrigin + performance.now(), as a float64) so readers can tell its age
+  // - like a device with a single-packet endpoint buffer, only the latest report is kept
+  async _interrupt_report(length) {
+    let interval = this.options.report_interval_ms;
+    let latest = Math.floor((performance.now() - this.reports_started) / interval);
+    let index = Math.max(latest, this.last_report + 1);
+    this.last_report = index;
+    let produced = this.reports_started + index * interval;
+    await new Promise((resolve) => setTimeout(resolve, Math.max(0, produced - performance.now())));
+    this.stats.transfers++;
+    this.stats.bytes_in += length;
+    let data = new DataView(new ArrayBuffer(Math.max(length, 8)));
+    data.setFloat64(0, performance.timeOrigin + produced, true);
+    return { status: "ok", data: data };
+  }
+
+  // abort the pending transfers matching a predicate, including those whose data has
+  // arrived but that are still waiting for an earlier transfer on their endpoint to settle
+  _abort_pending(predicate) {
+    for(let t of this.pending) {
+      if(!predicate(t)) continue;
+      this.pending.delete(t);
+      t.aborted = true;
+      clearTimeout(t.timer);
+      t.reject(this._error("AbortError", "transfer aborted"));
+    }
+  }
+
+  // answer a control IN request
+  _control_response(setup, length) {
+    const GET_DESCRIPTOR = 6;
+    const LIBUSB_DT_CONFIG = 2;
+    let text = (s) => new TextEncoder().encode(s);
+
+    if(setup.requestType == "standard" && setup.request == GET_DESCRIPTOR && (setup.value >> 8) == LIBUSB_DT_CONFIG) {
+      return this._config_descriptor();
+    }
+    if(setup.requestType == "vendor") {
+      switch(setup.request) {
+        case HACKRF_VENDOR_REQUEST_BOARD_ID_READ:           return new Uint8Array([2]);
+        case HACKRF_VENDOR_REQUEST_VERSION_STRING_READ:     return text("bench-sim");
+        case HACKRF_VENDOR_REQUEST_BOARD_PARTID_SERIALNO_READ: return new Uint8Array(24);
+        case HACKRF_VENDOR_REQUEST_OPERACAKE_GET_BOARDS:    return new Uint8Array(8).fill(0xff);
+        case HACKRF_VENDOR_REQUEST_BOARD_REV_READ:          return new Uint8Array([0]);
+        case HACKRF_VENDOR_REQUEST_SUPPORTED_PLATFORM_READ: return new Uint8Array([0, 0, 0, 2]);
+        case HACKRF_VENDOR_REQUEST_SPIFLASH_STATUS:         return new Uint8Array(2);
+        case HACKRF_VENDOR_REQUEST_SPIFLASH_READ: {
+          let address = (setup.value << 16) | setup.index;
+          return this.flash.slice(address, address + length);
+        }
+      }
+    }
+    return new Uint8Array(length).fill(1);
+  }
+
+  // apply a control OUT request to the SPI flash
+  // - writes only clear bits, as on the real part, so writing without an erase shows up on read-back
+  _control_write(setup, data) {
+    if(setup.requestType != "vendor") return;
+    let address = (setup.value << 16) | setup.index;
+    switch(setup.request) {
+      case HACKRF_VENDOR_REQUEST_SPIFLASH_ERASE:
+        this.flash.fill(0xff);
+        break;
+      case HACKRF_VENDOR_REQUEST_SPIFLASH_WRITE: {
+        let bytes = ArrayBuffer.isView(data) ? new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+                                             : new Uint8Array(data);
+        for(let x = 0; x < bytes.length && address + x < this.flash.length; x++) this.flash[address + x] &= bytes[x];
+        this.stats.flash_bytes_written += bytes.length;
+        break;
+      }
+    }
+  }
+
+  // serialize the configuration descriptor
+  _config_descriptor() {
+    let alternate = this.configurations[0].interfaces[0].alternate;
+    let bytes = [9, 2, 0, 0, 1, 1, 0, 0x80, 250];
+    bytes.push(9, 4, 0, 0, alternate.endpoints.length, 0xff, 0xff, 0xff, 0);
+    for(let ep of alternate.endpoints) {
+      let address = ep.endpointNumber | (ep.direction == "in" ? 0x80 : 0);
+      let type = { isochronous: 1, bulk: 2, interrupt: 3 }[ep.type];
+      bytes.push(7, 5, address, type, ep.packetSize & 0xff, ep.packetSize >> 8, ep.type == "bulk" ? 0 : 1);
+    }
+    bytes[2] = bytes.length;
+    return new Uint8Array(bytes);
+  }
+
+  _interface(number) {
+    if(this.configuration === null) throw this._error("InvalidStateError", "device is not configured");
+    let i = this.configuration.interfaces.find((i) => i.interfaceNumber == number);
+    if(i === undefined) throw this._error("NotFoundError", "interface not found");
+    return i;
+  }
+
+  _check_open() {
+    if(!this.opened) throw this._error("InvalidStateError", "device is not open");
+  }
+
+  _check_endpoint(endpoint, direction) {
+    this._check_open();
+    let i = this._interface(0);
+    if(!i.claimed) throw this._error("InvalidStateError", "interface is not claimed");
+    if(!i.alternate.endpoints.some((ep) => ep.endpointNumber == endpoint && ep.direction == direction)) {
+      throw this._error("NotFoundError", "endpoint not found");
+    }
+  }
+
+  _error(name, message) {
+    let error = new Error(message);
+    error.name = name;
+    return error;
+  }
+
+  // xorshift32, so fault injection is repeatable
+  _random() {
+    let x = this.random_state;
+    x ^= x << 13;
+    x ^= x >>> 17;
+    x ^= x << 5;
+    this.random_state = x >>> 0;
+    return this.random_state / 4294967296;
+  }
+}
+
+
+// simulated navigator.usb with a single, already authorized device
+// - connect() and disconnect() emulate plugging the device in and out
+class SimulatedUSB extends EventTarget {
+  constructor(options) {
+    super();
+    this.device = new SimulatedUSBDevice(Object.assign({}, USB_SIM_DEFAULTS, options));
+    this.connected = true;
+  }
+
+  async getDevices() {
+    let delay = this.device.options.enumerate_ms;
+    if(delay > 0) await new Promise((resolve) => setTimeout(resolve, delay));
+    return this.connected ? [this.device] : [];
+  }
+
+  async requestDevice(options) {
+    if(!this.connected) throw this.device._error("NotFoundError", "no device selected");
+    return this.device;
+  }
+
+  connect() {
+    this.connected = true;
+    this._dispatch("connect");
+  }
+
+  disconnect() {
+    this.connected = false;
+    this.device._abort_pending(() => true);
+    this._dispatch("disconnect");
+  }
+
+  _dispatch(type) {
+    let event = new Event(type);
+    event.device = this.device;
+    this.dispatchEvent(event);
+  }
+}
+
+
+// install the simulator when running under Node.js
+if(typeof process !== "undefined" && process.versions !== undefined && process.versions.node !== undefined) {
+  let config = JSON.parse(process.env.BENCH_CONFIG || "{}");
+  if(typeof navigator === "undefined") globalThis.navigator = {};
+  if(navigator.usb === undefined) {
+    Object.defineProperty(navigator, "usb", { value: new SimulatedUSB(config.sim || {}), configurable: true });
+  }
+}
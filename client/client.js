@@ -9,18 +9,9 @@ var Module = {
 var runtime_config = undefined;
 
 
-// add a line to the terminal history div
+// add a line to the terminal (rendered on the next animation frame, see terminal.js)
 function add_terminal_line(msg, type) {
-
-  // create and append the output line
-  let line = document.createElement("div");
-  line.innerHTML = msg;
-  line.setAttribute("class", `terminal-line ${type}`);
-  let th = document.getElementById("terminal-history");
-  th.appendChild(line);
-
-  // auto-scroll
-  document.body.scrollTop = document.body.scrollHeight;
+  terminal_write(msg, type);
 }
 
 
@@ -58,11 +49,28 @@ function handle_stderr(msg) {
 }
 
 
+// check for Wasm SIMD support, by validating a function that returns an i8x16.splat
+function wasm_simd_supported() {
+  return WebAssembly.validate(new Uint8Array([
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,       // header
+    0x01, 0x05, 0x01, 0x60, 0x00, 0x01, 0x7b,             // type: () -> v128
+    0x03, 0x02, 0x01, 0x00,                               // function
+    0x0a, 0x08, 0x01, 0x06, 0x00, 0x41, 0x00, 0xfd, 0x0f, 0x0b, // code: i32.const 0, i8x16.splat
+  ]));
+}
+
+
 // run the wasm loader for a specified runtime config
+// - the multi-call loader (hackrf.js) runs the tool named by argv[0]
+// - without Wasm SIMD support, the loader's -nosimd build is run instead (see SIMD_FLAGS in the Makefile)
+// - the Wasm module is compiled, or taken from the module cache (see module-cache.js)
 function run_wasm_loader(config) {
   runtime_config = config;
+  if(config.app.tool !== undefined) Module.thisProgram = config.app.tool;
+  let loader = wasm_simd_supported() ? config.app.loader : config.app.loader.replace(/\.js$/, "-nosimd.js");
+  install_module_cache(loader.replace(/\.js$/, ".wasm"));
   let script = document.createElement("script");
-  script.setAttribute("src", config.app.loader);
+  script.setAttribute("src", loader);
   document.body.appendChild(script);
 }
 
@@ -80,7 +88,7 @@ function generate_app_list() {
     // for each configured app, generate a flattened runtime config
     for(let a in device.app_configs) {
       let app = device.app_configs[a];
-      let cmdline = app.loader.split(".")[0];
+      let cmdline = app.tool || app.loader.split(".")[0];
       if(app.args.length > 0) cmdline = `${cmdline} ${app.args.join(" ")}`;
       runtime_configs.push({
         usb: device.usb,
@@ -115,8 +123,8 @@ function generate_app_list() {
     list.appendChild(entry);
   }
 
-  // update the output div such that it's offset below the floating command list
-  document.getElementById("terminal-history").style.marginTop = `calc(${list.offsetHeight}px + 0.75em)`;
+  // offset the terminal below the floating command list
+  terminal_init(`${list.offsetHeight}px`);
 }
 
 
@@ -128,10 +136,11 @@ document.addEventListener("DOMContentLoaded", () => {
 
 // called when the Emscripten runtime environment is ready
 async function runtime_initialized() {
+  module_cache_stats.runtime_ready_ms = performance.now() - module_cache_stats.started;
 
-  // prepend the loader name as the first argument
+  // prepend the tool (or loader) name as the first argument
   let args = runtime_config.app.args;
-  args.unshift(runtime_config.app.loader);
+  args.unshift(runtime_config.app.tool || runtime_config.app.loader);
 
   // write the arguments to the wasm heap
   let arg_ptrs = [];
@@ -152,6 +161,21 @@ async function runtime_initialized() {
   for(let i in runtime_config.app.input_files) {
     let f = runtime_config.app.input_files[i];
 
+    // parse the file name and parent directory
+    let offset = f.local_path.lastIndexOf("/");
+    let filename = f.local_path.substr(offset);
+    let parent = f.local_path.substr(0, offset);
+    FS.mkdir(parent);
+
+    // create lazy-loaded files, which are fetched in chunks as they are read
+    if(f.lazy === true) {
+      if(await create_range_file(f.remote_url, f.local_path)) {
+        print_info(`lazily fetching '${f.remote_url}'`);
+        continue;
+      }
+      print_error(`the server doesn't support range requests for '${f.remote_url}', fetching it in full`);
+    }
+
     // fetch the remote file
     print_info(`fetching '${f.remote_url}'`);
     let res = await fetch(f.remote_url);
@@ -162,42 +186,88 @@ async function runtime_initialized() {
     
     // get the file contents as an ArrayBuffer
     let buff = new Uint8Array(await res.arrayBuffer());
+    FS.writeFile(f.local_path, buff);
+  }
 
-    // parse the file name and parent directory
-    let offset = f.local_path.lastIndexOf("/");
-    let filename = f.local_path.substr(offset);
-    let parent = f.local_path.substr(0, offset);
+  // create the streaming output files
+  for(let f of runtime_config.app.output_files || []) {
+    if(f.stream !== true) continue;
+    if(!stream_sinks_supported()) {
+      print_error(`streaming output is not supported by this browser, writing '${f.path}' to MEMFS`);
+      continue;
+    }
+    await create_stream_sink(f.path);
+  }
 
-    // create the lazy-loaded file
-    let can_read = true;
-    let can_write = false;
-    console.log(f.local_path);
-    FS.mkdir(parent);
-    FS.writeFile(f.local_path, buff);
+  // load the USB trace to replay
+  if(runtime_config.usb.replay !== undefined) {
+    try {
+      await _load_replay_trace(runtime_config.usb.replay.url, runtime_config.usb.replay.speed);
+    } catch (error) {
+      print_error(`${error}, aborting`);
+      return;
+    }
+    print_info(`replaying USB trace '${runtime_config.usb.replay.url}'`);
   }
 
   // output the select command line invocation
   print_info(`running '${runtime_config.cmdline}'`);
 
-  // call main(...)
-  Module.ccall("main", "number", ["number", "number"], [args.length, argv], { async: true }).then((status) => {
+  // call main(...), under the synthetic print load if one is configured
+  terminal_start_stress();
+  run_main(args, argv).then((status) => {
+    terminal_stop_stress();
 
     // log the main() return code
     print_info(`application exited with status code ${status}`);
 
+    // log the transfer and terminal statistics
+    if(runtime_config.usb.print_stats === true) {
+      print_info(`transfer statistics: ${JSON.stringify(_export_transfer_stats())}`);
+      print_info(`terminal statistics: ${JSON.stringify(terminal_export_stats())}`);
+      print_info(`startup statistics: ${JSON.stringify(module_cache_stats)}`);
+    }
+
+    // emit the recorded USB trace
+    if(trace_recorder !== undefined) {
+      emit_blob(trace_recorder.blob(), "usb-trace.bin");
+    }
+
     // attempt to emit the configured output files (as individual file downloads)
-    for(let f of runtime_config.app.output_files) {
-      emit_memfs_file(f);
+    for(let f of runtime_config.app.output_files || []) {
+      let path = (typeof f === "string") ? f : f.path;
+      if(stream_sinks.has(path)) emit_stream_sink(path);
+      else emit_memfs_file(path);
     }
   });
 }
 
 
+// run main(...), returning a promise for its exit status
+// - Asyncify/JSPI builds run main on this thread, suspending it around USB calls
+// - futex builds (no Asyncify) block in USB calls, so main runs on a pthread via callMain
+function run_main(args, argv) {
+  if(typeof Asyncify === "undefined") {
+    return new Promise((resolve) => {
+      Module.onExit = resolve;
+      Module.callMain(args.slice(1));
+    });
+  }
+  return Module.ccall("main", "number", ["number", "number"], [args.length, argv], { async: true });
+}
+
+
 // helper function to read a file from the Emscripten 
 // in-memory filesystem and emit it for download 
 function emit_memfs_file(path) {
   let data = Module.FS.readFile(path);
-  let url = URL.createObjectURL(new Blob([data], {type: "application/octet-stream"}));
+  emit_blob(new Blob([data], {type: "application/octet-stream"}), path);
+}
+
+
+// helper function to emit a blob for download
+function emit_blob(blob, path) {
+  let url = URL.createObjectURL(blob);
   var a = document.createElement("a");
   a.style = "display: none";
   a.href = url;
@@ -1,3 +1,18 @@
+// terminal output (see terminal.js)
+var terminal_config = {
+
+  // render output once per animation frame, rather than as each line arrives
+  batched: true,
+
+  // lines of history kept
+  max_lines: 10000,
+
+  // print this many synthetic lines per second while the application runs, to
+  // measure the effect of terminal output on USB completion latency (with usb.print_stats)
+  stress_lines_per_second: 0,
+};
+
+
 var device_configs = {
 
   // HackRF
@@ -7,33 +22,82 @@ var device_configs = {
     usb: {
       vid: 0x1d50,
       pid: 0x6089,
+
+      // number of transfers kept in flight per endpoint
+      queue_depth: 16,
+
+      // merge queued bulk transfers on an endpoint into larger WebUSB transfers, and split
+      // the results back in order (helps applications that submit small transfers)
+      // - the merge size adapts to the measured throughput, between 64 KiB and 1 MiB
+      coalesce: false,
+
+      // run the WebUSB I/O in a dedicated worker, away from the UI thread
+      io_worker: false,
+
+      // convert received int8 IQ samples before the application sees them (Wasm SIMD)
+      // - format: "none", "s16" (int16) or "f32" (float32 in [-1, 1))
+      // - dc_removal: subtract a running per-channel mean
+      // - decimation: average groups of this many complex samples
+      // - sample counts (e.g. hackrf_transfer -n) then apply to the converted output
+      iq_conversion: { format: "none", dc_removal: false, decimation: 1 },
+
+      // queue control OUT transfers (e.g. hackrf_spiflash's 256-byte flash writes) and send
+      // them as one pipelined batch when the application next reads from the device
+      // - a failed transfer in a batch is reported by that later call, not by the write itself,
+      //   so only enable this for tools that don't check their control OUT results
+      batch_control: false,
+
+      // print per-endpoint transfer statistics (as JSON) when the application exits
+      print_stats: false,
+
+      // record the USB traffic to a binary trace (usb-trace.bin), emitted when the application exits
+      // - bulk transfer payloads are only recorded with record_payloads
+      record: false,
+      record_payloads: false,
+
+      // replay a recorded trace instead of using a real device, e.g.
+      // { url: "usb-trace.bin", speed: "recorded" }, where speed is "recorded" or "max"
+      replay: undefined,
     },
 
     // application configurations
+    // - loader: the Emscripten loader; hackrf.js is the multi-call module, which runs the
+    //   tool named by "tool" (single-tool builds, e.g. "hackrf_info.js", need no tool)
+    //   the "-nosimd" build of the loader is run instead where Wasm SIMD is unsupported
     app_configs: {
 
       // hackrf_info
       hackrf_info: {
-        loader: "hackrf_info.js",
+        loader: "hackrf.js",
+        tool: "hackrf_info",
         args: [],
       },
 
       // hackrf_clock -a
       hackrf_clock: {
-        loader: "hackrf_clock.js",
+        loader: "hackrf.js",
+        tool: "hackrf_clock",
         args: ["-a"],
       },
 
       // hackrf_transfer -r out.iq -f 915000000 -n 10000000 -s 1000000
       hackrf_transfer_receive: {
-        loader: "hackrf_transfer.js",
+        loader: "hackrf.js",
+        tool: "hackrf_transfer",
         args: ["-r", "receive.iq", "-f", "915000000", "-n", "10000000", "-s", "1000000"],
-        output_files: ["receive.iq"],
+        output_files: [
+          {
+            // target file path (streamed to OPFS as it is written, rather than held in MEMFS)
+            path: "receive.iq",
+            stream: true,
+          }
+        ],
       },
 
       // hackrf_transfer -t /tmp/test.iq -f 915000000 -s 1000000
       hackrf_transfer_transmit: {
-        loader: "hackrf_transfer.js",
+        loader: "hackrf.js",
+        tool: "hackrf_transfer",
         args: ["-t", "/data/transmit.iq", "-f", "915000000", "-n", "10000000", "-s", "1000000"],
         input_files: [
           {
@@ -42,13 +106,17 @@ var device_configs = {
 
             // target file path (MEMFS filesystem)
             local_path: "/data/transmit.iq",
+
+            // fetch the file in chunks (HTTP range requests) as it is read
+            lazy: true,
           }
         ],
       },
 
       // hackrf_spiflash -v -w /firmware/portapack-h1_h2-mayhem.bin"
       hackrf_firmware_mayhem: {
-        loader: "hackrf_spiflash.js",
+        loader: "hackrf.js",
+        tool: "hackrf_spiflash",
         args: ["-v", "-w", "/firmware/portapack-h1_h2-mayhem.bin"],
         input_files: [
           {
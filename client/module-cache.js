@@ -0,0 +1,135 @@
+// compiled WebAssembly module cache
+// - the loader's Wasm module is compiled with WebAssembly.compileStreaming, as it downloads
+// - compiled modules are kept in IndexedDB, keyed by URL and checked against the
+//   response's ETag/Last-Modified, so repeat launches skip the download and compilation
+// - browsers that won't store a WebAssembly.Module in IndexedDB (DataCloneError) still
+//   get streaming compilation, and their own code cache for streamed modules
+// - installed as Module.instantiateWasm, so the Emscripten runtime (and its pthreads)
+//   use the cached module
+
+
+const MODULE_CACHE_DB = "wasm-module-cache";
+const MODULE_CACHE_STORE = "modules";
+
+
+// how the module was last loaded, and how long each step took (ms)
+var module_cache_stats = {
+  url: undefined,
+  source: undefined,        // "cache" (warm start) or "compiled" (cold start)
+  cache_error: undefined,   // why the compiled module couldn't be cached
+  load_ms: 0,               // the cache lookup (and version check) or the streaming compile
+  instantiate_ms: 0,
+  started: performance.now(),
+  runtime_ready_ms: 0,      // from loader injection to the Emscripten runtime being ready
+};
+
+
+// open the cache database, or resolve to undefined if IndexedDB isn't available
+function _open_module_cache() {
+  if(typeof indexedDB === "undefined") return Promise.resolve(undefined);
+  return new Promise((resolve) => {
+    let request = indexedDB.open(MODULE_CACHE_DB, 1);
+    request.onupgradeneeded = () => request.result.createObjectStore(MODULE_CACHE_STORE);
+    request.onsuccess = () => resolve(request.result);
+    request.onerror = () => resolve(undefined);
+  });
+}
+
+
+// run a request against the cache store
+function _module_cache_request(db, mode, operation) {
+  return new Promise((resolve, reject) => {
+    let request = operation(db.transaction(MODULE_CACHE_STORE, mode).objectStore(MODULE_CACHE_STORE));
+    request.onsuccess = () => resolve(request.result);
+    request.onerror = () => reject(request.error);
+  });
+}
+
+
+// get the version of a module on the server, or undefined if it can't be told apart
+// from other versions (in which case it isn't cached)
+async function _module_version(url) {
+  try {
+    let response = await fetch(url, { method: "HEAD", cache: "no-cache" });
+    if(!response.ok) return undefined;
+    return response.headers.get("ETag") || response.headers.get("Last-Modified") || undefined;
+  } catch (error) {
+    return undefined;
+  }
+}
+
+
+// compile a module as it downloads
+// - falls back to compiling the whole response if the server doesn't send application/wasm
+async function _compile_module(url) {
+  if(WebAssembly.compileStreaming !== undefined) {
+    try {
+      return await WebAssembly.compileStreaming(fetch(url));
+    } catch (error) {
+      console.warn(`streaming compilation of '${url}' failed (${error}), compiling the full response`);
+    }
+  }
+  let response = await fetch(url);
+  return WebAssembly.compile(await response.arrayBuffer());
+}
+
+
+// get the compiled module for a URL, from the cache if it holds the current version
+// - the version check runs alongside the cache lookup (and the compile, on a miss),
+//   so its round trip only delays a warm start when it's the slower of the two
+async function load_cached_module(url) {
+  let start = performance.now();
+  let version = _module_version(url);
+  let db = await _open_module_cache();
+  module_cache_stats.url = url;
+
+  let entry = undefined;
+  if(db !== undefined) {
+    try {
+      entry = await _module_cache_request(db, "readonly", (store) => store.get(url));
+    } catch (error) {
+      console.warn(`reading the module cache failed: ${error}`);
+    }
+  }
+  if(entry !== undefined && entry.module instanceof WebAssembly.Module &&
+     entry.version !== undefined && entry.version === await version) {
+    module_cache_stats.source = "cache";
+    module_cache_stats.load_ms = performance.now() - start;
+    return entry.module;
+  }
+
+  let module = await _compile_module(url);
+  module_cache_stats.source = "compiled";
+  module_cache_stats.load_ms = performance.now() - start;
+
+  // replace any older version of the module
+  version = await version;
+  if(db !== undefined && version !== undefined) {
+    try {
+      await _module_cache_request(db, "readwrite", (store) => store.put({ version: version, module: module }, url));
+    } catch (error) {
+      module_cache_stats.cache_error = `${error}`;
+    }
+  }
+  return module;
+}
+
+
+// have the Emscripten runtime instantiate the module at url through the cache
+// - a failure aborts the runtime (with the loader's abort), as Emscripten's own
+//   instantiation does, rather than leaving it waiting for the module
+function install_module_cache(url) {
+  module_cache_stats.started = performance.now();
+  Module.instantiateWasm = (imports, success) => {
+    load_cached_module(url).then(async (module) => {
+      let start = performance.now();
+      let instance = await WebAssembly.instantiate(module, imports);
+      module_cache_stats.instantiate_ms = performance.now() - start;
+      success(instance, module);
+    }).catch((error) => {
+      print_error(`failed to load '${url}': ${error}`);
+      abort(`${error}`);
+    });
+    return {};
+  };
+}
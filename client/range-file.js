@@ -0,0 +1,154 @@
+// lazily-fetched input files
+// - an input file configured with "lazy: true" is created as an Emscripten
+//   FS device, and read from the server in fixed-size chunks using HTTP range
+//   requests as the application consumes it
+// - the chunks following each read are prefetched asynchronously, and only a
+//   bounded number of chunks are cached, so startup time and memory use don't
+//   depend on the file size
+
+
+// FS device major number for range files
+const RANGE_FILE_MAJOR = 251;
+
+
+// chunk size, chunk cache size and read-ahead depth
+const RANGE_FILE_CHUNK_SIZE = 4 * 1024 * 1024;
+const RANGE_FILE_CACHE_CHUNKS = 16;
+const RANGE_FILE_READ_AHEAD = 4;
+
+
+// number of range files created
+var range_file_count = 0;
+
+
+// create a range file device at the given MEMFS path
+// - returns false if the server doesn't support range requests
+async function create_range_file(remote_url, local_path) {
+
+  // probe the server for range support and the file size
+  let res = await fetch(remote_url, { headers: { Range: "bytes=0-0" } });
+  if(res.status != 206 || res.headers.get("Content-Range") === null) {
+    await res.body.cancel();
+    return false;
+  }
+  let size = parseInt(res.headers.get("Content-Range").split("/")[1]);
+  await res.arrayBuffer();
+
+  let file = {
+    url: remote_url,
+    size: size,
+    chunks: new Map(),   // chunk index -> Uint8Array, in LRU order
+    fetching: new Set(), // chunk indices being prefetched
+  };
+
+  // register the FS device
+  let dev = FS.makedev(RANGE_FILE_MAJOR, range_file_count++);
+  FS.registerDevice(dev, {
+    open: (stream) => {},
+    close: (stream) => {},
+    read: (stream, buffer, offset, length, position) => {
+      return range_file_read(file, buffer, offset, length, position);
+    },
+    write: (stream, buffer, offset, length, position) => {
+      throw new FS.ErrnoError(ERRNO_CODES.EROFS);
+    },
+    llseek: (stream, offset, whence) => {
+      let position = offset;
+      if(whence == 1) position += stream.position;      // SEEK_CUR
+      else if(whence == 2) position += file.size;       // SEEK_END
+      if(position < 0) throw new FS.ErrnoError(ERRNO_CODES.EINVAL);
+      return position;
+    },
+  });
+  FS.mkdev(local_path, 0o444, dev);
+
+  // start fetching the beginning of the file
+  range_file_read_ahead(file, -1);
+  return true;
+}
+
+
+// read from a range file into the heap
+function range_file_read(file, buffer, offset, length, position) {
+  let end = Math.min(position + length, file.size);
+  let done = 0;
+  let index = 0;
+  while(position + done < end) {
+    index = Math.floor((position + done) / RANGE_FILE_CHUNK_SIZE);
+    let chunk = range_file_chunk(file, index);
+    let start = position + done - index * RANGE_FILE_CHUNK_SIZE;
+    let count = Math.min(chunk.length - start, end - position - done);
+    buffer.set(chunk.subarray(start, start + count), offset + done);
+    done += count;
+  }
+  range_file_read_ahead(file, index);
+  return done;
+}
+
+
+// get a chunk from the cache, or fetch it synchronously on a cache miss
+function range_file_chunk(file, index) {
+  let chunk = file.chunks.get(index);
+  if(chunk === undefined) {
+    chunk = range_file_fetch_sync(file, index);
+    range_file_cache(file, index, chunk);
+  }
+
+  // move the chunk to the most-recently-used position
+  file.chunks.delete(index);
+  file.chunks.set(index, chunk);
+  return chunk;
+}
+
+
+// add a chunk to the cache, evicting the least-recently-used chunk if it's full
+function range_file_cache(file, index, chunk) {
+  file.chunks.set(index, chunk);
+  while(file.chunks.size > RANGE_FILE_CACHE_CHUNKS) {
+    file.chunks.delete(file.chunks.keys().next().value);
+  }
+}
+
+
+// get the byte range of a chunk
+function range_file_range(file, index) {
+  let start = index * RANGE_FILE_CHUNK_SIZE;
+  let end = Math.min(start + RANGE_FILE_CHUNK_SIZE, file.size) - 1;
+  return `bytes=${start}-${end}`;
+}
+
+
+// prefetch the chunks following the given chunk
+function range_file_read_ahead(file, index) {
+  let last = Math.min(index + RANGE_FILE_READ_AHEAD, Math.ceil(file.size / RANGE_FILE_CHUNK_SIZE) - 1);
+  for(let i = index + 1; i <= last; i++) {
+    if(file.chunks.has(i) || file.fetching.has(i)) continue;
+    file.fetching.add(i);
+    fetch(file.url, { headers: { Range: range_file_range(file, i) } })
+      .then((res) => res.arrayBuffer())
+      .then((data) => range_file_cache(file, i, new Uint8Array(data)))
+      .catch((error) => console.warn(`prefetch of ${file.url} chunk ${i} failed: ${error}`))
+      .finally(() => file.fetching.delete(i));
+  }
+}
+
+
+// fetch a chunk with a synchronous XHR
+// - FS reads are synchronous, so a chunk that hasn't been prefetched yet has to
+//   be fetched in-line; on the main thread, a binary response can only be read
+//   as a user-defined charset string
+function range_file_fetch_sync(file, index) {
+  let xhr = new XMLHttpRequest();
+  xhr.open("GET", file.url, false);
+  xhr.setRequestHeader("Range", range_file_range(file, index));
+  xhr.overrideMimeType("text/plain; charset=x-user-defined");
+  xhr.send(null);
+  if(xhr.status != 206) throw new FS.ErrnoError(ERRNO_CODES.EIO);
+
+  let text = xhr.responseText;
+  let chunk = new Uint8Array(text.length);
+  for(let x = 0; x < text.length; x++) {
+    chunk[x] = text.charCodeAt(x) & 0xff;
+  }
+  return chunk;
+}
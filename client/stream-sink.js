@@ -0,0 +1,91 @@
+// streaming output files
+// - an output file configured with "stream: true" is created as an Emscripten
+//   FS device, and every write is forwarded to a file in the origin private
+//   file system (OPFS) as it happens
+// - captures never accumulate in MEMFS, so memory use stays constant
+//   regardless of the capture length
+
+
+// FS device major number for stream sinks
+const STREAM_SINK_MAJOR = 250;
+
+
+// warn when this many bytes are waiting to be written to OPFS
+const STREAM_SINK_BACKLOG_WARNING = 256 * 1024 * 1024;
+
+
+// active stream sinks, keyed by path
+var stream_sinks = new Map();
+
+
+// check for OPFS writable stream support
+function stream_sinks_supported() {
+  return navigator.storage !== undefined &&
+         navigator.storage.getDirectory !== undefined &&
+         typeof FileSystemFileHandle !== "undefined" &&
+         FileSystemFileHandle.prototype.createWritable !== undefined;
+}
+
+
+// create a stream sink device at the given MEMFS path
+async function create_stream_sink(path) {
+
+  // create the backing OPFS file
+  let root = await navigator.storage.getDirectory();
+  let handle = await root.getFileHandle(path.substr(path.lastIndexOf("/") + 1), { create: true });
+  let writable = await handle.createWritable();
+
+  let sink = {
+    handle: handle,
+    writable: writable,
+    pending: Promise.resolve(),
+    backlog: 0,
+    bytes: 0,
+    warned: false,
+  };
+
+  // register the FS device
+  // - writes are synchronous from the application's point of view, so each
+  //   chunk is copied off the heap and queued on the OPFS writable stream
+  let dev = FS.makedev(STREAM_SINK_MAJOR, stream_sinks.size);
+  FS.registerDevice(dev, {
+    open: (stream) => {
+      stream.seekable = false;
+    },
+    close: (stream) => {},
+    read: (stream, buffer, offset, length, position) => {
+      throw new FS.ErrnoError(ERRNO_CODES.EINVAL);
+    },
+    write: (stream, buffer, offset, length, position) => {
+      let chunk = buffer.slice(offset, offset + length);
+      sink.backlog += length;
+      sink.bytes += length;
+      if(sink.backlog > STREAM_SINK_BACKLOG_WARNING && !sink.warned) {
+        sink.warned = true;
+        print_error(`'${path}' is being written faster than OPFS can store it`);
+      }
+      sink.pending = sink.pending.then(async () => {
+        await writable.write(chunk);
+        sink.backlog -= chunk.length;
+      });
+      return length;
+    },
+  });
+  FS.mkdev(path, 0o666, dev);
+
+  stream_sinks.set(path, sink);
+}
+
+
+// finish writing a stream sink, and emit the OPFS file for download
+async function emit_stream_sink(path) {
+  let sink = stream_sinks.get(path);
+  await sink.pending;
+  await sink.writable.close();
+  stream_sinks.delete(path);
+
+  // the OPFS file is disk-backed, so this doesn't load the capture into memory
+  let file = await sink.handle.getFile();
+  print_info(`'${path}' streamed to OPFS (${sink.bytes} bytes)`);
+  emit_blob(file, path);
+}
@@ -0,0 +1,165 @@
+// terminal output
+// - stdout/stderr lines are appended to a ring buffer and rendered once per animation
+//   frame, so floods of output don't hold up the WebUSB promises serviced on this thread
+// - the history is capped at terminal_config.max_lines, and the view is virtualized:
+//   lines have a fixed height, and only the ones in view (plus an overscan) are in the DOM
+// - with terminal_config.batched false, each line is rendered (and scrolled to) as it
+//   arrives instead, for comparison
+
+
+// lines rendered above and below the visible ones
+const TERMINAL_OVERSCAN = 16;
+
+
+// main thread tasks longer than this count as blocking (see the Long Tasks API)
+const TERMINAL_LONG_TASK_MS = 50;
+
+
+var terminal = {
+  ring: [],                 // { text, type } lines, indexed by line number modulo max_lines
+  written: 0,               // lines written so far (the next line number)
+  frame_requested: false,
+  rendered_first: -1,       // line range currently in the DOM, and the written count it reflects
+  rendered_last: -1,
+  rendered_written: -1,
+  line_height: 0,
+  stress_timer: undefined,
+  stats: { lines: 0, dropped: 0, frames: 0, render_ms: 0, max_render_ms: 0, blocking_ms: 0, long_tasks: 0 },
+};
+
+
+// get the oldest line still in the history
+function terminal_first_line() {
+  return Math.max(0, terminal.written - terminal_config.max_lines);
+}
+
+
+// add a line to the terminal, and schedule a render
+function terminal_write(text, type) {
+  if(terminal.written >= terminal_config.max_lines) terminal.stats.dropped++;
+  terminal.ring[terminal.written % terminal_config.max_lines] = { text: text, type: type };
+  terminal.written++;
+  terminal.stats.lines++;
+
+  if(terminal_config.batched !== true) {
+    terminal_render(true);
+    return;
+  }
+  terminal_request_frame();
+}
+
+
+// render on the next animation frame, once per frame
+function terminal_request_frame() {
+  if(terminal.frame_requested) return;
+  terminal.frame_requested = true;
+  requestAnimationFrame(() => {
+    terminal.frame_requested = false;
+    terminal_render(false);
+  });
+}
+
+
+// bring the DOM up to date with the history
+// - follows the output if the view was scrolled to the bottom (or scroll is set)
+function terminal_render(scroll) {
+  let history = document.getElementById("terminal-history");
+  if(history === null) return;
+  let start = performance.now();
+  let spacer = document.getElementById("terminal-spacer");
+  let view = document.getElementById("terminal-view");
+
+  // measure the fixed line height once
+  if(terminal.line_height == 0) {
+    let probe = document.createElement("div");
+    probe.setAttribute("class", "terminal-line");
+    probe.textContent = " ";
+    view.appendChild(probe);
+    terminal.line_height = probe.offsetHeight || 16;
+    view.removeChild(probe);
+  }
+  let line_height = terminal.line_height;
+
+  // size the scroll area for the whole history, following the output if at the bottom
+  let first = terminal_first_line();
+  let count = terminal.written - first;
+  let at_bottom = scroll || history.scrollTop + history.clientHeight >= history.scrollHeight - line_height;
+  spacer.style.height = `${count * line_height}px`;
+  if(at_bottom) history.scrollTop = history.scrollHeight;
+
+  // render the lines in view, reusing the existing line elements
+  let top = Math.floor(history.scrollTop / line_height);
+  let visible = Math.ceil(history.clientHeight / line_height);
+  let from = first + Math.max(0, top - TERMINAL_OVERSCAN);
+  let to = Math.min(terminal.written, first + top + visible + TERMINAL_OVERSCAN);
+  if(from != terminal.rendered_first || to != terminal.rendered_last || terminal.written != terminal.rendered_written) {
+    while(view.childElementCount < to - from) view.appendChild(document.createElement("div"));
+    while(view.childElementCount > to - from) view.removeChild(view.lastChild);
+    for(let x = from; x < to; x++) {
+      let line = terminal.ring[x % terminal_config.max_lines];
+      let element = view.children[x - from];
+      if(element.textContent !== line.text) element.textContent = line.text;
+      element.className = `terminal-line ${line.type}`;
+    }
+    view.style.top = `${(from - first) * line_height}px`;
+    terminal.rendered_first = from;
+    terminal.rendered_last = to;
+    terminal.rendered_written = terminal.written;
+  }
+
+  let elapsed = performance.now() - start;
+  terminal.stats.frames++;
+  terminal.stats.render_ms += elapsed;
+  terminal.stats.max_render_ms = Math.max(terminal.stats.max_render_ms, elapsed);
+}
+
+
+// set up the terminal view, below the command list
+function terminal_init(offset) {
+  let history = document.getElementById("terminal-history");
+  history.style.top = offset;
+  history.addEventListener("scroll", () => terminal_request_frame());
+  window.addEventListener("resize", () => terminal_request_frame());
+
+  // measure main thread blocking time (the part of each long task past the threshold)
+  if(typeof PerformanceObserver !== "undefined" &&
+     (PerformanceObserver.supportedEntryTypes || []).includes("longtask")) {
+    new PerformanceObserver((list) => {
+      for(let entry of list.getEntries()) {
+        terminal.stats.long_tasks++;
+        terminal.stats.blocking_ms += Math.max(0, entry.duration - TERMINAL_LONG_TASK_MS);
+      }
+    }).observe({ type: "longtask", buffered: true });
+  }
+}
+
+
+// start a synthetic print load of terminal_config.stress_lines_per_second lines
+// - used to measure how terminal output affects USB completion latency
+function terminal_start_stress() {
+  let rate = terminal_config.stress_lines_per_second;
+  if(!(rate > 0)) return;
+  let interval_ms = 10;
+  let line = 0;
+  terminal.stress_timer = setInterval(() => {
+    for(let x = 0; x < rate * interval_ms / 1000; x++) {
+      terminal_write(`stress line ${line++}: ${"-".repeat(64)}`, "stdout");
+    }
+  }, interval_ms);
+}
+
+
+function terminal_stop_stress() {
+  if(terminal.stress_timer !== undefined) clearInterval(terminal.stress_timer);
+  terminal.stress_timer = undefined;
+}
+
+
+// get the terminal statistics (e.g. for JSON.stringify)
+function terminal_export_stats() {
+  let s = terminal.stats;
+  return Object.assign({}, s, {
+    batched: terminal_config.batched === true,
+    mean_render_ms: s.render_ms / Math.max(s.frames, 1),
+  });
+}
@@ -1,4 +1,51 @@
 #!/bin/bash
 
+# serve the build directory
+# - the stock http.server doesn't support range requests, which lazily-fetched
+#   input files need, so single byte ranges are handled here
 cd build
-python3 -m http.server 8000 --bind 127.0.0.1
\ No newline at end of file
+python3 - <<'PY'
+import http.server, os, re
+
+class RangeRequestHandler(http.server.SimpleHTTPRequestHandler):
+    def send_head(self):
+        self.range_length = None
+        match = re.fullmatch(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+        path = self.translate_path(self.path)
+        if match is None or not os.path.isfile(path):
+            return super().send_head()
+
+        size = os.path.getsize(path)
+        start, end = match.groups()
+        if start == "":
+            start, end = max(size - int(end), 0), size - 1
+        else:
+            start, end = int(start), min(int(end or size - 1), size - 1)
+        if start > end:
+            self.send_error(416)
+            return None
+
+        f = open(path, "rb")
+        f.seek(start)
+        self.range_length = end - start + 1
+        self.send_response(206)
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+        self.send_header("Content-Length", str(self.range_length))
+        self.send_header("Accept-Ranges", "bytes")
+        self.end_headers()
+        return f
+
+    def copyfile(self, source, outputfile):
+        length = self.range_length
+        if length is None:
+            return super().copyfile(source, outputfile)
+        while length > 0:
+            data = source.read(min(length, 64 * 1024))
+            if not data:
+                break
+            outputfile.write(data)
+            length -= len(data)
+
+http.server.ThreadingHTTPServer(("127.0.0.1", 8000), RangeRequestHandler).serve_forever()
+PY
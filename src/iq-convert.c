@@ -0,0 +1,244 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+#include "iq-convert.h"
+
+
+// input bytes converted per block: the block's float samples (16 KiB) stay in L1
+// while they are decimated and stored
+#define IQ_BLOCK_SIZE 4096
+
+// weight of a full block's mean in the running DC offset estimate
+#define IQ_DC_ALPHA (1.0f / 16)
+
+// scale from int8 to [-1, 1), and from [-1, 1) to int16
+#define IQ_S8_SCALE (1.0f / 128)
+#define IQ_S16_SCALE 32768.0f
+
+
+void iq_converter_init(struct iq_converter *c, enum iq_format format, bool dc_removal, int decimation)
+{
+  memset(c, 0, sizeof(struct iq_converter));
+  c->format = format;
+  c->dc_removal = dc_removal;
+  c->decimation = (decimation < 1) ? 1 : decimation;
+}
+
+
+// get the largest output, in bytes, that converting length input bytes can produce
+size_t iq_output_size(const struct iq_converter *c, size_t length)
+{
+  size_t component_size = (c->format == IQ_FORMAT_S16) ? 2 : 4;
+  if(c->format == IQ_FORMAT_NONE) return length;
+
+  // a decimation group carried over from the previous buffer may complete one extra sample
+  size_t samples = length / 2 / c->decimation + 1;
+  return samples * 2 * component_size;
+}
+
+
+// fold a block's mean into the DC offset estimate, weighted by the block's length
+static void update_dc(struct iq_converter *c, int32_t sum_i, int32_t sum_q, size_t length)
+{
+  float samples = length / 2;
+  float alpha = IQ_DC_ALPHA * length / IQ_BLOCK_SIZE;
+  c->dc[0] += alpha * (sum_i / samples - c->dc[0]);
+  c->dc[1] += alpha * (sum_q / samples - c->dc[1]);
+}
+
+
+// average groups of decimation complex samples, in place, returning the number of floats left
+// - groups may span blocks and buffers
+static size_t decimate(struct iq_converter *c, float *block, size_t count)
+{
+  float scale = 1.0f / c->decimation;
+  size_t out = 0;
+  for(size_t x = 0; x < count; x += 2) {
+    c->carry[0] += block[x];
+    c->carry[1] += block[x+1];
+    if(++c->carry_count == c->decimation) {
+      block[out++] = c->carry[0] * scale;
+      block[out++] = c->carry[1] * scale;
+      c->carry[0] = c->carry[1] = 0;
+      c->carry_count = 0;
+    }
+  }
+  return out;
+}
+
+
+/***************
+ * scalar path *
+ ***************/
+
+static size_t convert_block_scalar(struct iq_converter *c, const int8_t *input, size_t length, float *block)
+{
+  if(c->dc_removal) {
+    int32_t sum_i = 0, sum_q = 0;
+    for(size_t x = 0; x < length; x += 2) {
+      sum_i += input[x];
+      sum_q += input[x+1];
+    }
+    update_dc(c, sum_i, sum_q, length);
+  }
+
+  float dc[2] = { c->dc[0], c->dc[1] };
+  for(size_t x = 0; x < length; x++) {
+    block[x] = ((float)input[x] - dc[x & 1]) * IQ_S8_SCALE;
+  }
+  return (c->decimation > 1) ? decimate(c, block, length) : length;
+}
+
+static void store_block_scalar(enum iq_format format, const float *block, size_t count, void *output)
+{
+  if(format == IQ_FORMAT_F32) {
+    if(output != block) memcpy(output, block, count * sizeof(float));
+    return;
+  }
+
+  int16_t *out = output;
+  for(size_t x = 0; x < count; x++) {
+    int32_t v = (int32_t)(block[x] * IQ_S16_SCALE);
+    out[x] = (v > INT16_MAX) ? INT16_MAX : (v < INT16_MIN) ? INT16_MIN : v;
+  }
+}
+
+
+/*************************
+ * Wasm SIMD (-msimd128) *
+ *************************/
+
+#ifdef __wasm_simd128__
+
+// sum the I and Q samples of a block
+static void sum_block_simd(const int8_t *input, size_t length, int32_t *sum_i, int32_t *sum_q)
+{
+  // int16 lanes are widened every 64 vectors, before they can overflow
+  const size_t WIDEN_INTERVAL = 64 * 16;
+  size_t vectors_end = length & ~(size_t)15;
+  v128_t acc = wasm_i32x4_splat(0);
+  size_t x = 0;
+  while(x < vectors_end) {
+    size_t end = (x + WIDEN_INTERVAL < vectors_end) ? x + WIDEN_INTERVAL : vectors_end;
+    v128_t acc16 = wasm_i16x8_splat(0);
+    for(; x < end; x += 16) {
+      v128_t v = wasm_v128_load(input + x);
+      acc16 = wasm_i16x8_add(acc16, wasm_i16x8_add(wasm_i16x8_extend_low_i8x16(v), wasm_i16x8_extend_high_i8x16(v)));
+    }
+    acc = wasm_i32x4_add(acc, wasm_i32x4_add(wasm_i32x4_extend_low_i16x8(acc16), wasm_i32x4_extend_high_i16x8(acc16)));
+  }
+
+  // lanes alternate between I and Q
+  *sum_i = wasm_i32x4_extract_lane(acc, 0) + wasm_i32x4_extract_lane(acc, 2);
+  *sum_q = wasm_i32x4_extract_lane(acc, 1) + wasm_i32x4_extract_lane(acc, 3);
+  for(; x < length; x += 2) {
+    *sum_i += input[x];
+    *sum_q += input[x+1];
+  }
+}
+
+static size_t convert_block_simd(struct iq_converter *c, const int8_t *input, size_t length, float *block)
+{
+  if(c->dc_removal) {
+    int32_t sum_i, sum_q;
+    sum_block_simd(input, length, &sum_i, &sum_q);
+    update_dc(c, sum_i, sum_q, length);
+  }
+
+  // 16 int8 samples widen to four float vectors
+  v128_t dc = wasm_f32x4_make(c->dc[0], c->dc[1], c->dc[0], c->dc[1]);
+  v128_t scale = wasm_f32x4_splat(IQ_S8_SCALE);
+  size_t x = 0;
+  for(; x + 16 <= length; x += 16) {
+    v128_t v = wasm_v128_load(input + x);
+    v128_t low = wasm_i16x8_extend_low_i8x16(v);
+    v128_t high = wasm_i16x8_extend_high_i8x16(v);
+    v128_t f0 = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(low));
+    v128_t f1 = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(low));
+    v128_t f2 = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(high));
+    v128_t f3 = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(high));
+    wasm_v128_store(block + x, wasm_f32x4_mul(wasm_f32x4_sub(f0, dc), scale));
+    wasm_v128_store(block + x + 4, wasm_f32x4_mul(wasm_f32x4_sub(f1, dc), scale));
+    wasm_v128_store(block + x + 8, wasm_f32x4_mul(wasm_f32x4_sub(f2, dc), scale));
+    wasm_v128_store(block + x + 12, wasm_f32x4_mul(wasm_f32x4_sub(f3, dc), scale));
+  }
+  for(; x < length; x++) {
+    block[x] = ((float)input[x] - c->dc[x & 1]) * IQ_S8_SCALE;
+  }
+  return (c->decimation > 1) ? decimate(c, block, length) : length;
+}
+
+static void store_block_simd(enum iq_format format, const float *block, size_t count, void *output)
+{
+  if(format == IQ_FORMAT_F32) {
+    if(output != block) memcpy(output, block, count * sizeof(float));
+    return;
+  }
+
+  // truncate to int32, then narrow with signed saturation
+  int16_t *out = output;
+  v128_t scale = wasm_f32x4_splat(IQ_S16_SCALE);
+  size_t x = 0;
+  for(; x + 8 <= count; x += 8) {
+    v128_t a = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(wasm_v128_load(block + x), scale));
+    v128_t b = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(wasm_v128_load(block + x + 4), scale));
+    wasm_v128_store(out + x, wasm_i16x8_narrow_i32x4(a, b));
+  }
+  store_block_scalar(format, block + x, count - x, out + x);
+}
+
+#endif
+
+
+/**************
+ * block loop *
+ **************/
+
+typedef size_t (*convert_block_fn)(struct iq_converter *c, const int8_t *input, size_t length, float *block);
+typedef void (*store_block_fn)(enum iq_format format, const float *block, size_t count, void *output);
+
+// convert a buffer block by block, returning the number of bytes written
+// - without decimation, float32 output is converted in place in the output buffer
+static size_t convert_blocks(struct iq_converter *c, const int8_t *input, size_t length, void *output,
+                             convert_block_fn convert_block, store_block_fn store_block)
+{
+  float block[IQ_BLOCK_SIZE];
+  size_t component_size = (c->format == IQ_FORMAT_S16) ? 2 : 4;
+  bool direct = (c->format == IQ_FORMAT_F32 && c->decimation == 1);
+  uint8_t *out = output;
+
+  if(c->format == IQ_FORMAT_NONE) return 0;
+  length &= ~(size_t)1;
+
+  for(size_t offset = 0; offset < length; offset += IQ_BLOCK_SIZE) {
+    size_t block_length = (length - offset < IQ_BLOCK_SIZE) ? length - offset : IQ_BLOCK_SIZE;
+    float *target = direct ? (float *)out : block;
+    size_t count = convert_block(c, input + offset, block_length, target);
+    store_block(c->format, target, count, out);
+    out += count * component_size;
+  }
+  return out - (uint8_t *)output;
+}
+
+
+// convert a buffer of int8 IQ samples, returning the number of bytes written
+// - output must hold iq_output_size(c, length) bytes
+size_t iq_convert(struct iq_converter *c, const int8_t *input, size_t length, void *output)
+{
+#ifdef __wasm_simd128__
+  return convert_blocks(c, input, length, output, convert_block_simd, store_block_simd);
+#else
+  return convert_blocks(c, input, length, output, convert_block_scalar, store_block_scalar);
+#endif
+}
+
+// scalar reference implementation, for comparison with the SIMD path
+size_t iq_convert_scalar(struct iq_converter *c, const int8_t *input, size_t length, void *output)
+{
+  return convert_blocks(c, input, length, output, convert_block_scalar, store_block_scalar);
+}
@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// conversion of interleaved int8 IQ samples (as produced by the HackRF) to wider formats
+// - optionally removes the DC offset (a running per-channel mean) and decimates by
+//   averaging groups of complex samples, keeping state across buffers
+// - buffers are processed in cache-sized blocks, with Wasm SIMD when built with -msimd128
+enum iq_format {
+  IQ_FORMAT_NONE, // no conversion
+  IQ_FORMAT_S16,  // interleaved int16, full scale
+  IQ_FORMAT_F32,  // interleaved float32, in [-1, 1)
+};
+
+struct iq_converter {
+  enum iq_format format;
+  bool dc_removal;
+  int decimation;        // complex samples averaged into each output sample (1 = none)
+  float dc[2];           // running I/Q DC offset estimates, in int8 units
+  float carry[2];        // partial I/Q sums of the current decimation group
+  int carry_count;       // complex samples in the current decimation group
+};
+
+void iq_converter_init(struct iq_converter *c, enum iq_format format, bool dc_removal, int decimation);
+size_t iq_output_size(const struct iq_converter *c, size_t length);
+size_t iq_convert(struct iq_converter *c, const int8_t *input, size_t length, void *output);
+size_t iq_convert_scalar(struct iq_converter *c, const int8_t *input, size_t length, void *output);
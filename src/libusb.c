@@ -1,96 +1,887 @@
 #include <emscripten.h>
+#include <emscripten/threading.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libusb.h>
 
+#include "iq-convert.h"
 #include "webusb.h"
 
-static bool enable_debug_log = false;
+// log level and callback (see libusb_set_debug and libusb_set_log_cb)
+static enum libusb_log_level log_level = LIBUSB_LOG_LEVEL_NONE;
+static libusb_log_cb log_callback = NULL;
+
+void usb_log (enum libusb_log_level level, char *fmt, va_list argp)
+{
+  if(level > log_level) return;
+
+  // format the message, and pass it to the log callback or stderr
+  char message[256];
+  vsnprintf(message, sizeof(message) - 1, fmt, argp);
+  strcat(message, "\n");
+  if(log_callback != NULL) log_callback(NULL, level, message);
+  else fputs(message, stderr);
+}
 
 void debug_log (char *fmt, ...) 
 {
-  if(enable_debug_log) {
-    va_list argp;
-    va_start (argp, fmt); 
-    vfprintf (stderr, fmt, argp); 
-    fprintf(stderr, "\n");
-    va_end (argp);
-  }
+  va_list argp;
+  va_start (argp, fmt); 
+  usb_log(LIBUSB_LOG_LEVEL_DEBUG, fmt, argp);
+  va_end (argp);
+}
+
+void warning_log (char *fmt, ...)
+{
+  va_list argp;
+  va_start (argp, fmt);
+  usb_log(LIBUSB_LOG_LEVEL_WARNING, fmt, argp);
+  va_end (argp);
 }
 
 // override sleep(...) to use emscripten_sleep(...) instead
+// - futex builds (no Asyncify) run on a pthread, where the libc sleep blocks
+#ifndef WEBUSB_BLOCKING_FUTEX
 unsigned int sleep(unsigned int seconds)
 {
   emscripten_sleep(seconds*1000);
 }
+#endif
 
 
-/*************************************************
- * simple linked-list to track pending transfers *
- *************************************************/
+/*******************
+ * device registry *
+ *******************/
 
-struct pending_transfer {
-  struct libusb_transfer * transfer;
-  struct pending_transfer * next;
-  struct pending_transfer * previous;
+// maximum number of WebUSB devices tracked by the shim
+#define MAX_DEVICES 16
+
+// descriptors read from WebUSB, served to libusb without a JS round trip
+// - filled at libusb_open (the device descriptor on first use), invalidated by libusb_set_configuration
+#define MAX_CONFIGURATIONS 8
+#define MAX_CACHED_STRINGS 4 // string descriptor indices served by webusb.js
+#define MAX_STRING_LENGTH  256
+
+struct descriptor_cache {
+  bool valid;
+  struct libusb_device_descriptor device;
+  int configuration_value;
+  int num_configs;
+  uint8_t * configs[MAX_CONFIGURATIONS]; // raw configuration descriptors
+  char strings[MAX_CACHED_STRINGS][MAX_STRING_LENGTH];
+  int string_lengths[MAX_CACHED_STRINGS];
+};
+
+struct libusb_device_handle {
+  struct libusb_device * dev;
+  bool open;
+  struct shim_transfer * pending_transfers; // pending transfers on this device
+  int pending_transfer_count;
 };
 
-struct pending_transfer * pending_transfers = NULL;
+// each libusb_device maps to the WebUSB device with the same index in the JS device table
+struct libusb_device {
+  int id;
+  bool registered;
+  bool connected;   // cleared by disconnect events (see process_hotplug_events)
+  struct libusb_device_handle handle;
+  struct descriptor_cache descriptors;
+};
+
+struct libusb_device devices[MAX_DEVICES];
+
 
-void add_pending_transfer(struct libusb_transfer * t)
+// register the devices listed by the JS device table, returning the device count
+int register_devices(int *ids, int count, libusb_device **list)
 {
-  if(pending_transfers == NULL) pending_transfers = calloc(1, sizeof(struct pending_transfer));
+  int registered = 0;
+  for(int x = 0; x < count; x++) {
+    if(ids[x] < 0 || ids[x] >= MAX_DEVICES) continue;
+    struct libusb_device * dev = &devices[ids[x]];
+    if(!dev->registered) {
+      memset(dev, 0, sizeof(struct libusb_device));
+      dev->id = ids[x];
+      dev->handle.dev = dev;
+      dev->registered = true;
+      dev->connected = true;
+    }
+    if(list != NULL) list[registered] = dev;
+    registered++;
+  }
+  return registered;
+}
+
+bool valid_device(libusb_device *dev)
+{
+  return dev >= devices && dev < devices + MAX_DEVICES && dev->registered;
+}
+
+bool valid_handle(libusb_device_handle *dev_handle)
+{
+  return dev_handle != NULL && valid_device(dev_handle->dev) && dev_handle->open;
+}
+
+
 
-  struct pending_transfer * transfer = calloc(1, sizeof(struct pending_transfer));
-  transfer->transfer = t;
 
-  // find the end of the list
-  struct pending_transfer * p = pending_transfers;
-  while(p->next != NULL) {
-    p = p->next;
-  } 
+/********************
+ * descriptor cache *
+ ********************/
 
-  // add this transfer to the list
-  transfer->previous = p;
-  p->next = transfer;
+// read the device descriptor from WebUSB, if it isn't already cached
+void fill_device_descriptor(libusb_device *dev)
+{
+  struct descriptor_cache * c = &dev->descriptors;
+  if(c->device.bLength == 0) get_device_descriptor(dev->id, &c->device);
 }
 
-int process_completed_transfers()
+// read all descriptors from WebUSB, if they aren't already cached
+void fill_descriptor_cache(libusb_device *dev)
 {
-  // traverse the list for pending transfers
-  struct pending_transfer * p = pending_transfers;
-  while(p->next != NULL) {
-    p = p->next;
-    if(p->transfer->status == LIBUSB_TRANSFER_COMPLETED || 
-       p->transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-      p->transfer->callback(p->transfer);
-      p->transfer->status = -1;
+  struct descriptor_cache * c = &dev->descriptors;
+  if(c->valid) return;
+
+  fill_device_descriptor(dev);
+  c->configuration_value = get_configuration(dev->id);
+
+  // raw configuration descriptors
+  c->num_configs = c->device.bNumConfigurations;
+  if(c->num_configs > MAX_CONFIGURATIONS) c->num_configs = MAX_CONFIGURATIONS;
+  for(int x = 0; x < c->num_configs; x++) {
+    c->configs[x] = get_config_descriptor(dev->id, x);
+  }
+
+  // string descriptors
+  for(int x = 1; x < MAX_CACHED_STRINGS; x++) {
+    c->string_lengths[x] = get_string_descriptor(dev->id, x, (uint8_t *)c->strings[x], MAX_STRING_LENGTH);
+  }
+
+  c->valid = true;
+}
+
+void invalidate_descriptor_cache(libusb_device *dev)
+{
+  struct descriptor_cache * c = &dev->descriptors;
+  for(int x = 0; x < c->num_configs; x++) {
+    free(c->configs[x]);
+    c->configs[x] = NULL;
+  }
+  c->num_configs = 0;
+  c->valid = false;
+}
+
+// find a cached raw configuration descriptor by its bConfigurationValue
+const uint8_t * find_config_descriptor(libusb_device *dev, int value)
+{
+  fill_descriptor_cache(dev);
+  struct descriptor_cache * c = &dev->descriptors;
+  for(int x = 0; x < c->num_configs; x++) {
+    if(c->configs[x] != NULL && c->configs[x][5] == value) return c->configs[x];
+  }
+  return NULL;
+}
+
+// find an endpoint descriptor in a raw configuration descriptor
+const uint8_t * find_endpoint_descriptor(const uint8_t *config, unsigned char endpoint)
+{
+  int length = config[2] | (config[3] << 8);
+  for(int offset = 0; offset + 2 <= length && config[offset] > 0; offset += config[offset]) {
+    if(config[offset+1] == LIBUSB_DT_ENDPOINT && config[offset+2] == endpoint) return &config[offset];
+  }
+  return NULL;
+}
+
+// parse a raw configuration descriptor into a single heap allocation
+// - the result is released with libusb_free_config_descriptor
+int parse_config_descriptor(const uint8_t *raw, struct libusb_config_descriptor **config)
+{
+  int length = raw[2] | (raw[3] << 8);
+
+  // count the interfaces, alternate settings and endpoints
+  int num_interfaces = 0, num_altsettings = 0, num_endpoints = 0;
+  int last_interface = -1;
+  for(int offset = raw[0]; offset + 2 <= length && raw[offset] > 0; offset += raw[offset]) {
+    if(raw[offset+1] == LIBUSB_DT_INTERFACE) {
+      if(raw[offset+2] != last_interface) num_interfaces++;
+      last_interface = raw[offset+2];
+      num_altsettings++;
+    }
+    else if(raw[offset+1] == LIBUSB_DT_ENDPOINT && num_altsettings > 0) {
+      num_endpoints++;
     }
   }
+
+  // allocate the config, interface, altsetting and endpoint arrays as one block
+  size_t size = sizeof(struct libusb_config_descriptor) +
+                sizeof(struct libusb_interface) * num_interfaces +
+                sizeof(struct libusb_interface_descriptor) * num_altsettings +
+                sizeof(struct libusb_endpoint_descriptor) * num_endpoints;
+  uint8_t * block = calloc(1, size);
+  if(block == NULL) return LIBUSB_ERROR_NO_MEM;
+  struct libusb_config_descriptor * c = (struct libusb_config_descriptor *)block;
+  struct libusb_interface * interfaces = (struct libusb_interface *)(c + 1);
+  struct libusb_interface_descriptor * altsettings = (struct libusb_interface_descriptor *)(interfaces + num_interfaces);
+  struct libusb_endpoint_descriptor * endpoints = (struct libusb_endpoint_descriptor *)(altsettings + num_altsettings);
+
+  // configuration descriptor
+  c->bLength = raw[0];
+  c->bDescriptorType = raw[1];
+  c->wTotalLength = length;
+  c->bNumInterfaces = num_interfaces;
+  c->bConfigurationValue = raw[5];
+  c->iConfiguration = raw[6];
+  c->bmAttributes = raw[7];
+  c->MaxPower = raw[8];
+  c->interface = interfaces;
+
+  // interface and endpoint descriptors
+  struct libusb_interface * interface = interfaces - 1;
+  struct libusb_interface_descriptor * alt = NULL;
+  last_interface = -1;
+  for(int offset = raw[0]; offset + 2 <= length && raw[offset] > 0; offset += raw[offset]) {
+    const uint8_t * d = &raw[offset];
+    if(d[1] == LIBUSB_DT_INTERFACE) {
+      if(d[2] != last_interface) {
+        interface++;
+        interface->altsetting = altsettings;
+      }
+      last_interface = d[2];
+      alt = altsettings++;
+      interface->num_altsetting++;
+      alt->bLength = d[0];
+      alt->bDescriptorType = d[1];
+      alt->bInterfaceNumber = d[2];
+      alt->bAlternateSetting = d[3];
+      alt->bInterfaceClass = d[5];
+      alt->bInterfaceSubClass = d[6];
+      alt->bInterfaceProtocol = d[7];
+      alt->iInterface = d[8];
+      alt->endpoint = endpoints;
+    }
+    else if(d[1] == LIBUSB_DT_ENDPOINT && alt != NULL) {
+      struct libusb_endpoint_descriptor * ep = endpoints++;
+      ep->bLength = d[0];
+      ep->bDescriptorType = d[1];
+      ep->bEndpointAddress = d[2];
+      ep->bmAttributes = d[3];
+      ep->wMaxPacketSize = d[4] | (d[5] << 8);
+      ep->bInterval = d[6];
+      alt->bNumEndpoints++;
+    }
+  }
+
+  *config = c;
   return LIBUSB_SUCCESS;
 }
 
 
 
 
+/****************************************
+ * enumeration cache and hotplug events *
+ ****************************************/
+
+// device connection events from the navigator.usb connect/disconnect handlers
+struct hotplug_ring hotplug_events;
+
+// VID/PID of the devices listed by libusb_get_device_list (read once, by libusb_init)
+uint16_t configured_vid = 0;
+uint16_t configured_pid = 0;
+
+// device ids found for recent VID/PID lookups
+// - valid until the next device connection event, so repeat enumerations
+//   don't return to the main thread (getDevices, or a requestDevice prompt)
+// - lookups that find no devices are not cached, so they can still prompt
+#define ENUMERATION_CACHE_SIZE 4
+struct enumeration {
+  bool valid;
+  uint16_t vid;
+  uint16_t pid;
+  uint32_t generation; // hotplug_events.generation when the lookup started
+  int count;
+  int ids[MAX_DEVICES];
+};
+struct enumeration enumeration_cache[ENUMERATION_CACHE_SIZE];
+int enumeration_cache_next = 0;
+
+// find the devices matching a vid/pid, returning their ids from the enumeration cache if possible
+int cached_enumerate_devices(uint16_t vid, uint16_t pid, int *ids)
+{
+  uint32_t generation = __atomic_load_n(&hotplug_events.generation, __ATOMIC_ACQUIRE);
+  for(int x = 0; x < ENUMERATION_CACHE_SIZE; x++) {
+    struct enumeration * e = &enumeration_cache[x];
+    if(e->valid && e->vid == vid && e->pid == pid && e->generation == generation) {
+      memcpy(ids, e->ids, sizeof(int) * e->count);
+      return e->count;
+    }
+  }
+
+  int count = enumerate_devices(vid, pid, ids, MAX_DEVICES);
+  if(count > 0) {
+    struct enumeration * e = &enumeration_cache[enumeration_cache_next];
+    enumeration_cache_next = (enumeration_cache_next + 1) % ENUMERATION_CACHE_SIZE;
+    e->valid = true;
+    e->vid = vid;
+    e->pid = pid;
+    e->generation = generation;
+    e->count = count;
+    memcpy(e->ids, ids, sizeof(int) * count);
+  }
+  return count;
+}
+
+
+// registered hotplug callbacks (see libusb_hotplug_register_callback)
+#define MAX_HOTPLUG_CALLBACKS 8
+struct hotplug_callback {
+  bool registered;
+  int events;
+  int vendor_id;
+  int product_id;
+  int dev_class;
+  libusb_hotplug_callback_fn fn;
+  void * user_data;
+};
+struct hotplug_callback hotplug_callbacks[MAX_HOTPLUG_CALLBACKS];
+
+bool hotplug_callback_matches(struct hotplug_callback *cb, libusb_device *dev, libusb_hotplug_event event)
+{
+  if(!cb->registered || (cb->events & event) == 0) return false;
+  fill_device_descriptor(dev);
+  struct libusb_device_descriptor * d = &dev->descriptors.device;
+  return (cb->vendor_id == LIBUSB_HOTPLUG_MATCH_ANY || cb->vendor_id == d->idVendor) &&
+         (cb->product_id == LIBUSB_HOTPLUG_MATCH_ANY || cb->product_id == d->idProduct) &&
+         (cb->dev_class == LIBUSB_HOTPLUG_MATCH_ANY || cb->dev_class == d->bDeviceClass);
+}
+
+// run the matching callbacks for a device event; callbacks returning 1 are deregistered
+void run_hotplug_callbacks(libusb_device *dev, libusb_hotplug_event event)
+{
+  for(int x = 0; x < MAX_HOTPLUG_CALLBACKS; x++) {
+    struct hotplug_callback * cb = &hotplug_callbacks[x];
+    if(!hotplug_callback_matches(cb, dev, event)) continue;
+    if(cb->fn(NULL, dev, event, cb->user_data) == 1) cb->registered = false;
+  }
+}
+
+// drain the hotplug ring, returning the number of events handled
+// - called with the event lock held
+int process_hotplug_events()
+{
+  int count = 0;
+  uint32_t tail = __atomic_load_n(&hotplug_events.tail, __ATOMIC_ACQUIRE);
+  while(hotplug_events.head != tail) {
+    int32_t entry = hotplug_events.entries[hotplug_events.head & (HOTPLUG_RING_SIZE - 1)];
+    __atomic_store_n(&hotplug_events.head, hotplug_events.head + 1, __ATOMIC_RELEASE);
+    count++;
+
+    int id = entry & ~HOTPLUG_EVENT_LEFT;
+    libusb_device * dev = NULL;
+    if(register_devices(&id, 1, &dev) == 0) continue;
+    if(entry & HOTPLUG_EVENT_LEFT) {
+      dev->connected = false;
+      run_hotplug_callbacks(dev, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT);
+    } else {
+      dev->connected = true;
+      run_hotplug_callbacks(dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+    }
+  }
+  return count;
+}
+
+
+
+
+/*********************************************************
+ * pool-backed transfer tracking and the completion ring *
+ ********************************************************/
+
+// shim-private transfer state, allocated in front of each libusb_transfer
+struct shim_transfer {
+  struct shim_transfer * next;      // pending list / free list link
+  struct shim_transfer * previous;  // pending list link
+  int iso_packets;                  // number of allocated iso packet descriptors
+  bool pending;                     // submitted, callback not yet run
+  bool cancelling;                  // cancellation posted to the JS dispatcher
+  bool free_on_completion;          // freed while pending; released instead of calling back
+  int stats_slot;                   // endpoint statistics slot, or -1
+  double submit_time;               // emscripten_get_now() at submission
+  int device_id;                    // read by the JS transfer dispatcher
+  uint8_t * converted;              // IQ conversion output, or NULL
+  size_t converted_size;            // allocated size of converted
+  unsigned char * raw_buffer;       // application buffer while the callback sees converted samples
+  int raw_length;                   // application buffer and sample lengths, likewise
+  int raw_actual_length;
+  struct libusb_transfer transfer;  // must be last (iso_packet_desc is a flexible array)
+};
+
+#define SHIM_TRANSFER(t) \
+  ((struct shim_transfer *)((uint8_t *)(t) - offsetof(struct shim_transfer, transfer)))
+
+// free list of released transfers without iso packet descriptors
+struct shim_transfer * free_transfers = NULL;
+
+// total number of pending transfers across all devices
+int pending_transfer_count = 0;
+
+// guards the pending lists, the submission ring and the free list
+// - transfers are submitted, allocated and freed from both the application and event-handling threads
+pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// serializes event handling, as libusb's event lock does: only the thread holding it
+// drains the completion and hotplug rings (their single consumer) and runs callbacks
+// - threads that find it held wait for the holder to finish its pass (see wait_for_event_pass)
+// - the holding thread may take it again, from a completion callback that makes a synchronous transfer
+pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local int event_lock_depth = 0;
+
+// advanced, and woken, each time a thread releases the event lock
+uint32_t event_passes = 0;
+
+// submissions consumed by the JS transfer dispatcher
+struct transfer_ring submitted_transfers;
+
+// completions posted by the JS transfer handlers, drained by the event loop
+struct transfer_ring completed_transfers;
+
+// per-endpoint transfer statistics, shared with the JS transfer engine
+struct endpoint_stats transfer_stats[STATS_MAX_ENDPOINTS];
+
+// per-endpoint IQ sample conversion state, indexed like transfer_stats
+struct iq_converter iq_converters[STATS_MAX_ENDPOINTS];
+
+// transfer whose completion callback is running on this thread
+_Thread_local struct shim_transfer * callback_transfer = NULL;
+
+
+// take the event lock, returning false if another thread is handling events
+bool try_lock_events()
+{
+  if(event_lock_depth == 0 && pthread_mutex_trylock(&event_lock) != 0) return false;
+  event_lock_depth++;
+  return true;
+}
+
+// release the event lock, and wake the threads waiting for the pass to end
+void unlock_events()
+{
+  if(--event_lock_depth > 0) return;
+  pthread_mutex_unlock(&event_lock);
+  __atomic_add_fetch(&event_passes, 1, __ATOMIC_ACQ_REL);
+  emscripten_futex_wake(&event_passes, INT_MAX);
+}
+
+// wait until the thread handling events ends its pass (passes is event_passes, read
+// before the event lock was found held), or the timeout expires
+void wait_for_event_pass(uint32_t passes, double timeout_ms)
+{
+  if(__atomic_load_n(&event_passes, __ATOMIC_ACQUIRE) != passes) return;
+  wait_on_address(&event_passes, passes, timeout_ms);
+}
+
+
+// find or claim the statistics slot of a device endpoint, or return -1 if all slots are in use
+// - called with transfer_lock held
+int endpoint_stats_slot(int device_id, unsigned char endpoint)
+{
+  int key = (device_id << 8) | endpoint;
+  for(int x = 0; x < STATS_MAX_ENDPOINTS; x++) {
+    if(transfer_stats[x].values[STAT_KEY] == key) return x;
+    if(transfer_stats[x].values[STAT_KEY] < 0) {
+      transfer_stats[x].values[STAT_KEY] = key;
+      return x;
+    }
+  }
+  return -1;
+}
+
+
+// add a transfer to its device's doubly-linked pending list (O(1) insert and remove)
+void add_pending_transfer(struct shim_transfer * t)
+{
+  libusb_device_handle * h = t->transfer.dev_handle;
+  t->pending = true;
+  t->previous = NULL;
+  t->next = h->pending_transfers;
+  if(h->pending_transfers != NULL) h->pending_transfers->previous = t;
+  h->pending_transfers = t;
+  h->pending_transfer_count++;
+  pending_transfer_count++;
+}
+
+void remove_pending_transfer(struct shim_transfer * t)
+{
+  libusb_device_handle * h = t->transfer.dev_handle;
+  if(t->previous != NULL) t->previous->next = t->next;
+  else h->pending_transfers = t->next;
+  if(t->next != NULL) t->next->previous = t->previous;
+  t->next = t->previous = NULL;
+  t->pending = false;
+  h->pending_transfer_count--;
+  pending_transfer_count--;
+}
+
+// post a transfer to the JS dispatcher, which wakes on the ring tail
+// - called with transfer_lock held
+void post_submission(struct libusb_transfer * transfer)
+{
+  uint32_t tail = submitted_transfers.tail;
+  submitted_transfers.entries[tail & (TRANSFER_RING_SIZE - 1)] = transfer;
+  __atomic_store_n(&submitted_transfers.tail, tail + 1, __ATOMIC_RELEASE);
+  emscripten_futex_wake(&submitted_transfers.tail, 1);
+}
+
+// ask the JS dispatcher to cancel a pending transfer
+// - called with transfer_lock held
+void post_cancellation(struct libusb_transfer * transfer)
+{
+  post_submission((struct libusb_transfer *)((uintptr_t)transfer | TRANSFER_RING_CANCEL));
+}
+
+void sync_transfer_callback(struct libusb_transfer *transfer);
+
+// convert the samples of a completed bulk IN transfer, so its callback sees the
+// converted buffer (see iq-convert.h), until restore_iq_samples
+// - synchronous transfers (libusb_bulk_transfer) return raw samples
+void convert_iq_samples(struct shim_transfer * t)
+{
+  struct libusb_transfer * transfer = &t->transfer;
+  if(t->stats_slot < 0 || iq_converters[t->stats_slot].format == IQ_FORMAT_NONE) return;
+  if(transfer->callback == sync_transfer_callback) return;
+  if(transfer->type != LIBUSB_TRANSFER_TYPE_BULK || (transfer->endpoint & LIBUSB_ENDPOINT_IN) == 0) return;
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED) return;
+
+  // the output buffer is kept with the transfer, and only grows
+  struct iq_converter * c = &iq_converters[t->stats_slot];
+  size_t size = iq_output_size(c, transfer->length);
+  if(t->converted_size < size) {
+    free(t->converted);
+    t->converted = malloc(size);
+    t->converted_size = (t->converted == NULL) ? 0 : size;
+    if(t->converted == NULL) return;
+  }
+
+  double start = emscripten_get_now();
+  size_t length = iq_convert(c, (const int8_t *)transfer->buffer, transfer->actual_length, t->converted);
+  transfer_stats[t->stats_slot].values[STAT_CONVERT_MS] += emscripten_get_now() - start;
+
+  t->raw_buffer = transfer->buffer;
+  t->raw_length = transfer->length;
+  t->raw_actual_length = transfer->actual_length;
+  transfer->buffer = t->converted;
+  transfer->length = size;
+  transfer->actual_length = length;
+}
+
+// give a converted transfer its application buffer back
+// - run when the callback returns, or earlier if the callback resubmits or frees the transfer
+void restore_iq_samples(struct shim_transfer * t)
+{
+  if(t->raw_buffer == NULL) return;
+  t->transfer.buffer = t->raw_buffer;
+  t->transfer.length = t->raw_length;
+  t->transfer.actual_length = t->raw_actual_length;
+  t->raw_buffer = NULL;
+}
+
+// release a transfer that is no longer pending (see libusb_free_transfer)
+void release_transfer(struct shim_transfer * t)
+{
+  // release the IQ conversion buffer
+  if(t == callback_transfer) callback_transfer = NULL;
+  restore_iq_samples(t);
+  free(t->converted);
+
+  // return transfers without iso packets to the pool
+  if(t->iso_packets == 0) {
+    pthread_mutex_lock(&transfer_lock);
+    t->next = free_transfers;
+    free_transfers = t;
+    pthread_mutex_unlock(&transfer_lock);
+  }
+  else {
+    free(t);
+  }
+}
+
+// returns the number of transfers completed
+// - called with the event lock held
+int process_completed_transfers()
+{
+  // drain the completion ring; the JS side has already
+  // written the actual_length and status of each transfer
+  int count = 0;
+  uint32_t tail = __atomic_load_n(&completed_transfers.tail, __ATOMIC_ACQUIRE);
+  while(completed_transfers.head != tail) {
+    uint32_t index = completed_transfers.head & (TRANSFER_RING_SIZE - 1);
+    struct libusb_transfer * transfer = completed_transfers.entries[index];
+    __atomic_store_n(&completed_transfers.head, completed_transfers.head + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&transfer_lock);
+    struct shim_transfer * t = SHIM_TRANSFER(transfer);
+    remove_pending_transfer(t);
+    bool release = t->free_on_completion;
+    pthread_mutex_unlock(&transfer_lock);
+
+    // transfers freed while pending are released without running their callback
+    if(release) {
+      release_transfer(t);
+      count++;
+      continue;
+    }
+
+    convert_iq_samples(t);
+
+    // the callback may free the transfer, so its stats slot is read first
+    int slot = t->stats_slot;
+    double start = emscripten_get_now();
+    callback_transfer = t;
+    transfer->callback(transfer);
+    if(callback_transfer != NULL) restore_iq_samples(callback_transfer);
+    callback_transfer = NULL;
+    if(slot >= 0) transfer_stats[slot].values[STAT_CALLBACK_MS] += emscripten_get_now() - start;
+    count++;
+  }
+  return count;
+}
+
+
+// set by libusb_interrupt_event_handler to wake a blocked event loop
+bool completion_wait_interrupted = false;
+
+void interrupt_completion_wait()
+{
+  __atomic_store_n(&completion_wait_interrupted, true, __ATOMIC_RELEASE);
+  emscripten_futex_wake(&completed_transfers.tail, INT_MAX);
+}
+
+// block until the JS side posts a completion (it notifies the ring tail),
+// the wait is interrupted, or the timeout expires
+// - returns false if the timeout expired
+bool wait_for_completions(double timeout_ms)
+{
+  double deadline = emscripten_get_now() + timeout_ms;
+  while(true) {
+    uint32_t tail = __atomic_load_n(&completed_transfers.tail, __ATOMIC_ACQUIRE);
+    if(tail != completed_transfers.head) return true;
+    if(__atomic_load_n(&hotplug_events.tail, __ATOMIC_ACQUIRE) != hotplug_events.head) return true;
+    if(__atomic_exchange_n(&completion_wait_interrupted, false, __ATOMIC_ACQ_REL)) return true;
+
+    double remaining = deadline - emscripten_get_now();
+    if(remaining <= 0) return false;
+    wait_on_address(&completed_transfers.tail, tail, remaining);
+  }
+}
+
+// convert an event timeout to milliseconds (NULL waits forever)
+double timeval_to_ms(struct timeval *tv)
+{
+  if(tv == NULL) return INFINITY;
+  return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+
+
+
+/*******************************************
+ * synchronous transfers on the async path *
+ *******************************************/
+
+void sync_transfer_callback(struct libusb_transfer *transfer)
+{
+  int * completed = transfer->user_data;
+  __atomic_store_n(completed, 1, __ATOMIC_RELEASE);
+}
+
+// submit a transfer and handle events until its callback runs
+// - the timeout is enforced by the transfer engine, which completes the transfer as TIMED_OUT
+// - if another thread is handling events, it runs the callback, and this thread waits
+//   for that pass to end
+int sync_transfer(libusb_device_handle *dev_handle, unsigned char type,
+  unsigned char endpoint, unsigned char *data, int length,
+  int *actual_length, unsigned int timeout)
+{
+  // validate the device handle
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  struct libusb_transfer * transfer = libusb_alloc_transfer(0);
+  if(transfer == NULL) return LIBUSB_ERROR_NO_MEM;
+
+  // submit the transfer
+  int completed = 0;
+  libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, data, length,
+                            sync_transfer_callback, &completed, timeout);
+  transfer->type = type;
+  int result = libusb_submit_transfer(transfer);
+  if(result < 0) {
+    libusb_free_transfer(transfer);
+    return result;
+  }
+
+  // wait for the transfer to complete
+  while(!__atomic_load_n(&completed, __ATOMIC_ACQUIRE)) {
+    uint32_t passes = __atomic_load_n(&event_passes, __ATOMIC_ACQUIRE);
+    if(!try_lock_events()) {
+      wait_for_event_pass(passes, INFINITY);
+      continue;
+    }
+    if(!__atomic_load_n(&completed, __ATOMIC_ACQUIRE) && wait_for_completions(INFINITY)) {
+      process_hotplug_events();
+      process_completed_transfers();
+    }
+    unlock_events();
+  }
+
+  // map the transfer status to a libusb error
+  if(actual_length != NULL) *actual_length = transfer->actual_length;
+  switch(transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED: result = LIBUSB_SUCCESS; break;
+    case LIBUSB_TRANSFER_TIMED_OUT: result = LIBUSB_ERROR_TIMEOUT; break;
+    case LIBUSB_TRANSFER_STALL:     result = LIBUSB_ERROR_PIPE; break;
+    case LIBUSB_TRANSFER_OVERFLOW:  result = LIBUSB_ERROR_OVERFLOW; break;
+    case LIBUSB_TRANSFER_NO_DEVICE: result = LIBUSB_ERROR_NO_DEVICE; break;
+    case LIBUSB_TRANSFER_CANCELLED: result = LIBUSB_ERROR_INTERRUPTED; break;
+    default:                        result = LIBUSB_ERROR_IO; break;
+  }
+
+  libusb_free_transfer(transfer);
+  return result;
+}
+
+
+
+
+/*********************************
+ * batched control OUT transfers *
+ *********************************/
+
+// control OUT transfers are queued, and sent to JS in one crossing when the application
+// next needs the device's state (see runtime_config.usb.batch_control, off by default)
+// - a queued transfer reports success (wLength bytes) right away; errors surface from the
+//   call that flushes the batch, or are logged if that call can't return them
+// - only threads that can reach the devices queue or flush transfers, so a transfer
+//   resubmitted from another thread leaves the batch for the application's next call
+#define CONTROL_BATCH_SIZE 64
+#define CONTROL_BATCH_BYTES 16384
+
+bool control_batching = false;
+
+struct control_batch {
+  int device_id;
+  int count;
+  int data_length;
+  struct control_batch_entry entries[CONTROL_BATCH_SIZE];
+  uint8_t data[CONTROL_BATCH_BYTES];
+};
+struct control_batch control_batch;
+
+// guards the control batch, since control transfers may come from any thread
+pthread_mutex_t control_batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// send the queued control transfers, returning the first error, or LIBUSB_SUCCESS
+// - called with control_batch_lock held
+int flush_control_batch_locked()
+{
+  if(control_batch.count == 0) return LIBUSB_SUCCESS;
+  int result = control_transfer_batch(control_batch.device_id, control_batch.entries,
+                                      control_batch.count, control_batch.data);
+  control_batch.count = 0;
+  control_batch.data_length = 0;
+  return result < 0 ? result : LIBUSB_SUCCESS;
+}
+
+int flush_control_batch()
+{
+  if(!control_batching || !can_reach_devices()) return LIBUSB_SUCCESS;
+  pthread_mutex_lock(&control_batch_lock);
+  int result = flush_control_batch_locked();
+  pthread_mutex_unlock(&control_batch_lock);
+  if(result < 0) warning_log("batched control transfer failed: %d", result);
+  return result;
+}
+
+// queue a control OUT transfer, returning 1 if it was queued, 0 if it must be sent on
+// its own, or the error of a full batch it had to flush first (which the transfers in
+// that batch, already reported as written, can't return themselves)
+int queue_control_transfer(int device_id, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                           uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout)
+{
+  if(!control_batching || !can_reach_devices() ||
+     (request_type & LIBUSB_ENDPOINT_IN) || wLength > CONTROL_BATCH_BYTES) return 0;
+
+  pthread_mutex_lock(&control_batch_lock);
+
+  // a batch holds transfers for one device, up to its size limits
+  if(control_batch.count > 0 && (control_batch.device_id != device_id ||
+     control_batch.count == CONTROL_BATCH_SIZE || control_batch.data_length + wLength > CONTROL_BATCH_BYTES)) {
+    int result = flush_control_batch_locked();
+    if(result < 0) {
+      pthread_mutex_unlock(&control_batch_lock);
+      warning_log("batched control transfer failed: %d", result);
+      return result;
+    }
+  }
+
+  struct control_batch_entry * e = &control_batch.entries[control_batch.count++];
+  e->request_type = request_type;
+  e->request = bRequest;
+  e->value = wValue;
+  e->index = wIndex;
+  e->length = wLength;
+  e->timeout = timeout;
+  e->result = 0;
+  if(wLength > 0) memcpy(control_batch.data + control_batch.data_length, data, wLength);
+  control_batch.data_length += wLength;
+  control_batch.device_id = device_id;
+
+  pthread_mutex_unlock(&control_batch_lock);
+  return 1;
+}
+
+
+
+
 /***************************************
  * libusb API [partial] implementation *
  ***************************************/
 
 
-// fixed values for context and device handles
+// fixed values for the context and bus
 const libusb_context * DEFAULT_LIBUSB_CONTEXT = 0; // Fixed context handle
-const libusb_device  * DEFAULT_LIBUSB_DEVICE  = 1; // Fixed device handle
 #define DEFAULT_BUS_NUMBER     0 // Fixed USB bus number
-#define DEFAULT_DEVICE_ADDRESS 0 // Fixed USB device address
+#define DEFAULT_EVENT_TIMEOUT_SECONDS 60 // libusb_handle_events(...) timeout
 
 
 int libusb_init(libusb_context **ctx)
 {
   debug_log("libusb_init(...)");
   if(!ensure_navigator_usb()) return LIBUSB_ERROR_NOT_SUPPORTED;
+
+  // mark all statistics slots as unused
+  for(int x = 0; x < STATS_MAX_ENDPOINTS; x++) transfer_stats[x].values[STAT_KEY] = -1;
+
+  // set up the configured IQ sample conversion
+  int iq_format, iq_decimation;
+  bool iq_dc_removal;
+  get_iq_conversion(&iq_format, &iq_dc_removal, &iq_decimation);
+  for(int x = 0; x < STATS_MAX_ENDPOINTS; x++) {
+    iq_converter_init(&iq_converters[x], iq_format, iq_dc_removal, iq_decimation);
+  }
+
+  get_device_filter(&configured_vid, &configured_pid);
+  control_batching = get_batch_control();
+
+  int transfer_offset = (int)offsetof(struct shim_transfer, transfer);
+  init_webusb(&submitted_transfers, &completed_transfers, transfer_stats, &hotplug_events,
+              (int)offsetof(struct shim_transfer, device_id) - transfer_offset,
+              (int)offsetof(struct shim_transfer, stats_slot) - transfer_offset,
+              (int)offsetof(struct shim_transfer, submit_time) - transfer_offset);
   if(ctx != NULL) *ctx = DEFAULT_LIBUSB_CONTEXT;
   return LIBUSB_SUCCESS;
 }
@@ -103,22 +894,22 @@ ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
   // validate the context
   if(ctx != DEFAULT_LIBUSB_CONTEXT) return LIBUSB_ERROR_INVALID_PARAM;
 
-  // request access to the configured device
-  if(request_device_access() == 0) {
-    fprintf(stderr, "request_device_access() USB device not found/authorized\n");
+  // request access to the configured devices
+  int ids[MAX_DEVICES];
+  int count = cached_enumerate_devices(configured_vid, configured_pid, ids);
+  if(count == 0) {
+    fprintf(stderr, "libusb_get_device_list() USB device not found/authorized\n");
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
-  // generate a two-device list
-  // - our target device
-  // - dummy NULL device
-  libusb_device ** l = malloc(sizeof(libusb_device *) * 2);
-  l[0] = DEFAULT_LIBUSB_DEVICE;
-  l[1] = NULL;
+  // generate a NULL-terminated device list
+  libusb_device ** l = malloc(sizeof(libusb_device *) * (count + 1));
+  count = register_devices(ids, count, l);
+  l[count] = NULL;
   *list = l;
 
   // return the device count
-  return 1;
+  return count;
 }
 
 
@@ -127,10 +918,11 @@ int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descri
   debug_log("libusb_get_device_descriptor(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
-  // generate the device descriptor and write it to the heap
-  get_device_descriptor(desc);
+  // copy the cached device descriptor
+  fill_device_descriptor(dev);
+  memcpy(desc, &dev->descriptors.device, sizeof(struct libusb_device_descriptor));
 
   return 0;
 }
@@ -146,7 +938,9 @@ void libusb_free_device_list(libusb_device **list, int unref_devices)
 void libusb_exit(libusb_context *ctx)
 {
   debug_log("libusb_exit(...)");
-  // nop
+
+  // send any queued control transfers
+  flush_control_batch();
 }
 
 
@@ -155,7 +949,7 @@ uint8_t libusb_get_bus_number(libusb_device *dev)
   debug_log("libusb_get_bus_number(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
   return DEFAULT_BUS_NUMBER;
 }
@@ -166,9 +960,10 @@ uint8_t libusb_get_device_address(libusb_device *dev)
   debug_log("libusb_get_device_address(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
-  return DEFAULT_DEVICE_ADDRESS;
+  // device addresses are assigned in registration order
+  return dev->id + 1;
 }
 
 
@@ -177,7 +972,7 @@ int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_
   debug_log("libusb_get_port_numbers(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
   // return 0 port numbers
   return 0;
@@ -189,13 +984,22 @@ int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
   debug_log("libusb_open(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
   // open the device
-  open_device();
+  if(!dev->handle.open) {
+    if(open_device(dev->id) < 0) return LIBUSB_ERROR_ACCESS;
+    dev->handle.open = true;
+
+    // descriptors read while the device was closed lack the endpoint intervals
+    invalidate_descriptor_cache(dev);
+  }
 
-  // set the device handle to the device value
-  *dev_handle = dev;
+  // read the device's descriptors once, up front
+  fill_descriptor_cache(dev);
+
+  // each device has a single handle
+  *dev_handle = &dev->handle;
 
   return LIBUSB_SUCCESS;  
 }
@@ -206,10 +1010,12 @@ void libusb_close(libusb_device_handle *dev_handle)
   debug_log("libusb_close(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return;
+  if(!valid_handle(dev_handle)) return;
 
-  // close the device
-  close_device();
+  // send any queued control transfers, then close the device
+  flush_control_batch();
+  close_device(dev_handle->dev->id);
+  dev_handle->open = false;
 }
 
 
@@ -220,22 +1026,33 @@ int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
   debug_log("libusb_get_string_descriptor_ascii(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // serve the manufacturer/product/serial strings from the descriptor cache
+  struct descriptor_cache * c = &dev_handle->dev->descriptors;
+  fill_descriptor_cache(dev_handle->dev);
+  if(desc_index > 0 && desc_index < MAX_CACHED_STRINGS && length > 0) {
+    int len = c->string_lengths[desc_index] < length ? c->string_lengths[desc_index] : length;
+    memcpy(data, c->strings[desc_index], len);
+    data[len-1] = 0;
+    return len;
+  }
 
   // get the descriptor string and return the length
-  return get_string_descriptor(desc_index, data, length);  
+  return get_string_descriptor(dev_handle->dev->id, desc_index, data, length);  
 }
 
 
-int libusb_get_configuration(libusb_device_handle *dev, int *config)
+int libusb_get_configuration(libusb_device_handle *dev_handle, int *config)
 {
   debug_log("libusb_get_configuration(...)");
 
-  // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  // validate the device handle
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
 
-  // get the configuration value from WebUSB
-  *config = get_configuration();
+  // get the cached configuration value
+  fill_descriptor_cache(dev_handle->dev);
+  *config = dev_handle->dev->descriptors.configuration_value;
 
   return LIBUSB_SUCCESS;
 }
@@ -246,10 +1063,9 @@ libusb_device * libusb_get_device(libusb_device_handle *dev_handle)
   debug_log("libusb_get_device(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return NULL;
 
-  // return the fixed device ptr (same as the handle)
-  return DEFAULT_LIBUSB_DEVICE;
+  return dev_handle->dev;
 }
 
 
@@ -258,12 +1074,38 @@ int libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config
   debug_log("libusb_get_active_config_descriptor(...)");
 
   // validate the device
-  if(dev != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
 
-  // serialize the descriptor to the heap
-  *config = get_active_config_descriptor();
+  fill_descriptor_cache(dev);
+  return libusb_get_config_descriptor_by_value(dev, dev->descriptors.configuration_value, config);
+}
 
-  return LIBUSB_SUCCESS;  
+
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
+{
+  debug_log("libusb_get_config_descriptor(...)");
+
+  // validate the device
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // parse the cached descriptor
+  fill_descriptor_cache(dev);
+  if(config_index >= dev->descriptors.num_configs) return LIBUSB_ERROR_NOT_FOUND;
+  return parse_config_descriptor(dev->descriptors.configs[config_index], config);
+}
+
+
+int libusb_get_config_descriptor_by_value(libusb_device *dev, uint8_t bConfigurationValue, struct libusb_config_descriptor **config)
+{
+  debug_log("libusb_get_config_descriptor_by_value(...)");
+
+  // validate the device
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // parse the cached descriptor
+  const uint8_t * raw = find_config_descriptor(dev, bConfigurationValue);
+  if(raw == NULL) return LIBUSB_ERROR_NOT_FOUND;
+  return parse_config_descriptor(raw, config);
 }
 
 
@@ -274,12 +1116,72 @@ void libusb_free_config_descriptor( struct libusb_config_descriptor *config)
 }
 
 
+int libusb_get_max_packet_size(libusb_device *dev, unsigned char endpoint)
+{
+  debug_log("libusb_get_max_packet_size(...)");
+
+  // validate the device
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // look up the endpoint in the cached active configuration
+  fill_descriptor_cache(dev);
+  const uint8_t * config = find_config_descriptor(dev, dev->descriptors.configuration_value);
+  if(config == NULL) return LIBUSB_ERROR_NOT_FOUND;
+  const uint8_t * ep = find_endpoint_descriptor(config, endpoint);
+  if(ep == NULL) return LIBUSB_ERROR_NOT_FOUND;
+
+  return ep[4] | (ep[5] << 8);
+}
+
+
+int libusb_get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint)
+{
+  debug_log("libusb_get_max_iso_packet_size(...)");
+
+  // validate the device
+  if(!valid_device(dev)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // look up the endpoint in the cached active configuration
+  fill_descriptor_cache(dev);
+  const uint8_t * config = find_config_descriptor(dev, dev->descriptors.configuration_value);
+  if(config == NULL) return LIBUSB_ERROR_NOT_FOUND;
+  const uint8_t * ep = find_endpoint_descriptor(config, endpoint);
+  if(ep == NULL) return LIBUSB_ERROR_NOT_FOUND;
+
+  // isochronous and interrupt endpoints can carry several packets per microframe
+  int max_packet_size = ep[4] | (ep[5] << 8);
+  int transfer_type = ep[3] & 0x3;
+  if(transfer_type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS || transfer_type == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+    return (max_packet_size & 0x7ff) * (1 + ((max_packet_size >> 11) & 0x3));
+  }
+  return max_packet_size;
+}
+
+
+int libusb_set_configuration(libusb_device_handle *dev_handle, int configuration)
+{
+  debug_log("libusb_set_configuration(...)");
+
+  // validate the device handle
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  flush_control_batch();
+
+  // select the configuration, then re-read the descriptors
+  if(select_configuration(dev_handle->dev->id, configuration) < 0) return LIBUSB_ERROR_NOT_FOUND;
+  invalidate_descriptor_cache(dev_handle->dev);
+  fill_descriptor_cache(dev_handle->dev);
+
+  return LIBUSB_SUCCESS;
+}
+
+
 int libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number)
 {
   debug_log("libusb_kernel_driver_active(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
 
   // WebUSB only has access to devices which aren't currently
   // owned by the kernel, so we always return 0 (not active)
@@ -292,10 +1194,12 @@ int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_numbe
   debug_log("libusb_claim_interface(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  flush_control_batch();
 
   // claim the interface
-  claim_interface(interface_number);
+  claim_interface(dev_handle->dev->id, interface_number);
   
   return LIBUSB_SUCCESS;
 }
@@ -306,10 +1210,12 @@ int libusb_release_interface(libusb_device_handle *dev_handle, int interface_num
   debug_log("libusb_release_interface(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  flush_control_batch();
 
   // release the interface
-  release_interface(interface_number);
+  release_interface(dev_handle->dev->id, interface_number);
   
   return LIBUSB_SUCCESS;
 }
@@ -319,13 +1225,27 @@ struct libusb_transfer * libusb_alloc_transfer(int iso_packets)
 {
   debug_log("libusb_alloc_transfer(...)");
 
-  // compute the size of the struct give the number of iso packets
-  int size = sizeof(struct libusb_transfer) + 
-             sizeof(struct libusb_iso_packet_descriptor) * iso_packets;
+  // reuse a pooled transfer when no iso packets are needed
+  struct shim_transfer * t = NULL;
+  if(iso_packets == 0) {
+    pthread_mutex_lock(&transfer_lock);
+    t = free_transfers;
+    if(t != NULL) free_transfers = t->next;
+    pthread_mutex_unlock(&transfer_lock);
+  }
+
+  // otherwise, compute the size of the struct given the number of iso packets
+  if(t == NULL) {
+    int size = sizeof(struct shim_transfer) +
+               sizeof(struct libusb_iso_packet_descriptor) * iso_packets;
+    t = malloc(size);
+    if(t == NULL) return NULL;
+  }
 
-  // allocate and return
-  struct libusb_transfer * xfer = malloc(size);
-  return xfer;
+  memset(t, 0, sizeof(struct shim_transfer));
+  t->iso_packets = iso_packets;
+  t->transfer.num_iso_packets = iso_packets;
+  return &t->transfer;
 }
 
 
@@ -336,17 +1256,48 @@ int libusb_control_transfer(libusb_device_handle *dev_handle,
   debug_log("libusb_control_transfer(...)");
 
   // validate the device handle
-  if(dev_handle != DEFAULT_LIBUSB_DEVICE) return LIBUSB_ERROR_INVALID_PARAM;
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  // queue control OUT transfers when batching, reporting the full length as written
+  int result = queue_control_transfer(dev_handle->dev->id, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+  if(result < 0) return result;
+  if(result > 0) return wLength;
+
+  // otherwise send any queued transfers first, so the device sees them in order
+  result = flush_control_batch();
+  if(result < 0) return result;
 
   // run the control transfer and return the number of bytes transferred
-  return control_transfer(request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+  return control_transfer(dev_handle->dev->id, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
 }
 
 
 void libusb_free_transfer(struct libusb_transfer *transfer)
 {
   debug_log("libusb_free_transfer(...)");
-  free(transfer);
+  if(transfer == NULL) return;
+
+  // a pending transfer is still owned by the transfer engine, which writes its status
+  // and buffer when it completes, so freeing it is an application error (as in libusb)
+  // - it is cancelled instead, and released when its completion is processed,
+  //   without running its callback (its buffer must stay valid until then)
+  struct shim_transfer * t = SHIM_TRANSFER(transfer);
+  pthread_mutex_lock(&transfer_lock);
+  bool pending = t->pending;
+  if(pending) {
+    t->free_on_completion = true;
+    if(!t->cancelling) {
+      t->cancelling = true;
+      post_cancellation(transfer);
+    }
+  }
+  pthread_mutex_unlock(&transfer_lock);
+  if(pending) {
+    warning_log("libusb_free_transfer: transfer is still pending, cancelled and freed on completion");
+    return;
+  }
+
+  release_transfer(t);
 }
 
 
@@ -355,14 +1306,19 @@ libusb_device_handle * libusb_open_device_with_vid_pid( libusb_context *ctx, uin
   debug_log("libusb_open_device_with_vid_pid(...)");
 
   // validate the context
-  if(ctx != DEFAULT_LIBUSB_CONTEXT) return LIBUSB_ERROR_INVALID_PARAM;
+  if(ctx != DEFAULT_LIBUSB_CONTEXT) return NULL;
 
-  // attempt to open the device
-  if(open_device_with_vid_pid(vendor_id, product_id) < 0) {
-    return LIBUSB_ERROR_NO_DEVICE;
-  }
+  // find the matching devices
+  int ids[MAX_DEVICES];
+  libusb_device * list[MAX_DEVICES];
+  int count = cached_enumerate_devices(vendor_id, product_id, ids);
+  if(register_devices(ids, count, list) == 0) return NULL;
+
+  // open the first matching device
+  libusb_device_handle * dev_handle = NULL;
+  if(libusb_open(list[0], &dev_handle) != LIBUSB_SUCCESS) return NULL;
 
-  return DEFAULT_LIBUSB_DEVICE;
+  return dev_handle;
 }
 
 
@@ -370,92 +1326,285 @@ int libusb_submit_transfer(struct libusb_transfer *transfer)
 {
   debug_log("libusb_submit_transfer(...)");
 
-  bool dir_in = (transfer->endpoint & 0x80) == 0x80;
-  uint8_t ep = transfer->endpoint & 0x7f;
+  // callbacks resubmit transfers that still point at their converted samples
+  restore_iq_samples(SHIM_TRANSFER(transfer));
 
-  add_pending_transfer(transfer);
+  // validate the device handle
+  if(!valid_handle(transfer->dev_handle)) return LIBUSB_ERROR_NO_DEVICE;
 
-  transfer->status = -1;
+  // send any queued control transfers before the device starts streaming
+  int result = flush_control_batch();
+  if(result < 0) return result;
 
   switch(transfer->type) {
+    // WebUSB uses transferIn/transferOut for both bulk and interrupt endpoints
     case LIBUSB_TRANSFER_TYPE_BULK:
-      if(dir_in) return submit_bulk_in_transfer(ep, 
-                                                transfer->length, 
-                                                transfer->buffer, 
-                                                transfer);
-      else return submit_bulk_out_transfer(ep, 
-                                           transfer->length, 
-                                           transfer->buffer, 
-                                           transfer);
+    case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+      break;
+    // isochronous transfers map to isochronousTransferIn/isochronousTransferOut
+    case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+      if(transfer->num_iso_packets < 0 ||
+         transfer->num_iso_packets > SHIM_TRANSFER(transfer)->iso_packets) return LIBUSB_ERROR_INVALID_PARAM;
       break;
     default:
-      printf("Transfer type not implemented: %u", transfer->type);
-      return 0;
+      warning_log("transfer type not implemented: %u", transfer->type);
+      return LIBUSB_ERROR_NOT_SUPPORTED;
+  }
+
+  pthread_mutex_lock(&transfer_lock);
+
+  // each pending transfer occupies at most two slots in the submission ring
+  // (submission and cancellation), and one in the completion ring
+  struct shim_transfer * t = SHIM_TRANSFER(transfer);
+  if(t->pending || pending_transfer_count >= TRANSFER_RING_SIZE / 2) {
+    pthread_mutex_unlock(&transfer_lock);
+    return LIBUSB_ERROR_BUSY;
+  }
+
+  add_pending_transfer(t);
+  t->cancelling = false;
+  t->device_id = transfer->dev_handle->dev->id;
+  t->stats_slot = endpoint_stats_slot(t->device_id, transfer->endpoint);
+  t->submit_time = emscripten_get_now();
+  if(t->stats_slot >= 0) transfer_stats[t->stats_slot].values[STAT_SUBMITTED]++;
+  transfer->status = -1;
+
+  // hand the transfer to the JS dispatcher without waiting on the main thread
+  post_submission(transfer);
+
+  pthread_mutex_unlock(&transfer_lock);
+  return LIBUSB_SUCCESS;
+}
+
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+  // debug_log("libusb_handle_events_timeout_completed(...)");
+
+  // if another thread is handling events, wait for it to end its pass
+  uint32_t passes = __atomic_load_n(&event_passes, __ATOMIC_ACQUIRE);
+  if(!try_lock_events()) {
+    wait_for_event_pass(passes, timeval_to_ms(tv));
+    return LIBUSB_SUCCESS;
   }
 
+  // handle any completions and device events that have already been posted, or
+  // block until one is posted, or the timeout expires
+  int handled = process_hotplug_events() + process_completed_transfers();
+  if(handled == 0 && (completed == NULL || !*completed) && wait_for_completions(timeval_to_ms(tv))) {
+    process_hotplug_events();
+    process_completed_transfers();
+  }
+  unlock_events();
   return LIBUSB_SUCCESS;
 }
 
 
 int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
 {
-  // debug_log("libusb_handle_events_timeout(...)"); 
-  process_completed_transfers();
+  return libusb_handle_events_timeout_completed(ctx, tv, NULL);
 }
 
-int libusb_cancel_transfer(struct libusb_transfer *transfer)
+
+int libusb_handle_events_completed(libusb_context *ctx, int *completed)
 {
-  debug_log("libusb_cancel_transfer(...)"); 
-  transfer->status = LIBUSB_TRANSFER_CANCELLED;
+  struct timeval tv = { DEFAULT_EVENT_TIMEOUT_SECONDS, 0 };
+  return libusb_handle_events_timeout_completed(ctx, &tv, completed);
 }
 
 
-/******************************************
- * HERE BE DRAGONS AND UNDEFINED BEHAVIOR *
- ******************************************/ 
+int libusb_handle_events(libusb_context *ctx)
+{
+  return libusb_handle_events_completed(ctx, NULL);
+}
+
+
+int libusb_handle_events_locked(libusb_context *ctx, struct timeval *tv)
+{
+  return libusb_handle_events_timeout_completed(ctx, tv, NULL);
+}
+
+
+int libusb_wait_for_event(libusb_context *ctx, struct timeval *tv)
+{
+  // returns 1 if the timeout expired, 0 otherwise
+  return wait_for_completions(timeval_to_ms(tv)) ? 0 : 1;
+}
+
+
+void libusb_interrupt_event_handler(libusb_context *ctx)
+{
+  debug_log("libusb_interrupt_event_handler(...)");
+  interrupt_completion_wait();
+}
 
 int libusb_bulk_transfer(libusb_device_handle *dev_handle,
 	unsigned char endpoint, unsigned char *data, int length,
 	int *actual_length, unsigned int timeout)
 {
-  fprintf(stderr, "not implemented: libusb_bulk_transfer\n");
+  debug_log("libusb_bulk_transfer(...)");
+  return sync_transfer(dev_handle, LIBUSB_TRANSFER_TYPE_BULK, endpoint,
+                       data, length, actual_length, timeout);
 }
 
+
 int libusb_interrupt_transfer(libusb_device_handle *dev_handle,
 	unsigned char endpoint, unsigned char *data, int length,
 	int *actual_length, unsigned int timeout)
 {
-  fprintf(stderr, "not implemented: libusb_interrupt_transfer\n");  
+  debug_log("libusb_interrupt_transfer(...)");
+  return sync_transfer(dev_handle, LIBUSB_TRANSFER_TYPE_INTERRUPT, endpoint,
+                       data, length, actual_length, timeout);
 }
 
-void libusb_transfer_set_stream_id(struct libusb_transfer *transfer, uint32_t stream_id)
+
+void libusb_set_debug(libusb_context *ctx, int level)
 {
-  fprintf(stderr, "not implemented: libusb_transfer_set_stream_id\n");
+  if(level < LIBUSB_LOG_LEVEL_NONE) level = LIBUSB_LOG_LEVEL_NONE;
+  if(level > LIBUSB_LOG_LEVEL_DEBUG) level = LIBUSB_LOG_LEVEL_DEBUG;
+  log_level = level;
 }
 
-uint32_t libusb_transfer_get_stream_id(struct libusb_transfer *transfer)
+
+// there is a single context, so global and context callbacks are the same
+void libusb_set_log_cb(libusb_context *ctx, libusb_log_cb cb, int mode)
 {
-  fprintf(stderr, "not implemented: libusb_transfer_get_stream_id\n");
+  log_callback = cb;
 }
 
-void libusb_set_debug(libusb_context *ctx, int level)
+
+int libusb_has_capability(uint32_t capability)
+{
+  debug_log("libusb_has_capability(...)");
+  switch(capability) {
+    case LIBUSB_CAP_HAS_CAPABILITY:
+    case LIBUSB_CAP_HAS_HOTPLUG:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+
+int libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags,
+  int vendor_id, int product_id, int dev_class,
+  libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
 {
-  fprintf(stderr, "not implemented: libusb_set_debug\n");
+  debug_log("libusb_hotplug_register_callback(...)");
+
+  // validate the arguments
+  if(ctx != DEFAULT_LIBUSB_CONTEXT || cb_fn == NULL) return LIBUSB_ERROR_INVALID_PARAM;
+  if((events & (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT)) == 0) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+
+  // find a free callback slot
+  int x = 0;
+  while(x < MAX_HOTPLUG_CALLBACKS && hotplug_callbacks[x].registered) x++;
+  if(x == MAX_HOTPLUG_CALLBACKS) return LIBUSB_ERROR_NO_MEM;
+
+  struct hotplug_callback * cb = &hotplug_callbacks[x];
+  cb->events = events;
+  cb->vendor_id = vendor_id;
+  cb->product_id = product_id;
+  cb->dev_class = dev_class;
+  cb->fn = cb_fn;
+  cb->user_data = user_data;
+  cb->registered = true;
+  if(callback_handle != NULL) *callback_handle = x + 1;
+
+  // report the connected devices as arrivals
+  // - only devices already known to the shim (enumerated, or seen connecting) are listed
+  if(flags & LIBUSB_HOTPLUG_ENUMERATE) {
+    for(int d = 0; d < MAX_DEVICES && cb->registered; d++) {
+      libusb_device * dev = &devices[d];
+      if(!dev->registered || !dev->connected) continue;
+      if(!hotplug_callback_matches(cb, dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)) continue;
+      if(cb_fn(ctx, dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data) == 1) cb->registered = false;
+    }
+  }
+  return LIBUSB_SUCCESS;
 }
 
-void libusb_set_log_cb(libusb_context *ctx, libusb_log_cb cb, int mode)
+
+void libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
 {
-  fprintf(stderr, "not implemented: libusb_set_log_cb\n");
+  debug_log("libusb_hotplug_deregister_callback(...)");
+  if(callback_handle < 1 || callback_handle > MAX_HOTPLUG_CALLBACKS) return;
+  hotplug_callbacks[callback_handle - 1].registered = false;
 }
 
-const struct libusb_version * libusb_get_version(void)
+
+int libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
 {
-  fprintf(stderr, "not implemented: libusb_get_version\n");
+  debug_log("libusb_clear_halt(...)");
+
+  // validate the device handle
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  int result = flush_control_batch();
+  if(result < 0) return result;
+
+  // clear the halt, which also aborts the endpoint's outstanding WebUSB transfers
+  return clear_halt(dev_handle->dev->id, endpoint);
 }
 
-int libusb_has_capability(uint32_t capability)
+
+int libusb_reset_device(libusb_device_handle *dev_handle)
+{
+  debug_log("libusb_reset_device(...)");
+
+  // validate the device handle
+  if(!valid_handle(dev_handle)) return LIBUSB_ERROR_INVALID_PARAM;
+
+  int result = flush_control_batch();
+  if(result < 0) return result;
+
+  // reset the device, which aborts all of its outstanding WebUSB transfers
+  return reset_device(dev_handle->dev->id);
+}
+
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+  debug_log("libusb_cancel_transfer(...)"); 
+
+  pthread_mutex_lock(&transfer_lock);
+
+  // only pending transfers that aren't already being cancelled can be cancelled
+  struct shim_transfer * t = SHIM_TRANSFER(transfer);
+  if(!t->pending || t->cancelling) {
+    pthread_mutex_unlock(&transfer_lock);
+    return LIBUSB_ERROR_NOT_FOUND;
+  }
+
+  // the dispatcher completes the transfer as CANCELLED, unless it has already completed
+  t->cancelling = true;
+  post_cancellation(transfer);
+
+  pthread_mutex_unlock(&transfer_lock);
+  return LIBUSB_SUCCESS;
+}
+
+
+/******************************************
+ * HERE BE DRAGONS AND UNDEFINED BEHAVIOR *
+ ******************************************/ 
+
+void libusb_transfer_set_stream_id(struct libusb_transfer *transfer, uint32_t stream_id)
+{
+  fprintf(stderr, "not implemented: libusb_transfer_set_stream_id\n");
+}
+
+uint32_t libusb_transfer_get_stream_id(struct libusb_transfer *transfer)
+{
+  fprintf(stderr, "not implemented: libusb_transfer_get_stream_id\n");
+}
+
+
+const struct libusb_version * libusb_get_version(void)
 {
-  fprintf(stderr, "not implemented: libusb_has_capability\n");
+  fprintf(stderr, "not implemented: libusb_get_version\n");
 }
 
 const char * libusb_error_name(int errcode)
@@ -483,16 +1632,6 @@ void libusb_unref_device(libusb_device *dev)
   fprintf(stderr, "not implemented: libusb_unref_device\n");
 }
 
-int libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
-{
-  fprintf(stderr, "not implemented: libusb_get_config_descriptor\n");
-}
-
-int libusb_get_config_descriptor_by_value(libusb_device *dev, uint8_t bConfigurationValue, struct libusb_config_descriptor **config)
-{
-  fprintf(stderr, "not implemented: libusb_get_config_descriptor_by_value\n");
-}
-
 int libusb_get_ss_endpoint_companion_descriptor( libusb_context *ctx, const struct libusb_endpoint_descriptor *endpoint, struct libusb_ss_endpoint_companion_descriptor **ep_comp)
 {
   fprintf(stderr, "not implemented: libusb_get_ss_endpoint_companion_descriptor\n");
@@ -563,41 +1702,17 @@ int libusb_get_device_speed(libusb_device *dev)
   fprintf(stderr, "not implemented: libusb_get_device_speed\n");
 }
 
-int libusb_get_max_packet_size(libusb_device *dev, unsigned char endpoint)
-{
-  fprintf(stderr, "not implemented: libusb_get_max_packet_size\n");
-}
-
-int libusb_get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint)
-{
-  fprintf(stderr, "not implemented: libusb_get_max_iso_packet_size\n");
-}
 
 int libusb_wrap_sys_device(libusb_context *ctx, intptr_t sys_dev, libusb_device_handle **dev_handle)
 {
   fprintf(stderr, "not implemented: libusb_wrap_sys_device\n");
 }
 
-int libusb_set_configuration(libusb_device_handle *dev_handle, int configuration)
-{
-  fprintf(stderr, "not implemented: libusb_set_configuration\n");
-}
-
 int libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting)
 {
   fprintf(stderr, "not implemented: libusb_set_interface_alt_setting\n");
 }
 
-int libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
-{
-  fprintf(stderr, "not implemented: libusb_clear_halt\n");
-}
-
-int libusb_reset_device(libusb_device_handle *dev_handle)
-{
-  fprintf(stderr, "not implemented: libusb_reset_device\n");
-}
-
 int libusb_alloc_streams(libusb_device_handle *dev_handle, uint32_t num_streams, unsigned char *endpoints, int num_endpoints)
 {
   fprintf(stderr, "not implemented: libusb_alloc_streams\n");
@@ -658,11 +1773,6 @@ int libusb_event_handler_active(libusb_context *ctx)
   fprintf(stderr, "not implemented: implemented\n");
 }
 
-void libusb_interrupt_event_handler(libusb_context *ctx)
-{
-  fprintf(stderr, "not implemented: libusb_interrupt_event_handler\n");
-}
-
 void libusb_lock_event_waiters(libusb_context *ctx)
 {
   fprintf(stderr, "not implemented: libusb_lock_event_waiters\n");
@@ -673,33 +1783,6 @@ void libusb_unlock_event_waiters(libusb_context *ctx)
   fprintf(stderr, "not implemented: libusb_unlock_event_waiters\n");
 }
 
-int libusb_wait_for_event(libusb_context *ctx, struct timeval *tv)
-{
-  fprintf(stderr, "not implemented: libusb_wait_for_event\n");
-}
-
-int libusb_handle_events_timeout_completed(libusb_context *ctx,
-	struct timeval *tv, int *completed)
-{
-  fprintf(stderr, "not implemented: libusb_handle_events_timeout_completed\n");
-}
-
-int libusb_handle_events(libusb_context *ctx)
-{
-  fprintf(stderr, "not implemented: libusb_handle_events\n");
-}
-
-int libusb_handle_events_completed(libusb_context *ctx, int *completed)
-{
-  fprintf(stderr, "not implemented: libusb_handle_events_completed\n");
-}
-
-int libusb_handle_events_locked(libusb_context *ctx,
-	struct timeval *tv)
-{
-  fprintf(stderr, "not implemented: libusb_handle_events_locked\n");
-}
-
 int libusb_pollfds_handle_timeouts(libusb_context *ctx)
 {
   fprintf(stderr, "not implemented: libusb_pollfds_handle_timeouts\n");
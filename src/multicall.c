@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+
+// multi-call entry point (busybox-style)
+// - the hackrf tools are linked into one module, with each tool's main renamed to
+//   <tool>_main (see the Makefile multi-call rules), and main runs the tool named by
+//   argv[0], without its directory or extension (e.g. "hackrf_info" or "build/hackrf_info.js")
+// - "hackrf <tool> [args]" works too, for loaders that can't set argv[0]
+
+int hackrf_info_main(int argc, char **argv);
+int hackrf_clock_main(int argc, char **argv);
+int hackrf_transfer_main(int argc, char **argv);
+int hackrf_spiflash_main(int argc, char **argv);
+
+struct multicall_tool {
+  const char * name;
+  int (*main)(int argc, char **argv);
+};
+
+static const struct multicall_tool tools[] = {
+  { "hackrf_info",     hackrf_info_main },
+  { "hackrf_clock",    hackrf_clock_main },
+  { "hackrf_transfer", hackrf_transfer_main },
+  { "hackrf_spiflash", hackrf_spiflash_main },
+};
+#define TOOL_COUNT (sizeof(tools) / sizeof(tools[0]))
+
+
+// find the tool named by a path, or NULL
+static const struct multicall_tool * find_tool(const char *path)
+{
+  const char * name = strrchr(path, '/');
+  name = (name != NULL) ? name + 1 : path;
+  size_t length = strcspn(name, ".");
+  for(size_t x = 0; x < TOOL_COUNT; x++) {
+    if(strlen(tools[x].name) == length && strncmp(tools[x].name, name, length) == 0) return &tools[x];
+  }
+  return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+  // dispatch on argv[0], then on argv[1]
+  for(int x = 0; x < 2 && x < argc; x++) {
+    const struct multicall_tool * tool = find_tool(argv[x]);
+    if(tool != NULL) return tool->main(argc - x, argv + x);
+  }
+
+  fprintf(stderr, "usage: hackrf <tool> [args...]\ntools:");
+  for(size_t x = 0; x < TOOL_COUNT; x++) fprintf(stderr, " %s", tools[x].name);
+  fprintf(stderr, "\n");
+  return 1;
+}
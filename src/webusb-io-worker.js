@@ -0,0 +1,102 @@
+// dedicated WebUSB I/O worker
+// - owns the WebUSB devices in I/O worker mode, so transfer completions
+//   don't wait on the UI event loop
+// - runs the transfer engine from webusb-io.js directly on the shared wasm memory
+
+importScripts("webusb-io.js");
+
+
+// state used by the transfer engine (see webusb-io.js)
+var wasmMemory = undefined;
+var webusb_devices = [];
+var runtime_config = { usb: {} };
+
+
+// commands from the main thread (see _io_worker_call in webusb.js)
+const commands = {
+
+  // start the transfer engine on the shared wasm memory
+  start: async (msg) => {
+    wasmMemory = msg.memory;
+    transfer_layout = msg.layout;
+    transfer_stats = msg.stats;
+    runtime_config.usb.queue_depth = msg.queue_depth;
+    runtime_config.usb.coalesce = msg.coalesce;
+    _set_transfer_rings(...msg.rings);
+    _run_transfer_dispatcher();
+  },
+
+  // re-acquire a device that was authorized on the main thread
+  add_device: async (msg) => {
+    let devices = await navigator.usb.getDevices();
+    let device = devices.find((d) => d.vendorId == msg.vendor_id &&
+                                     d.productId == msg.product_id &&
+                                     d.serialNumber == msg.serial_number);
+    if(device === undefined) throw `I/O worker could not find USB device ${msg.device_id}`;
+    webusb_devices[msg.device_id] = device;
+  },
+
+  // run a WebUSB device method
+  device: async (msg) => {
+    let result = await webusb_devices[msg.device_id][msg.method](...msg.args);
+    if(result === undefined) return undefined;
+    if(result.data !== undefined) return { status: result.status, data: result.data };
+    if(result.bytesWritten !== undefined) return { status: result.status, bytesWritten: result.bytesWritten };
+    return undefined;
+  },
+
+  // run a batch of control OUT transfers, pipelined (see _control_transfer_batch in webusb.js)
+  control_batch: async (msg) => {
+    return _control_transfer_out_batch(webusb_devices[msg.device_id], msg.transfers);
+  },
+
+  // reset a device after a control transfer timed out (see _reset_after_timeout in webusb-io.js)
+  reset_after_timeout: async (msg) => {
+    return _reset_after_timeout(webusb_devices[msg.device_id]);
+  },
+};
+
+
+// how commands are ordered
+// - worker setup and configuration changes run in order, once every earlier command
+//   has settled, since later commands depend on them
+// - transfers (including control batches) only wait for the configuration changes before
+//   them, and are issued in order (WebUSB keeps transfers on an endpoint in order itself)
+// - clearHalt, reset and resets after a control transfer timeout run right away: they
+//   abort hung transfers (see _abort_in_flight in webusb-io.js), so they can't wait
+//   behind them
+const ORDERED_COMMANDS = ["start", "add_device"];
+const ORDERED_METHODS = ["open", "close", "selectConfiguration", "claimInterface", "releaseInterface"];
+const IMMEDIATE_COMMANDS = ["reset_after_timeout"];
+const IMMEDIATE_METHODS = ["clearHalt", "reset"];
+
+// settles once the last ordered command has run, and the commands still running since
+var ordered_commands = Promise.resolve();
+var running_commands = new Set();
+
+// run a command, and post its result
+async function _run_command(msg) {
+  try {
+    postMessage({ id: msg.id, result: await commands[msg.cmd](msg) });
+  } catch (error) {
+    postMessage({ id: msg.id, error: `${error}` });
+  }
+}
+
+onmessage = (event) => {
+  let msg = event.data;
+  let method = (msg.cmd == "device") ? msg.method : undefined;
+  if(IMMEDIATE_COMMANDS.includes(msg.cmd) || IMMEDIATE_METHODS.includes(method)) {
+    _run_command(msg);
+    return;
+  }
+  if(ORDERED_COMMANDS.includes(msg.cmd) || ORDERED_METHODS.includes(method)) {
+    let earlier = Promise.all([ordered_commands, ...running_commands]);
+    running_commands.clear();
+    ordered_commands = earlier.then(() => _run_command(msg));
+    return;
+  }
+  let command = ordered_commands.then(() => _run_command(msg));
+  running_commands.add(command);
+  command.then(() => running_commands.delete(command));
+};
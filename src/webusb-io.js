@@ -0,0 +1,1252 @@
+// WebUSB transfer engine
+// - dispatches libusb transfers from the submission ring to WebUSB, and posts
+//   their completions to the completion ring
+// - runs on the main thread (see webusb.js), or in the dedicated I/O worker
+//   (see webusb-io-worker.js), and only depends on wasmMemory, webusb_devices
+//   and runtime_config.usb
+
+const LIBUSB_SUCCESS = 0;
+const LIBUSB_ERROR_IO = -1;
+const LIBUSB_ERROR_NO_DEVICE = -4;
+const LIBUSB_ERROR_TIMEOUT = -7;
+const LIBUSB_ERROR_OVERFLOW = -8;
+const LIBUSB_ERROR_PIPE = -9;
+const LIBUSB_TRANSFER_COMPLETED = 0;
+const LIBUSB_TRANSFER_ERROR = 1;
+const LIBUSB_TRANSFER_TIMED_OUT = 2;
+const LIBUSB_TRANSFER_CANCELLED = 3;
+const LIBUSB_TRANSFER_STALL = 4;
+const LIBUSB_TRANSFER_NO_DEVICE = 5;
+const LIBUSB_TRANSFER_OVERFLOW = 6;
+const LIBUSB_TRANSFER_TYPE_ISOCHRONOUS = 1;
+const LIBUSB_TRANSFER_TYPE_BULK = 2;
+const LIBUSB_TRANSFER_TYPE_INTERRUPT = 3;
+
+
+// libusb_transfer field offsets, provided by the C side (see init_webusb)
+var transfer_layout = undefined;
+
+
+// transfer rings shared with libusb (see struct transfer_ring)
+// - submission ring: libusb_submit_transfer -> transfer dispatcher
+// - completion ring: transfer handlers -> libusb event loop
+var submission_ring = undefined;
+var completion_ring = undefined;
+
+
+// per-endpoint transfer queues, keyed by device id and endpoint address
+// - up to queue_depth WebUSB transfers are kept in flight on each endpoint
+const DEFAULT_QUEUE_DEPTH = 16;
+var endpoint_queues = new Map();
+var dispatcher_running = false;
+
+
+// bulk transfer coalescing (see usb.coalesce in client/config.js)
+// - queued bulk transfers on an endpoint are merged into one WebUSB transfer of up
+//   to the endpoint's merge size, and its result is split back across them in order
+// - while COALESCE_PIPELINE merged transfers are in flight, transfers wait until a
+//   full merge size is queued, so resubmissions arriving one at a time still merge
+// - the merge size follows the endpoint's throughput, measured over COALESCE_WINDOW
+//   WebUSB transfers (see _adapt_coalesce_size)
+const COALESCE_MIN_BYTES = 64 * 1024;
+const COALESCE_MAX_BYTES = 1024 * 1024;
+const COALESCE_PIPELINE = 2;
+const COALESCE_WINDOW = 16;
+const COALESCE_TOLERANCE = 0.05;
+var coalesce_pending = new Set();
+
+
+// requests for pending transfers, keyed by libusb_transfer address
+var active_transfers = new Map();
+
+// submission order of transfers, for queueing aborted transfers again (see _requeue_aborted_transfer)
+var transfer_sequence = 0;
+
+
+// tag bit marking cancellation requests in the submission ring (see webusb.h)
+const TRANSFER_RING_CANCEL = 1;
+
+
+// per-endpoint transfer statistics (see struct endpoint_stats in webusb.h)
+const STAT_KEY = 0;
+const STAT_SUBMITTED = 1;
+const STAT_CALLBACK_MS = 2;
+const STAT_COMPLETED = 3;
+const STAT_ERRORS = 4;
+const STAT_CANCELLED = 5;
+const STAT_DROPPED = 6;
+const STAT_QUEUED = 7;
+const STAT_IN_FLIGHT = 8;
+const STAT_MAX_IN_FLIGHT = 9;
+const STAT_BYTES = 10;
+const STAT_FIRST_COMPLETION = 11;
+const STAT_LAST_COMPLETION = 12;
+const STAT_DISPATCH_MS = 13;
+const STAT_WEBUSB_MS = 14;
+const STAT_COPY_MS = 15;
+const STAT_CONVERT_MS = 16;
+var transfer_stats = undefined;
+
+
+// interrupt IN endpoint pollers, keyed by device id and endpoint address
+// - each poller keeps one transferIn outstanding while libusb transfers are waiting
+//   for reports, so reports stay on the device (and fresh) until they're asked for
+var interrupt_pollers = new Map();
+
+
+// endpoint bInterval values, keyed by device id and configuration index
+var endpoint_intervals = new Map();
+
+
+// cached views of the wasm heap
+// - rebuilt whenever the underlying buffer changes (memory growth)
+var heap_u8 = undefined;
+var heap_i32 = undefined;
+var heap_f64 = undefined;
+
+
+// pooled staging buffers for outgoing transfers, keyed by length
+const STAGING_POOL_DEPTH = 32;
+var staging_pool = new Map();
+
+
+// set the libusb_transfer and libusb_iso_packet_descriptor field offsets
+function _set_transfer_layout(device_id, stats_slot, submit_time, endpoint, type, status, length, actual_length, buffer, timeout,
+                              num_iso_packets, iso_packet_desc, iso_packet_size,
+                              iso_length, iso_actual_length, iso_status) {
+  transfer_layout = {
+    device_id: device_id,
+    stats_slot: stats_slot,
+    submit_time: submit_time,
+    endpoint: endpoint,
+    type: type,
+    status: status,
+    length: length,
+    actual_length: actual_length,
+    buffer: buffer,
+    timeout: timeout,
+    num_iso_packets: num_iso_packets,
+    iso_packet_desc: iso_packet_desc,
+    iso_packet_size: iso_packet_size,
+    iso_length: iso_length,
+    iso_actual_length: iso_actual_length,
+    iso_status: iso_status,
+  };
+}
+
+
+// set the location of the transfer rings
+function _set_transfer_rings(submitted, completed, head_offset, tail_offset, entries_offset, size) {
+  let ring = (ptr) => ({
+    head: ptr + head_offset,
+    tail: ptr + tail_offset,
+    entries: ptr + entries_offset,
+    size: size,
+  });
+  submission_ring = ring(submitted);
+  completion_ring = ring(completed);
+}
+
+
+// set the location and layout of the endpoint statistics block
+function _set_transfer_stats(ptr, slots, size, histogram_offset, buckets, sub_buckets) {
+  transfer_stats = {
+    ptr: ptr,
+    slots: slots,
+    size: size,
+    histogram_offset: histogram_offset,
+    buckets: buckets,
+    sub_buckets: sub_buckets,
+  };
+}
+
+
+// get the number of transfers to keep in flight per endpoint
+function _get_queue_depth() {
+  if(typeof runtime_config !== "undefined" && runtime_config.usb.queue_depth !== undefined) {
+    return runtime_config.usb.queue_depth;
+  }
+  return DEFAULT_QUEUE_DEPTH;
+}
+
+
+// get whether bulk transfers are coalesced
+function _get_coalesce() {
+  return typeof runtime_config !== "undefined" && runtime_config.usb.coalesce === true;
+}
+
+
+// read a submitted libusb_transfer from the heap
+function _read_transfer(transfer) {
+  let heap = _heap_i32();
+  let heap_u8 = _heap_u8();
+  let request = {
+    transfer: transfer,
+    device_id: heap[(transfer + transfer_layout.device_id) >> 2],
+    endpoint: heap_u8[transfer + transfer_layout.endpoint],
+    type: heap_u8[transfer + transfer_layout.type],
+    length: heap[(transfer + transfer_layout.length) >> 2],
+    buffer: heap[(transfer + transfer_layout.buffer) >> 2],
+    timeout: heap[(transfer + transfer_layout.timeout) >> 2] >>> 0,
+    stats_slot: heap[(transfer + transfer_layout.stats_slot) >> 2],
+    submit_time: _heap_f64()[(transfer + transfer_layout.submit_time) >> 3],
+    webusb_ms: 0,
+    copy_ms: 0,
+  };
+  _add_stat(request, STAT_DISPATCH_MS, _stats_now() - request.submit_time);
+
+  // isochronous transfers also carry the requested length of each packet
+  if(request.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+    let num_packets = heap[(transfer + transfer_layout.num_iso_packets) >> 2];
+    request.packet_lengths = new Array(num_packets);
+    for(let x = 0; x < num_packets; x++) {
+      request.packet_lengths[x] = heap[(_iso_packet(transfer, x) + transfer_layout.iso_length) >> 2];
+    }
+  }
+  return request;
+}
+
+
+// get the address of a transfer's iso packet descriptor
+function _iso_packet(transfer, index) {
+  return transfer + transfer_layout.iso_packet_desc + index * transfer_layout.iso_packet_size;
+}
+
+
+// drain the submission ring into the endpoint queues
+// - libusb_submit_transfer notifies the ring tail after each submission,
+//   so the dispatcher sleeps in Atomics.waitAsync between bursts
+// - entries tagged with TRANSFER_RING_CANCEL are cancellation requests
+async function _run_transfer_dispatcher() {
+  if(dispatcher_running) return;
+  dispatcher_running = true;
+  while(true) {
+    let heap = _heap_i32();
+    let head = Atomics.load(heap, submission_ring.head >> 2);
+    let tail = Atomics.load(heap, submission_ring.tail >> 2);
+    while(head != tail) {
+      let entry = heap[(submission_ring.entries >> 2) + (head & (submission_ring.size - 1))];
+      if(entry & TRANSFER_RING_CANCEL) _cancel_transfer(entry & ~TRANSFER_RING_CANCEL);
+      else _queue_transfer(_read_transfer(entry));
+      head = (head + 1) | 0;
+    }
+    Atomics.store(heap, submission_ring.head >> 2, head);
+
+    // coalesced endpoints are started once the whole burst is queued
+    for(let queue of coalesce_pending) _pump_endpoint_queue(queue);
+    coalesce_pending.clear();
+
+    // wait for the next submission
+    if(Atomics.waitAsync !== undefined) {
+      let result = Atomics.waitAsync(heap, submission_ring.tail >> 2, tail);
+      if(result.async) await result.value;
+    } else {
+      await new Promise((resolve) => setTimeout(resolve, 1));
+    }
+  }
+}
+
+
+// add a transfer to its endpoint queue
+function _queue_transfer(request) {
+  active_transfers.set(request.transfer, request);
+  request.sequence = transfer_sequence++;
+
+  // interrupt IN transfers are completed by the endpoint's poller
+  if(request.type == LIBUSB_TRANSFER_TYPE_INTERRUPT && (request.endpoint & 0x80)) {
+    _queue_interrupt_transfer(request);
+    return;
+  }
+
+  // time the transfer out from its submission, as libusb does, whether it's still
+  // queued or in flight (see _abort_transfer)
+  if(request.timeout > 0) {
+    let remaining = Math.max(0, request.submit_time + request.timeout - _stats_now());
+    request.timer = setTimeout(() => _abort_transfer(request, LIBUSB_TRANSFER_TIMED_OUT), remaining);
+  }
+
+  let key = (request.device_id << 8) | request.endpoint;
+  let queue = endpoint_queues.get(key);
+  if(queue === undefined) {
+    queue = { device_id: request.device_id, waiting: [], in_flight: new Set(), requests: 0, coalesce: undefined,
+              aborting: 0, draining: false };
+    if(request.type == LIBUSB_TRANSFER_TYPE_BULK && _get_coalesce()) {
+      queue.coalesce = { size: COALESCE_MIN_BYTES, step: 2, rate: undefined,
+                         window_start: undefined, window_bytes: 0, window_count: 0 };
+    }
+    endpoint_queues.set(key, queue);
+  }
+  queue.waiting.push(request);
+  _set_stat(request, STAT_QUEUED, queue.waiting.length);
+  if(queue.coalesce !== undefined) coalesce_pending.add(queue);
+  else _pump_endpoint_queue(queue);
+}
+
+
+// start queued transfers until the endpoint has queue_depth WebUSB transfers in flight
+// - WebUSB resolves transfers on an endpoint in order, so completions stay ordered
+function _pump_endpoint_queue(queue) {
+  // hold the queue until an abort (see _abort_in_flight) has cleared the endpoint's halt
+  // and every WebUSB transfer it aborted has settled, so the aborted transfers go out first
+  if(queue.aborting > 0 || (queue.draining && queue.requests > 0)) return;
+  queue.draining = false;
+
+  let depth = _get_queue_depth();
+  while(queue.requests < depth && queue.waiting.length > 0) {
+    if(queue.coalesce !== undefined && queue.requests >= COALESCE_PIPELINE &&
+       _waiting_bytes(queue) < queue.coalesce.size) break;
+
+    let group = _next_transfer_group(queue);
+    let r = group[0];
+    queue.requests++;
+    for(let x of group) queue.in_flight.add(x);
+    _set_stat(r, STAT_QUEUED, queue.waiting.length);
+    _set_stat(r, STAT_IN_FLIGHT, queue.in_flight.size);
+    _max_stat(r, STAT_MAX_IN_FLIGHT, queue.in_flight.size);
+
+    let promise;
+    if(queue.coalesce !== undefined) {
+      promise = _submit_coalesced_transfer(queue, group);
+    } else if(r.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+      promise = (r.endpoint & 0x80) ? _submit_iso_in_transfer(r) : _submit_iso_out_transfer(r);
+    } else {
+      promise = (r.endpoint & 0x80) ? _submit_bulk_in_transfer(r) : _submit_bulk_out_transfer(r);
+    }
+
+    promise.finally(() => {
+      queue.requests--;
+      for(let x of group) queue.in_flight.delete(x);
+      _set_stat(r, STAT_IN_FLIGHT, queue.in_flight.size);
+      _pump_endpoint_queue(queue);
+    });
+  }
+}
+
+
+// take the next transfers to run as one WebUSB transfer off an endpoint queue
+// - without coalescing, that's a single transfer
+// - coalesced transfers must end on a packet boundary (except the last), since a short
+//   packet would otherwise end the merged transfer in the middle of a libusb transfer
+function _next_transfer_group(queue) {
+  let group = [queue.waiting.shift()];
+  if(queue.coalesce === undefined) return group;
+
+  let device = webusb_devices[group[0].device_id];
+  let packet_size = (device !== undefined) ? _get_endpoint_packet_size(device, group[0].endpoint) : 0;
+  let bytes = group[0].length;
+  while(queue.waiting.length > 0 && packet_size > 0) {
+    let last = group[group.length - 1];
+    let next = queue.waiting[0];
+    if(last.length % packet_size != 0 || bytes + next.length > queue.coalesce.size) break;
+    group.push(queue.waiting.shift());
+    bytes += next.length;
+  }
+  return group;
+}
+
+
+// get the number of bytes queued on an endpoint
+function _waiting_bytes(queue) {
+  return queue.waiting.reduce((a, r) => a + r.length, 0);
+}
+
+
+// add an interrupt IN transfer to its endpoint poller, starting the poller if needed
+function _queue_interrupt_transfer(request) {
+  let key = (request.device_id << 8) | request.endpoint;
+  let poller = interrupt_pollers.get(key);
+  if(poller === undefined) {
+    poller = {
+      device_id: request.device_id,
+      endpoint: request.endpoint,
+      length: request.length,
+      waiting: [],
+      reports: [],
+      running: false,
+    };
+    interrupt_pollers.set(key, poller);
+  }
+  poller.waiting.push(request);
+
+  // time out the transfer if no report arrives for it in time
+  if(request.timeout > 0) {
+    request.timer = setTimeout(() => {
+      let index = poller.waiting.indexOf(request);
+      if(index < 0) return;
+      poller.waiting.splice(index, 1);
+      _post_completion(request, LIBUSB_TRANSFER_TIMED_OUT, 0);
+    }, request.timeout);
+  }
+
+  _deliver_interrupt_reports(poller);
+  if(!poller.running) _run_interrupt_poller(poller);
+}
+
+
+// keep a transferIn outstanding on an interrupt endpoint while transfers are waiting
+// - the host polls the endpoint at its bInterval while the transfer is outstanding,
+//   and a new transfer is issued as soon as a report arrives for a waiting transfer;
+//   bInterval (taken as milliseconds) also paces polling after empty reports and errors
+// - a report that arrives after its transfer was cancelled or timed out is kept for
+//   the next transfer, and no more are read until one is queued
+// - errors that arrive with no transfer waiting to report them are dropped
+async function _run_interrupt_poller(poller) {
+  poller.running = true;
+
+  let device = webusb_devices[poller.device_id];
+  if(device === undefined) {
+    console.warn(`_run_interrupt_poller called for unknown device ${poller.device_id}`);
+    for(let r of poller.waiting.splice(0)) _post_completion(r, LIBUSB_TRANSFER_NO_DEVICE, 0);
+    poller.running = false;
+    return;
+  }
+
+  let ep = poller.endpoint & 0x7f;
+  let length = Math.max(poller.length, _get_endpoint_packet_size(device, poller.endpoint));
+  let interval = Math.max(1, await _get_endpoint_interval(poller.device_id, poller.endpoint));
+
+  while(poller.waiting.length > poller.reports.length) {
+    let report;
+    try {
+      let result = await device.transferIn(ep, length);
+      report = { status: _transfer_status(result.status), data: result.data };
+    } catch (error) {
+      report = { status: _transfer_error_status(error) };
+    }
+
+    if(report.status != LIBUSB_TRANSFER_COMPLETED && poller.waiting.length == 0) continue;
+    poller.reports.push(report);
+    _deliver_interrupt_reports(poller);
+
+    if(report.status != LIBUSB_TRANSFER_COMPLETED || report.data.byteLength == 0) {
+      await new Promise((resolve) => setTimeout(resolve, interval));
+    }
+  }
+
+  poller.running = false;
+}
+
+
+// complete waiting interrupt transfers with buffered reports, in order
+function _deliver_interrupt_reports(poller) {
+  while(poller.waiting.length > 0 && poller.reports.length > 0) {
+    let r = poller.waiting.shift();
+    let report = poller.reports.shift();
+    clearTimeout(r.timer);
+    if(report.status != LIBUSB_TRANSFER_COMPLETED) {
+      _post_completion(r, report.status, 0);
+      continue;
+    }
+
+    // reports longer than the transfer buffer are truncated
+    let data = report.data;
+    let length = Math.min(data.byteLength, r.length);
+    _write_data_to_heap(new DataView(data.buffer, data.byteOffset, length), r.buffer);
+    _post_completion(r, data.byteLength > r.length ? LIBUSB_TRANSFER_OVERFLOW : LIBUSB_TRANSFER_COMPLETED, length);
+  }
+}
+
+
+// get the max packet size of an endpoint in the device's active configuration
+function _get_endpoint_packet_size(device, endpoint) {
+  let direction = (endpoint & 0x80) ? "in" : "out";
+  let configuration = device.configuration;
+  if(configuration === null || configuration === undefined) return 0;
+  for(let i of configuration.interfaces) {
+    for(let ep of i.alternate.endpoints) {
+      if(ep.endpointNumber == (endpoint & 0x7f) && ep.direction == direction) return ep.packetSize;
+    }
+  }
+  return 0;
+}
+
+
+// get the bInterval of an endpoint in the device's active configuration
+async function _get_endpoint_interval(device_id, endpoint) {
+  let device = webusb_devices[device_id];
+  let configuration = device.configuration;
+  if(configuration === null || configuration === undefined) return 0;
+  let config_index = device.configurations.findIndex((c) => c.configurationValue == configuration.configurationValue);
+  let intervals = await _get_endpoint_intervals(device_id, Math.max(config_index, 0));
+  return intervals.get(endpoint) ?? 0;
+}
+
+
+// get the bInterval of each endpoint in a configuration, keyed by endpoint address
+// - WebUSB doesn't expose bInterval, so it's read from the raw configuration
+//   descriptor (GET_DESCRIPTOR), which requires the device to be open
+// - closed devices get no intervals, and nothing is cached, so the lookup runs once the
+//   device is open (libusb_open re-reads the descriptors); failed reads are retried likewise
+async function _get_endpoint_intervals(device_id, config_index) {
+  const GET_DESCRIPTOR = 6;
+  const LIBUSB_DT_CONFIG = 2;
+  const LIBUSB_DT_ENDPOINT = 5;
+
+  let key = `${device_id}:${config_index}`;
+  let intervals = endpoint_intervals.get(key);
+  if(intervals !== undefined) return intervals;
+
+  intervals = new Map();
+  let device = webusb_devices[device_id];
+  if(!device.opened) return intervals;
+  let setup = {
+    requestType: "standard",
+    recipient: "device",
+    request: GET_DESCRIPTOR,
+    value: (LIBUSB_DT_CONFIG << 8) | config_index,
+    index: 0,
+  };
+  try {
+    // read the descriptor header for its total length, then the whole descriptor
+    let header = await device.controlTransferIn(setup, 9);
+    let result = await device.controlTransferIn(setup, header.data.getUint16(2, true));
+    let data = result.data;
+    for(let offset = 0; offset + 7 <= data.byteLength && data.getUint8(offset) > 0; offset += data.getUint8(offset)) {
+      if(data.getUint8(offset+1) == LIBUSB_DT_ENDPOINT) {
+        intervals.set(data.getUint8(offset+2), data.getUint8(offset+6));
+      }
+    }
+    endpoint_intervals.set(key, intervals);
+  } catch (error) {
+    console.warn(`could not read configuration descriptor ${config_index} of device ${device_id}`);
+  }
+  return intervals;
+}
+
+
+// complete a transfer and post it to the completion ring
+// - each transfer is completed once; results arriving after a transfer has been
+//   cancelled or timed out are dropped
+// - the ring can't overflow, since libusb_submit_transfer bounds the number of pending transfers
+function _post_completion(r, status, actual_length) {
+  if(r.completed) {
+    _add_stat(r, STAT_DROPPED, 1);
+    return;
+  }
+  r.completed = true;
+  clearTimeout(r.timer);
+  active_transfers.delete(r.transfer);
+  _record_completion(r, status, actual_length);
+
+  // set the transfer status and length
+  let heap = _heap_i32();
+  let transfer = r.transfer;
+  heap[(transfer + transfer_layout.actual_length) >> 2] = actual_length;
+  heap[(transfer + transfer_layout.status) >> 2] = status;
+
+  // publish the transfer to the event loop
+  let tail = Atomics.load(heap, completion_ring.tail >> 2);
+  heap[(completion_ring.entries >> 2) + (tail & (completion_ring.size - 1))] = transfer;
+  Atomics.store(heap, completion_ring.tail >> 2, (tail + 1) | 0);
+
+  // wake the event loop if it's blocked in wait_for_completions
+  Atomics.notify(heap, completion_ring.tail >> 2);
+}
+
+
+// cancel a pending transfer (see libusb_cancel_transfer)
+// - a transfer that has already completed can't be cancelled
+function _cancel_transfer(transfer) {
+  let r = active_transfers.get(transfer);
+  if(r === undefined) return;
+  _abort_transfer(r, LIBUSB_TRANSFER_CANCELLED);
+}
+
+
+// complete a pending transfer that was cancelled or timed out with that status
+// - queued transfers are removed from their queue, and in-flight transfers are
+//   completed right away; their WebUSB result is dropped when it arrives
+// - WebUSB can't abort a single transfer, so aborting an in-flight transfer clears the
+//   endpoint's halt, aborting all of its WebUSB transfers (see _abort_in_flight)
+function _abort_transfer(r, status) {
+  let key = (r.device_id << 8) | r.endpoint;
+  let queue = endpoint_queues.get(key);
+  let poller = interrupt_pollers.get(key);
+  if(poller !== undefined) {
+    let index = poller.waiting.indexOf(r);
+    if(index >= 0) poller.waiting.splice(index, 1);
+  }
+  else if(queue !== undefined) {
+    let index = queue.waiting.indexOf(r);
+    if(index >= 0) queue.waiting.splice(index, 1);
+  }
+  if(r.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) _fail_iso_transfer(r, status);
+  else _post_completion(r, status, 0);
+  if(queue === undefined || !queue.in_flight.has(r) || queue.aborting > 0) return;
+
+  let device = webusb_devices[r.device_id];
+  let direction = (r.endpoint & 0x80) ? "in" : "out";
+  _abort_in_flight([queue], () => device.clearHalt(direction, r.endpoint & 0x7f)).catch((error) => {
+    console.warn(`clearHalt after ${status == LIBUSB_TRANSFER_TIMED_OUT ? "timeout" : "cancellation"} failed: ${error}`);
+  });
+}
+
+
+// abort the in-flight WebUSB transfers of endpoint queues with abort(), a WebUSB call that
+// aborts them (clearHalt or reset)
+// - the transfers they carried that haven't completed are queued again (see
+//   _requeue_aborted_transfer), and the queues hold until abort() and every aborted WebUSB
+//   transfer have settled, so those transfers go out first
+async function _abort_in_flight(queues, abort) {
+  for(let queue of queues) {
+    for(let x of queue.in_flight) {
+      if(!x.completed) x.aborted = true;
+    }
+    queue.aborting++;
+    queue.draining = true;
+  }
+  try {
+    await abort();
+  } finally {
+    for(let queue of queues) {
+      queue.aborting--;
+      _pump_endpoint_queue(queue);
+    }
+  }
+}
+
+
+// reset a device after a control transfer on it timed out
+// - the reset aborts every WebUSB transfer on the device, so the transfers in flight on
+//   its endpoints are queued again, as after a cancellation (see _abort_in_flight)
+// - in I/O worker mode, the endpoints are in the worker, which runs the reset
+function _reset_after_timeout(device) {
+  if(device.resetAfterTimeout !== undefined) return device.resetAfterTimeout();
+  let queues = [...endpoint_queues.values()].filter((q) => webusb_devices[q.device_id] === device);
+  return _abort_in_flight(queues, () => device.reset());
+}
+
+
+// queue a transfer whose WebUSB transfer was aborted by another transfer's cancellation
+// or timeout again, ahead of any transfers submitted after it
+// - returns false if the transfer wasn't aborted that way, so its failure stands
+function _requeue_aborted_transfer(r) {
+  if(r.aborted !== true || r.completed) return false;
+  r.aborted = false;
+  let queue = endpoint_queues.get((r.device_id << 8) | r.endpoint);
+  let index = queue.waiting.findIndex((x) => x.sequence > r.sequence);
+  queue.waiting.splice(index < 0 ? queue.waiting.length : index, 0, r);
+  _set_stat(r, STAT_QUEUED, queue.waiting.length);
+  return true;
+}
+
+
+// get a Uint8Array view of the wasm heap
+function _heap_u8() {
+  if(heap_u8 === undefined || heap_u8.buffer !== wasmMemory.buffer) {
+    heap_u8 = new Uint8Array(wasmMemory.buffer);
+  }
+  return heap_u8;
+}
+
+
+// get a Float64Array view of the wasm heap
+function _heap_f64() {
+  if(heap_f64 === undefined || heap_f64.buffer !== wasmMemory.buffer) {
+    heap_f64 = new Float64Array(wasmMemory.buffer);
+  }
+  return heap_f64;
+}
+
+
+// get an Int32Array view of the wasm heap
+function _heap_i32() {
+  if(heap_i32 === undefined || heap_i32.buffer !== wasmMemory.buffer) {
+    heap_i32 = new Int32Array(wasmMemory.buffer);
+  }
+  return heap_i32;
+}
+
+
+// copy the contents of a DataView (from a WebUSB transfer result) to the heap
+function _write_data_to_heap(data, ptr) {
+  _heap_u8().set(new Uint8Array(data.buffer, data.byteOffset, data.byteLength), ptr);
+  return data.byteLength;
+}
+
+
+// get the outgoing data for a heap buffer
+// - WebUSB rejects views of a SharedArrayBuffer, so when the heap is shared
+//   (pthread builds) the data is copied into a pooled staging buffer
+function _get_out_data(ptr, len) {
+  let heap = _heap_u8();
+  let view = heap.subarray(ptr, ptr+len);
+  if(typeof SharedArrayBuffer === "undefined" || !(heap.buffer instanceof SharedArrayBuffer)) {
+    return view;
+  }
+
+  // reuse a staging buffer of the same length if one is available
+  let pool = staging_pool.get(len);
+  let staging = (pool !== undefined && pool.length > 0) ? pool.pop() : new Uint8Array(len);
+  staging.set(view);
+  return staging;
+}
+
+
+// return the outgoing data from _get_out_data to the staging pool
+function _release_out_data(data) {
+  if(data.buffer === wasmMemory.buffer) return;
+  let pool = staging_pool.get(data.length);
+  if(pool === undefined) {
+    pool = [];
+    staging_pool.set(data.length, pool);
+  }
+  if(pool.length < STAGING_POOL_DEPTH) pool.push(data);
+}
+
+
+// submit an asynchronous bulk input transfer
+async function _submit_bulk_in_transfer(r) {
+
+  let device = webusb_devices[r.device_id];
+  if(device === undefined) {
+    console.warn(`_submit_bulk_in_transfer called for unknown device ${r.device_id}`);
+    _post_completion(r, LIBUSB_TRANSFER_NO_DEVICE, 0);
+    return false;
+  }
+
+  // perform the transfer
+  let ep = r.endpoint & 0x7f;
+  let result;
+  let start = _stats_now();
+  try {
+    result = await device.transferIn(ep, r.length);
+    r.webusb_ms = _stats_now() - start;
+  } catch (error) {
+    if(_requeue_aborted_transfer(r)) return false;
+    if(!r.completed) console.warn("transfer error in _submit_bulk_in_transfer");
+    _post_completion(r, _transfer_error_status(error), 0);
+    return false;
+  } 
+
+  // a cancelled transfer's buffer may already have been freed
+  if(r.completed) {
+    _add_stat(r, STAT_DROPPED, 1);
+    return false;
+  }
+
+  // write the received data to the heap buffer and post the completion
+  start = _stats_now();
+  let actual_length = _write_data_to_heap(result.data, r.buffer);
+  r.copy_ms = _stats_now() - start;
+  _post_completion(r, _transfer_status(result.status), actual_length);
+
+  return LIBUSB_SUCCESS;
+}
+
+
+// submit an asynchronous bulk output transfer
+async function _submit_bulk_out_transfer(r) {
+
+  let device = webusb_devices[r.device_id];
+  if(device === undefined) {
+    console.warn(`_submit_bulk_out_transfer called for unknown device ${r.device_id}`);
+    _post_completion(r, LIBUSB_TRANSFER_NO_DEVICE, 0);
+    return false;
+  }
+
+  // perform the transfer
+  let ep = r.endpoint & 0x7f;
+  let result;
+  let start = _stats_now();
+  let data = _get_out_data(r.buffer, r.length);
+  r.copy_ms = _stats_now() - start;
+  try {
+    result = await device.transferOut(ep, data);
+    r.webusb_ms = _stats_now() - start - r.copy_ms;
+  } catch (error) {
+    if(_requeue_aborted_transfer(r)) return false;
+    if(!r.completed) console.warn("transfer error in _submit_bulk_out_transfer");
+    _post_completion(r, _transfer_error_status(error), 0);
+    return false;
+  } finally {
+    _release_out_data(data);
+  }
+
+  // post the completion
+  _post_completion(r, _transfer_status(result.status), result.bytesWritten);
+
+  return LIBUSB_SUCCESS;
+}
+
+
+// submit a group of coalesced bulk transfers as one WebUSB transfer
+// - the data is split across the transfers in order; received IN data fills each transfer
+//   before the next, and a short packet ends the merged transfer early, so the transfers
+//   it didn't reach complete with no data (as libusb completes the rest of a split transfer
+//   after a short packet); queueing them again would reorder them behind the endpoint's next
+//   merged transfer, which may already be in flight
+// - each transfer keeps its own timeout (see _queue_transfer); one expiring aborts the
+//   merged transfer, and queues the rest of the group again
+async function _submit_coalesced_transfer(queue, group) {
+
+  let first = group[0];
+  let device = webusb_devices[first.device_id];
+  if(device === undefined) {
+    console.warn(`_submit_coalesced_transfer called for unknown device ${first.device_id}`);
+    for(let r of group) _post_completion(r, LIBUSB_TRANSFER_NO_DEVICE, 0);
+    return false;
+  }
+
+  // perform the transfer
+  let ep = first.endpoint & 0x7f;
+  let dir_in = (first.endpoint & 0x80) != 0;
+  let length = group.reduce((a, r) => a + r.length, 0);
+  let result;
+  let data = undefined;
+  let copy_ms = 0;
+  let start = _stats_now();
+  try {
+    if(dir_in) {
+      result = await device.transferIn(ep, length);
+    } else {
+      data = _gather_out_data(group, length);
+      copy_ms = _stats_now() - start;
+      result = await device.transferOut(ep, data);
+    }
+  } catch (error) {
+    let failed = group.filter((r) => !_requeue_aborted_transfer(r));
+    if(failed.some((r) => !r.completed)) console.warn("transfer error in _submit_coalesced_transfer");
+    for(let r of failed) _post_completion(r, _transfer_error_status(error), 0);
+    return false;
+  } finally {
+    if(data !== undefined) _release_out_data(data);
+  }
+  let webusb_ms = _stats_now() - start - copy_ms;
+
+  // split the result across the transfers
+  let status = _transfer_status(result.status);
+  let received = dir_in ? result.data.byteLength : result.bytesWritten;
+  let offset = 0;
+  for(let x = 0; x < group.length; x++) {
+    let r = group[x];
+    let actual_length = Math.min(r.length, received - offset);
+    r.webusb_ms = webusb_ms;
+    r.copy_ms = copy_ms / group.length;
+
+    // a cancelled transfer's buffer may already have been freed
+    if(r.completed) {
+      _add_stat(r, STAT_DROPPED, 1);
+    } else {
+      if(dir_in) {
+        let copy_start = _stats_now();
+        _write_data_to_heap(new DataView(result.data.buffer, result.data.byteOffset + offset, actual_length), r.buffer);
+        r.copy_ms = _stats_now() - copy_start;
+      }
+      _post_completion(r, offset + actual_length < received ? LIBUSB_TRANSFER_COMPLETED : status, actual_length);
+    }
+    offset += actual_length;
+  }
+
+  _adapt_coalesce_size(queue.coalesce, received);
+  return LIBUSB_SUCCESS;
+}
+
+
+// copy the outgoing data of a group of coalesced transfers into one staging buffer
+// - released with _release_out_data
+function _gather_out_data(group, length) {
+  let heap = _heap_u8();
+  let pool = staging_pool.get(length);
+  let staging = (pool !== undefined && pool.length > 0) ? pool.pop() : new Uint8Array(length);
+  let offset = 0;
+  for(let r of group) {
+    staging.set(heap.subarray(r.buffer, r.buffer + r.length), offset);
+    offset += r.length;
+  }
+  return staging;
+}
+
+
+// adapt an endpoint's merge size to its measured throughput
+// - hill climbing: the size keeps doubling (or halving) while each window's throughput
+//   improves, turns around when throughput drops, and holds while it's flat
+function _adapt_coalesce_size(c, bytes) {
+  let now = _stats_now();
+  if(c.window_start === undefined) {
+    c.window_start = now;
+    return;
+  }
+  c.window_bytes += bytes;
+  if(++c.window_count < COALESCE_WINDOW) return;
+
+  let rate = c.window_bytes / (now - c.window_start);
+  if(c.rate !== undefined && rate < c.rate * (1 - COALESCE_TOLERANCE)) c.step = 1 / c.step;
+  if(c.rate === undefined || Math.abs(rate - c.rate) > c.rate * COALESCE_TOLERANCE) {
+    c.size = Math.min(COALESCE_MAX_BYTES, Math.max(COALESCE_MIN_BYTES, c.size * c.step));
+  }
+  c.rate = rate;
+  c.window_start = now;
+  c.window_bytes = 0;
+  c.window_count = 0;
+}
+
+
+// run a control IN transfer, returning the data read (a DataView) or a libusb error
+// - a control transfer that times out leaves the default endpoint wedged, so the device is reset
+async function _control_transfer_in(device, setup, length, timeout) {
+  let result;
+  try {
+    result = await _with_timeout(device.controlTransferIn(setup, length), timeout, () => _reset_after_timeout(device));
+  } catch (error) {
+    console.warn(`controlTransferIn error: ${error}`);
+    return _control_transfer_error(_transfer_error_status(error));
+  }
+  if(result.status != "ok") {
+    return _control_transfer_error(_transfer_status(result.status));
+  }
+  return result.data;
+}
+
+
+// run a control OUT transfer, returning the number of bytes written or a libusb error
+// - buffer comes from _get_out_data, and is released once the transfer settles
+// - a control transfer that times out leaves the default endpoint wedged, so the device is reset
+async function _control_transfer_out(device, setup, buffer, timeout) {
+  let result;
+  try {
+    result = await _with_timeout(device.controlTransferOut(setup, buffer), timeout, () => _reset_after_timeout(device));
+  } catch (error) {
+    console.warn(`controlTransferOut error: ${error}`);
+    return _control_transfer_error(_transfer_error_status(error));
+  } finally {
+    _release_out_data(buffer);
+  }
+  if(result.status != "ok") {
+    return _control_transfer_error(_transfer_status(result.status));
+  }
+
+  // return the length of data written
+  return result.bytesWritten;
+}
+
+
+// run control OUT transfers ({ setup, data, timeout }, with data from _get_out_data)
+// pipelined: each is issued without waiting for the previous one to complete, and WebUSB
+// runs them in order on the default endpoint
+// - returns each transfer's bytes written or libusb error
+function _control_transfer_out_batch(device, transfers) {
+  return Promise.all(transfers.map((t) => _control_transfer_out(device, t.setup, t.data, t.timeout)));
+}
+
+
+// map a libusb transfer status to the error code returned by libusb_control_transfer
+function _control_transfer_error(status) {
+  switch(status) {
+    case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+    default:                        return LIBUSB_ERROR_IO;
+  }
+}
+
+
+// error thrown by _with_timeout when a transfer times out
+class TransferTimeoutError extends Error {
+  constructor() {
+    super("transfer timed out");
+    this.name = "TransferTimeoutError";
+  }
+}
+
+
+// race a WebUSB control transfer against a timeout in milliseconds (0 waits forever)
+// - WebUSB transfers can't be aborted, so on expiry reset() is awaited to reset
+//   the device, and a TransferTimeoutError is thrown; a late result of the transfer
+//   itself is discarded
+// - transfers on the endpoint queues are timed from their submission instead (see
+//   _queue_transfer)
+async function _with_timeout(promise, timeout, reset) {
+  if(timeout == 0) return promise;
+
+  let timer;
+  let expired = new Promise((resolve) => { timer = setTimeout(resolve, timeout, TransferTimeoutError); });
+  try {
+    let result = await Promise.race([promise, expired]);
+    if(result !== TransferTimeoutError) return result;
+  } finally {
+    clearTimeout(timer);
+  }
+
+  promise.catch(() => {});
+  try {
+    await reset();
+  } catch (error) {
+    console.warn(`reset after transfer timeout failed: ${error}`);
+  }
+  throw new TransferTimeoutError();
+}
+
+
+// map an exception from a WebUSB transfer to a libusb transfer status
+function _transfer_error_status(error) {
+  if(error instanceof TransferTimeoutError) return LIBUSB_TRANSFER_TIMED_OUT;
+  if(error.name == "NotFoundError") return LIBUSB_TRANSFER_NO_DEVICE;
+  return LIBUSB_TRANSFER_ERROR;
+}
+
+
+// map a WebUSB transfer or packet status to a libusb transfer status
+function _transfer_status(status) {
+  switch(status) {
+    case "ok":     return LIBUSB_TRANSFER_COMPLETED;
+    case "stall":  return LIBUSB_TRANSFER_STALL;
+    case "babble": return LIBUSB_TRANSFER_OVERFLOW;
+    default:       return LIBUSB_TRANSFER_ERROR;
+  }
+}
+
+
+// set the actual length and status of a transfer's iso packet descriptor
+function _set_iso_packet(transfer, index, actual_length, status) {
+  let heap = _heap_i32();
+  let packet = _iso_packet(transfer, index);
+  heap[(packet + transfer_layout.iso_actual_length) >> 2] = actual_length;
+  heap[(packet + transfer_layout.iso_status) >> 2] = status;
+}
+
+
+// fail all packets of an isochronous transfer and post its completion
+function _fail_iso_transfer(r, status) {
+  if(r.completed) return;
+  for(let x = 0; x < r.packet_lengths.length; x++) {
+    _set_iso_packet(r.transfer, x, 0, LIBUSB_TRANSFER_ERROR);
+  }
+  _post_completion(r, status, 0);
+}
+
+
+// submit an asynchronous isochronous input transfer
+// - all packets of the transfer are requested with a single WebUSB call; as in
+//   libusb, packet x is written at the sum of the requested lengths of packets 0..x-1
+async function _submit_iso_in_transfer(r) {
+
+  let device = webusb_devices[r.device_id];
+  if(device === undefined) {
+    console.warn(`_submit_iso_in_transfer called for unknown device ${r.device_id}`);
+    _fail_iso_transfer(r, LIBUSB_TRANSFER_NO_DEVICE);
+    return false;
+  }
+
+  // perform the transfer
+  let ep = r.endpoint & 0x7f;
+  let result;
+  let start = _stats_now();
+  try {
+    result = await device.isochronousTransferIn(ep, r.packet_lengths);
+    r.webusb_ms = _stats_now() - start;
+  } catch (error) {
+    if(_requeue_aborted_transfer(r)) return false;
+    if(!r.completed) console.warn("transfer error in _submit_iso_in_transfer");
+    _fail_iso_transfer(r, _transfer_error_status(error));
+    return false;
+  }
+
+  // a cancelled transfer's buffer may already have been freed
+  if(r.completed) {
+    _add_stat(r, STAT_DROPPED, 1);
+    return false;
+  }
+
+  // write each packet to the heap buffer and fill in its descriptor
+  start = _stats_now();
+  let offset = 0;
+  let actual_length = 0;
+  for(let x = 0; x < r.packet_lengths.length; x++) {
+    let packet = result.packets[x];
+    let length = _write_data_to_heap(packet.data, r.buffer + offset);
+    _set_iso_packet(r.transfer, x, length, _transfer_status(packet.status));
+    offset += r.packet_lengths[x];
+    actual_length += length;
+  }
+  r.copy_ms = _stats_now() - start;
+  _post_completion(r, LIBUSB_TRANSFER_COMPLETED, actual_length);
+
+  return LIBUSB_SUCCESS;
+}
+
+
+// submit an asynchronous isochronous output transfer
+async function _submit_iso_out_transfer(r) {
+
+  let device = webusb_devices[r.device_id];
+  if(device === undefined) {
+    console.warn(`_submit_iso_out_transfer called for unknown device ${r.device_id}`);
+    _fail_iso_transfer(r, LIBUSB_TRANSFER_NO_DEVICE);
+    return false;
+  }
+
+  // perform the transfer
+  let ep = r.endpoint & 0x7f;
+  let result;
+  let start = _stats_now();
+  let data = _get_out_data(r.buffer, r.packet_lengths.reduce((a, b) => a + b, 0));
+  r.copy_ms = _stats_now() - start;
+  try {
+    result = await device.isochronousTransferOut(ep, data, r.packet_lengths);
+    r.webusb_ms = _stats_now() - start - r.copy_ms;
+  } catch (error) {
+    if(_requeue_aborted_transfer(r)) return false;
+    if(!r.completed) console.warn("transfer error in _submit_iso_out_transfer");
+    _fail_iso_transfer(r, _transfer_error_status(error));
+    return false;
+  } finally {
+    _release_out_data(data);
+  }
+
+  // a cancelled transfer may already have been freed
+  if(r.completed) {
+    _add_stat(r, STAT_DROPPED, 1);
+    return false;
+  }
+
+  // fill in the packet descriptors and post the completion
+  let actual_length = 0;
+  for(let x = 0; x < r.packet_lengths.length; x++) {
+    let packet = result.packets[x];
+    _set_iso_packet(r.transfer, x, packet.bytesWritten, _transfer_status(packet.status));
+    actual_length += packet.bytesWritten;
+  }
+  _post_completion(r, LIBUSB_TRANSFER_COMPLETED, actual_length);
+
+  return LIBUSB_SUCCESS;
+}
+
+
+// current time in milliseconds, on the same clock as emscripten_get_now() in pthread builds
+function _stats_now() {
+  return performance.timeOrigin + performance.now();
+}
+
+
+// get the statistics values of a transfer's endpoint, or undefined if it has no slot
+function _stat_values(r) {
+  if(transfer_stats === undefined || r.stats_slot < 0) return undefined;
+  let base = (transfer_stats.ptr + r.stats_slot * transfer_stats.size) >> 3;
+  return _heap_f64().subarray(base, base + STAT_CONVERT_MS + 1);
+}
+
+
+// update a single statistic of a transfer's endpoint
+function _set_stat(r, stat, value) {
+  let values = _stat_values(r);
+  if(values !== undefined) values[stat] = value;
+}
+
+function _add_stat(r, stat, value) {
+  let values = _stat_values(r);
+  if(values !== undefined) values[stat] += value;
+}
+
+function _max_stat(r, stat, value) {
+  let values = _stat_values(r);
+  if(values !== undefined && value > values[stat]) values[stat] = value;
+}
+
+
+// record a transfer completion in its endpoint's statistics
+function _record_completion(r, status, actual_length) {
+  let values = _stat_values(r);
+  if(values === undefined) return;
+
+  let now = _stats_now();
+  values[STAT_COMPLETED]++;
+  if(status == LIBUSB_TRANSFER_CANCELLED) values[STAT_CANCELLED]++;
+  else if(status != LIBUSB_TRANSFER_COMPLETED) values[STAT_ERRORS]++;
+  values[STAT_BYTES] += actual_length;
+  if(values[STAT_FIRST_COMPLETION] == 0) values[STAT_FIRST_COMPLETION] = now;
+  values[STAT_LAST_COMPLETION] = now;
+  values[STAT_WEBUSB_MS] += r.webusb_ms;
+  values[STAT_COPY_MS] += r.copy_ms;
+
+  // add the submission to completion latency to the histogram
+  let histogram = (transfer_stats.ptr + r.stats_slot * transfer_stats.size + transfer_stats.histogram_offset) >> 2;
+  _heap_i32()[histogram + _latency_bucket((now - r.submit_time) * 1000)]++;
+}
+
+
+// get the histogram bucket of a latency in microseconds
+// - values below sub_buckets have a bucket each; above that, each power of two
+//   is split into sub_buckets linear buckets
+function _latency_bucket(us) {
+  let sub_buckets = transfer_stats.sub_buckets;
+  let value = Math.max(0, Math.floor(us));
+  if(value < sub_buckets) return value;
+  let magnitude = 31 - Math.clz32(value);
+  let sub_bits = 31 - Math.clz32(sub_buckets);
+  let bucket = (magnitude - sub_bits + 1) * sub_buckets + ((value >>> (magnitude - sub_bits)) & (sub_buckets - 1));
+  return Math.min(bucket, transfer_stats.buckets - 1);
+}
+
+
+// get the lowest latency in microseconds counted by a histogram bucket
+function _latency_bucket_floor(bucket) {
+  let sub_buckets = transfer_stats.sub_buckets;
+  if(bucket < sub_buckets) return bucket;
+  let sub_bits = 31 - Math.clz32(sub_buckets);
+  let magnitude = Math.floor(bucket / sub_buckets) + sub_bits - 1;
+  return ((sub_buckets + bucket % sub_buckets) * 2 ** (magnitude - sub_bits));
+}
+
+
+// export the endpoint statistics as plain objects (e.g. for JSON.stringify)
+// - reads the shared statistics block directly, so it can run while transfers are in flight
+function _export_transfer_stats() {
+  if(transfer_stats === undefined) return [];
+
+  let heap = _heap_f64();
+  let heap_u32 = new Uint32Array(wasmMemory.buffer);
+  let endpoints = [];
+  for(let slot = 0; slot < transfer_stats.slots; slot++) {
+    let base = transfer_stats.ptr + slot * transfer_stats.size;
+    let v = heap.slice(base >> 3, (base >> 3) + STAT_CONVERT_MS + 1);
+    if(v[STAT_KEY] < 0) continue;
+
+    let histogram = heap_u32.slice((base + transfer_stats.histogram_offset) >> 2,
+                                   ((base + transfer_stats.histogram_offset) >> 2) + transfer_stats.buckets);
+    let completed = Math.max(v[STAT_COMPLETED], 1);
+    let elapsed = (v[STAT_LAST_COMPLETION] - v[STAT_FIRST_COMPLETION]) / 1000;
+
+    endpoints.push({
+      device_id: v[STAT_KEY] >> 8,
+      endpoint: v[STAT_KEY] & 0xff,
+      submitted: v[STAT_SUBMITTED],
+      completed: v[STAT_COMPLETED],
+      errors: v[STAT_ERRORS],
+      cancelled: v[STAT_CANCELLED],
+      dropped: v[STAT_DROPPED],
+      queued: v[STAT_QUEUED],
+      in_flight: v[STAT_IN_FLIGHT],
+      max_in_flight: v[STAT_MAX_IN_FLIGHT],
+      bytes: v[STAT_BYTES],
+      bytes_per_second: elapsed > 0 ? v[STAT_BYTES] / elapsed : 0,
+      mean_dispatch_ms: v[STAT_DISPATCH_MS] / Math.max(v[STAT_SUBMITTED], 1),
+      mean_webusb_ms: v[STAT_WEBUSB_MS] / completed,
+      mean_copy_ms: v[STAT_COPY_MS] / completed,
+      mean_callback_ms: v[STAT_CALLBACK_MS] / completed,
+      mean_convert_ms: v[STAT_CONVERT_MS] / completed,
+      latency_us: {
+        p50: _histogram_percentile(histogram, 0.5),
+        p90: _histogram_percentile(histogram, 0.9),
+        p99: _histogram_percentile(histogram, 0.99),
+        max: _histogram_percentile(histogram, 1),
+      },
+      latency_histogram: Array.from(histogram),
+    });
+  }
+  return endpoints;
+}
+
+
+// get a percentile from a latency histogram, as the floor of the bucket that contains it
+function _histogram_percentile(histogram, percentile) {
+  let total = histogram.reduce((a, b) => a + b, 0);
+  let target = Math.max(1, Math.ceil(total * percentile));
+  let count = 0;
+  for(let bucket = 0; bucket < histogram.length; bucket++) {
+    count += histogram[bucket];
+    if(count >= target) return _latency_bucket_floor(bucket);
+  }
+  return 0;
+}
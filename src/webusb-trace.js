@@ -0,0 +1,443 @@
+// USB transport recording and replay
+// - the shim reaches USB devices through the device-like objects in webusb_devices,
+//   so a transport is a device wrapper: the recorder forwards every call to the real
+//   device and captures it with its timing, and the replayer answers calls from a trace
+// - selected with runtime_config.usb.record / runtime_config.usb.replay (see client/config.js),
+//   and not available in I/O worker mode
+//
+// trace format (little-endian):
+//   header:  "WUSBTRC2"
+//   records: u8 op, u8 endpoint (or interface / configuration number), u8 status, u8 flags,
+//            u32 start (µs since the trace started, modulo 2^32), u32 duration (µs),
+//            u32 requested length, u32 device (trace device index),
+//            [8-byte setup packet for control ops], u32 actual length, [payload, if TRACE_FLAG_PAYLOAD]
+// - every device the shim registers is recorded: a TRACE_OP_DEVICE record, carrying the
+//   device's identity and configurations as JSON, introduces the next device index
+// - control IN payloads are always recorded; bulk payloads only with record_payloads
+// - isochronous transfers are forwarded, but not recorded
+// - single-device "WUSBTRC1" traces (device JSON in the header, no device field) still replay
+
+const TRACE_MAGIC = "WUSBTRC2";
+const TRACE_MAGIC_V1 = "WUSBTRC1";
+
+const TRACE_OP_CONTROL_IN = 1;
+const TRACE_OP_CONTROL_OUT = 2;
+const TRACE_OP_TRANSFER_IN = 3;
+const TRACE_OP_TRANSFER_OUT = 4;
+const TRACE_OP_OPEN = 5;
+const TRACE_OP_CLOSE = 6;
+const TRACE_OP_SELECT_CONFIGURATION = 7;
+const TRACE_OP_CLAIM_INTERFACE = 8;
+const TRACE_OP_RELEASE_INTERFACE = 9;
+const TRACE_OP_CLEAR_HALT = 10;
+const TRACE_OP_RESET = 11;
+const TRACE_OP_DEVICE = 12;
+
+const TRACE_STATUS_OK = 0;
+const TRACE_STATUS_STALL = 1;
+const TRACE_STATUS_BABBLE = 2;
+const TRACE_STATUS_EXCEPTION = 3;
+const TRACE_STATUSES = ["ok", "stall", "babble"];
+
+const TRACE_FLAG_PAYLOAD = 1;
+
+
+// active trace recorder, and the replayed USB backend
+var trace_recorder = undefined;
+var trace_replay = undefined;
+
+
+// get the USB backend: the replayed trace, or navigator.usb
+function _usb() {
+  if(trace_replay !== undefined) return trace_replay;
+  return (typeof navigator !== "undefined") ? navigator.usb : undefined;
+}
+
+
+// wrap a newly registered device with the configured transport
+function _transport_device(device) {
+  if(trace_replay !== undefined || typeof runtime_config === "undefined" || runtime_config.usb.record !== true) {
+    return device;
+  }
+  if(trace_recorder === undefined) {
+    trace_recorder = new TraceRecorder(runtime_config.usb.record_payloads === true);
+  }
+  return _recording_device(device, trace_recorder, trace_recorder.add_device(device));
+}
+
+
+// serialize the parts of a USBDevice the shim reads
+function _trace_device_info(device) {
+  const FIELDS = ["vendorId", "productId", "usbVersionMajor", "usbVersionMinor", "usbVersionSubminor",
+                  "deviceClass", "deviceSubClass", "deviceProtocol", "deviceVersionMajor",
+                  "deviceVersionMinor", "deviceVersionSubminor", "manufacturerName", "productName",
+                  "serialNumber"];
+  let info = {};
+  for(let f of FIELDS) info[f] = device[f];
+  info.configurations = device.configurations.map((c) => ({
+    configurationValue: c.configurationValue,
+    configurationName: c.configurationName,
+    interfaces: c.interfaces.map((i) => ({
+      interfaceNumber: i.interfaceNumber,
+      alternates: i.alternates.map((a) => ({
+        alternateSetting: a.alternateSetting,
+        interfaceClass: a.interfaceClass,
+        interfaceSubclass: a.interfaceSubclass,
+        interfaceProtocol: a.interfaceProtocol,
+        interfaceName: a.interfaceName,
+        endpoints: a.endpoints.map((e) => ({
+          endpointNumber: e.endpointNumber,
+          direction: e.direction,
+          type: e.type,
+          packetSize: e.packetSize,
+        })),
+      })),
+    })),
+  }));
+  return info;
+}
+
+
+// pack a WebUSB control transfer setup into an 8-byte setup packet
+function _trace_setup_packet(setup, direction, length) {
+  const REQUEST_TYPES = { standard: 0, class: 1, vendor: 2 };
+  const RECIPIENTS = { device: 0, interface: 1, endpoint: 2, other: 3 };
+  let packet = new DataView(new ArrayBuffer(8));
+  packet.setUint8(0, (direction == "in" ? 0x80 : 0) | (REQUEST_TYPES[setup.requestType] << 5) | RECIPIENTS[setup.recipient]);
+  packet.setUint8(1, setup.request);
+  packet.setUint16(2, setup.value, true);
+  packet.setUint16(4, setup.index, true);
+  packet.setUint16(6, length, true);
+  return new Uint8Array(packet.buffer);
+}
+
+
+// append-only binary trace, built from fixed-size chunks
+class TraceRecorder {
+
+  constructor(record_payloads) {
+    const CHUNK_SIZE = 1 << 20;
+    this.chunk_size = CHUNK_SIZE;
+    this.chunks = [];
+    this.chunk = new Uint8Array(CHUNK_SIZE);
+    this.offset = 0;
+    this.record_payloads = record_payloads;
+    this.started = performance.now();
+    this.devices = 0;
+    this.write(new TextEncoder().encode(TRACE_MAGIC));
+  }
+
+  // record a device's identity and configurations, returning its trace device index
+  add_device(device) {
+    let index = this.devices++;
+    let info = new TextEncoder().encode(JSON.stringify(_trace_device_info(device)));
+    this.record(TRACE_OP_DEVICE, index, 0, TRACE_STATUS_OK, performance.now(), info.length, undefined, info.length, info);
+    return index;
+  }
+
+  // append bytes to the trace
+  write(bytes) {
+    let offset = 0;
+    while(offset < bytes.length) {
+      if(this.offset == this.chunk.length) {
+        this.chunks.push(this.chunk);
+        this.chunk = new Uint8Array(Math.max(this.chunk_size, bytes.length - offset));
+        this.offset = 0;
+      }
+      let count = Math.min(bytes.length - offset, this.chunk.length - this.offset);
+      this.chunk.set(bytes.subarray(offset, offset + count), this.offset);
+      this.offset += count;
+      offset += count;
+    }
+  }
+
+  // append a record
+  record(op, device, endpoint, status, start, length, setup, actual_length, payload) {
+    let record = new DataView(new ArrayBuffer(20));
+    let flags = (payload !== undefined) ? TRACE_FLAG_PAYLOAD : 0;
+    record.setUint8(0, op);
+    record.setUint8(1, endpoint);
+    record.setUint8(2, status);
+    record.setUint8(3, flags);
+    record.setUint32(4, Math.round((start - this.started) * 1000) >>> 0, true);
+    record.setUint32(8, Math.round((performance.now() - start) * 1000) >>> 0, true);
+    record.setUint32(12, length, true);
+    record.setUint32(16, device, true);
+    this.write(new Uint8Array(record.buffer));
+    if(setup !== undefined) this.write(setup);
+
+    let actual = new DataView(new ArrayBuffer(4));
+    actual.setUint32(0, actual_length, true);
+    this.write(new Uint8Array(actual.buffer));
+    if(payload !== undefined) this.write(payload);
+  }
+
+  // get the trace as a Blob
+  blob() {
+    return new Blob([...this.chunks, this.chunk.subarray(0, this.offset)], { type: "application/octet-stream" });
+  }
+
+  // get the trace as a single byte array
+  bytes() {
+    let parts = [...this.chunks, this.chunk.subarray(0, this.offset)];
+    let bytes = new Uint8Array(parts.reduce((a, p) => a + p.length, 0));
+    let offset = 0;
+    for(let p of parts) {
+      bytes.set(p, offset);
+      offset += p.length;
+    }
+    return bytes;
+  }
+}
+
+
+// wrap a device so every call is forwarded to it and recorded
+function _recording_device(device, recorder, index) {
+
+  // run a call, recording its outcome once it settles
+  let run = async (op, endpoint, length, setup, promise, get_payload) => {
+    let start = performance.now();
+    try {
+      let result = await promise;
+      let status = (result === undefined) ? TRACE_STATUS_OK : TRACE_STATUSES.indexOf(result.status);
+      let actual_length = 0;
+      let payload = undefined;
+      if(result !== undefined && result.data !== undefined) {
+        actual_length = result.data.byteLength;
+        payload = get_payload(result.data);
+      } else if(result !== undefined && result.bytesWritten !== undefined) {
+        actual_length = result.bytesWritten;
+      }
+      recorder.record(op, index, endpoint, status, start, length, setup, actual_length, payload);
+      return result;
+    } catch (error) {
+      recorder.record(op, index, endpoint, TRACE_STATUS_EXCEPTION, start, length, setup, 0, undefined);
+      throw error;
+    }
+  };
+  let bytes = (data) => new Uint8Array(data.buffer, data.byteOffset, data.byteLength).slice();
+  let bulk_payload = (data) => recorder.record_payloads ? bytes(data) : undefined;
+  let none = () => undefined;
+
+  const METHODS = {
+    open: () => run(TRACE_OP_OPEN, 0, 0, undefined, device.open(), none),
+    close: () => run(TRACE_OP_CLOSE, 0, 0, undefined, device.close(), none),
+    selectConfiguration: (value) =>
+      run(TRACE_OP_SELECT_CONFIGURATION, value, 0, undefined, device.selectConfiguration(value), none),
+    claimInterface: (number) =>
+      run(TRACE_OP_CLAIM_INTERFACE, number, 0, undefined, device.claimInterface(number), none),
+    releaseInterface: (number) =>
+      run(TRACE_OP_RELEASE_INTERFACE, number, 0, undefined, device.releaseInterface(number), none),
+    clearHalt: (direction, ep) =>
+      run(TRACE_OP_CLEAR_HALT, ep | (direction == "in" ? 0x80 : 0), 0, undefined, device.clearHalt(direction, ep), none),
+    reset: () => run(TRACE_OP_RESET, 0, 0, undefined, device.reset(), none),
+    controlTransferIn: (setup, length) =>
+      run(TRACE_OP_CONTROL_IN, 0, length, _trace_setup_packet(setup, "in", length),
+          device.controlTransferIn(setup, length), bytes),
+    controlTransferOut: (setup, data) => {
+      let length = (data === undefined) ? 0 : data.byteLength;
+      return run(TRACE_OP_CONTROL_OUT, 0, length, _trace_setup_packet(setup, "out", length),
+                 device.controlTransferOut(setup, data), none);
+    },
+    transferIn: (ep, length) =>
+      run(TRACE_OP_TRANSFER_IN, ep | 0x80, length, undefined, device.transferIn(ep, length), bulk_payload),
+    transferOut: (ep, data) =>
+      run(TRACE_OP_TRANSFER_OUT, ep, data.byteLength, undefined, device.transferOut(ep, data), none),
+  };
+
+  return new Proxy(device, {
+    get(target, prop) {
+      if(prop === "device") return target;
+      if(METHODS[prop] !== undefined) return METHODS[prop];
+      let value = target[prop];
+      return (typeof value === "function") ? value.bind(target) : value;
+    },
+  });
+}
+
+
+// parse a trace, returning each device's info and records
+function _parse_trace(bytes) {
+  let view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  let magic = String.fromCharCode(...bytes.subarray(0, TRACE_MAGIC.length));
+  if(magic != TRACE_MAGIC && magic != TRACE_MAGIC_V1) throw "not a USB trace";
+  let devices = [];
+  let offset = TRACE_MAGIC.length;
+
+  // version 1 traces describe their single device in the header
+  if(magic == TRACE_MAGIC_V1) {
+    let info_length = view.getUint32(offset, true);
+    offset += 4;
+    devices.push({ info: JSON.parse(new TextDecoder().decode(bytes.subarray(offset, offset + info_length))), records: [] });
+    offset += info_length;
+  }
+
+  while(offset < bytes.length) {
+    let r = {
+      op: view.getUint8(offset),
+      endpoint: view.getUint8(offset+1),
+      status: view.getUint8(offset+2),
+      flags: view.getUint8(offset+3),
+      start_us: view.getUint32(offset+4, true),
+      duration_us: view.getUint32(offset+8, true),
+      length: view.getUint32(offset+12, true),
+      device: (magic == TRACE_MAGIC_V1) ? 0 : view.getUint32(offset+16, true),
+    };
+    offset += (magic == TRACE_MAGIC_V1) ? 16 : 20;
+    if(r.op == TRACE_OP_CONTROL_IN || r.op == TRACE_OP_CONTROL_OUT) {
+      r.setup = bytes.subarray(offset, offset + 8);
+      offset += 8;
+    }
+    r.actual_length = view.getUint32(offset, true);
+    offset += 4;
+    if(r.flags & TRACE_FLAG_PAYLOAD) {
+      r.payload = bytes.subarray(offset, offset + r.actual_length);
+      offset += r.actual_length;
+    }
+    if(r.op == TRACE_OP_DEVICE) {
+      devices[r.device] = { info: JSON.parse(new TextDecoder().decode(r.payload)), records: [] };
+    } else if(devices[r.device] !== undefined) {
+      devices[r.device].records.push(r);
+    }
+  }
+  return devices;
+}
+
+
+// install a trace as the USB backend, with every device it recorded
+// - speed "recorded" replays each call with its recorded duration, "max" as fast as possible
+// - requestDevice picks the first device matching any of its filters' VID/PID
+function _set_replay_trace(bytes, speed) {
+  let devices = _parse_trace(bytes).map((trace) => new ReplayedUSBDevice(trace, speed));
+  let matches = (device, filter) => (filter.vendorId === undefined || filter.vendorId == device.vendorId) &&
+                                    (filter.productId === undefined || filter.productId == device.productId);
+  trace_replay = {
+    getDevices: async () => devices.slice(),
+    requestDevice: async (options) => {
+      let filters = (options && options.filters && options.filters.length > 0) ? options.filters : [{}];
+      let device = devices.find((d) => filters.some((f) => matches(d, f)));
+      if(device === undefined) throw new DOMException("no device in the USB trace matches", "NotFoundError");
+      return device;
+    },
+  };
+}
+
+
+// fetch a trace and install it as the USB backend
+async function _load_replay_trace(url, speed) {
+  let res = await fetch(url);
+  if(res.ok !== true) throw `error fetching USB trace '${url}'`;
+  _set_replay_trace(new Uint8Array(await res.arrayBuffer()), speed);
+}
+
+
+// device answering calls from a recorded trace
+// - records are consumed in order per operation and endpoint, so concurrent
+//   transfers on different endpoints replay independently
+// - calls beyond the end of the trace fail with a NetworkError
+class ReplayedUSBDevice {
+
+  constructor(trace, speed) {
+    Object.assign(this, trace.info);
+    this.configuration = null;
+    this.opened = false;
+    this.speed = speed || "recorded";
+    this.diverged = false;
+    this.queues = new Map();
+    for(let r of trace.records) {
+      let key = (r.op << 8) | r.endpoint;
+      if(!this.queues.has(key)) this.queues.set(key, []);
+      this.queues.get(key).push(r);
+    }
+  }
+
+  // take the next record for an operation, and settle the call as recorded
+  async _replay(op, endpoint, setup, make_result) {
+    let queue = this.queues.get((op << 8) | endpoint);
+    let r = (queue !== undefined) ? queue.shift() : undefined;
+    if(r === undefined) throw this._error("NetworkError", "end of USB trace");
+
+    // warn once if the application's requests no longer match the trace
+    if(setup !== undefined && !this.diverged && r.setup.some((b, x) => b != setup[x])) {
+      console.warn("USB replay diverged from the trace (control request mismatch)");
+      this.diverged = true;
+    }
+
+    let delay = (this.speed == "max") ? 0 : r.duration_us / 1000;
+    await new Promise((resolve) => setTimeout(resolve, delay));
+    if(r.status == TRACE_STATUS_EXCEPTION) throw this._error("NetworkError", "recorded transfer error");
+    return make_result(r);
+  }
+
+  _in_result(r) {
+    let data = (r.payload !== undefined) ? r.payload.slice() : new Uint8Array(r.actual_length);
+    return { status: TRACE_STATUSES[r.status], data: new DataView(data.buffer) };
+  }
+
+  _out_result(r) {
+    return { status: TRACE_STATUSES[r.status], bytesWritten: r.actual_length };
+  }
+
+  _error(name, message) {
+    let error = new Error(message);
+    error.name = name;
+    return error;
+  }
+
+  async open() {
+    await this._replay(TRACE_OP_OPEN, 0, undefined, () => undefined);
+    this.opened = true;
+  }
+
+  async close() {
+    await this._replay(TRACE_OP_CLOSE, 0, undefined, () => undefined);
+    this.opened = false;
+  }
+
+  async selectConfiguration(value) {
+    await this._replay(TRACE_OP_SELECT_CONFIGURATION, value, undefined, () => undefined);
+    this.configuration = this.configurations.find((c) => c.configurationValue == value);
+    for(let i of this.configuration.interfaces) i.alternate = i.alternates[0];
+  }
+
+  claimInterface(number) {
+    return this._replay(TRACE_OP_CLAIM_INTERFACE, number, undefined, () => undefined);
+  }
+
+  releaseInterface(number) {
+    return this._replay(TRACE_OP_RELEASE_INTERFACE, number, undefined, () => undefined);
+  }
+
+  clearHalt(direction, ep) {
+    return this._replay(TRACE_OP_CLEAR_HALT, ep | (direction == "in" ? 0x80 : 0), undefined, () => undefined);
+  }
+
+  reset() {
+    return this._replay(TRACE_OP_RESET, 0, undefined, () => undefined);
+  }
+
+  controlTransferIn(setup, length) {
+    return this._replay(TRACE_OP_CONTROL_IN, 0, _trace_setup_packet(setup, "in", length), (r) => this._in_result(r));
+  }
+
+  controlTransferOut(setup, data) {
+    let length = (data === undefined) ? 0 : data.byteLength;
+    return this._replay(TRACE_OP_CONTROL_OUT, 0, _trace_setup_packet(setup, "out", length), (r) => this._out_result(r));
+  }
+
+  transferIn(ep, length) {
+    return this._replay(TRACE_OP_TRANSFER_IN, ep | 0x80, undefined, (r) => this._in_result(r));
+  }
+
+  transferOut(ep, data) {
+    return this._replay(TRACE_OP_TRANSFER_OUT, ep, undefined, (r) => this._out_result(r));
+  }
+
+  async isochronousTransferIn(ep, packet_lengths) {
+    throw this._error("NotSupportedError", "isochronous transfers are not replayed");
+  }
+
+  async isochronousTransferOut(ep, data, packet_lengths) {
+    throw this._error("NotSupportedError", "isochronous transfers are not replayed");
+  }
+}
@@ -1,81 +1,324 @@
 #include <emscripten.h>
+#include <emscripten/threading.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <libusb.h>
 
+#include "webusb.h"
+
+
+#ifndef WEBUSB_BLOCKING_FUTEX
+
+// Asyncify / JSPI builds: the USB entry points run on the calling thread, and
+// suspend the wasm stack while their WebUSB promises settle (see _blocking in webusb.js)
 
 EM_JS(bool, ensure_navigator_usb, (), {
-  return navigator.usb !== undefined;
+  return _usb() !== undefined;
+});
+
+
+EM_JS(int, get_device_descriptor, (int device_id, struct libusb_device_descriptor *desc), {
+  return _get_device_descriptor(device_id, desc);
 });
 
 
-EM_JS(int, get_device_descriptor, (struct libusb_device_descriptor *desc), {
-  return _get_device_descriptor(desc);
+EM_JS(int, open_device, (int device_id), {
+  return _open_device(device_id);
 });
 
 
-EM_JS(void, open_device, (), {
-  return _open_device();
+EM_JS(int, enumerate_devices, (uint16_t vid, uint16_t pid, int *ids, int max_ids), {
+  return _enumerate_devices(vid, pid, ids, max_ids);
 });
 
 
-EM_JS(int, open_device_with_vid_pid, (uint16_t vid, uint16_t pid), {
-  return _open_device_by_vid_pid(vid, pid);
+EM_JS(void, close_device, (int device_id), {
+  return _close_device(device_id);
 });
 
 
-EM_JS(void, close_device, (), {
-  return _close_device();
+EM_JS(int, get_configuration, (int device_id), {
+  return _get_configuration(device_id);
 });
 
 
-EM_JS(int, get_configuration, (), {
-  return _get_configuration();
+EM_JS(int, get_string_descriptor, (int device_id, uint8_t desc_index, uint8_t *data, int length), {
+  return _get_string_descriptor(device_id, desc_index, data, length);
 });
 
 
-EM_JS(int, get_string_descriptor, (uint8_t desc_index, uint8_t *data, int length), {
-  return _get_string_descriptor(desc_index, data, length);
+EM_JS(uint8_t *, get_config_descriptor, (int device_id, int config_index), {
+  return _get_config_descriptor(device_id, config_index);
 });
 
 
-EM_JS(struct libusb_config_descriptor *, get_active_config_descriptor, (), {
-  return _get_active_config_descriptor();
+EM_JS(int, select_configuration, (int device_id, int configuration), {
+  return _select_configuration(device_id, configuration);
 });
 
 
-EM_JS(void, claim_interface, (int interface_number), {
-  return _claim_interface(interface_number);
+EM_JS(void, claim_interface, (int device_id, int interface_number), {
+  return _claim_interface(device_id, interface_number);
 });
 
 
-EM_JS(void, release_interface, (int interface_number), {
-  return _release_interface(interface_number);
+EM_JS(void, release_interface, (int device_id, int interface_number), {
+  return _release_interface(device_id, interface_number);
 });
 
 
-EM_JS(int, control_transfer, (uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+EM_JS(int, control_transfer, (int device_id, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
 	                            uint8_t *data, uint16_t wLength, unsigned int timeout), {
-  return _control_transfer(request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+  return _control_transfer(device_id, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
 });
 
 
-int submit_bulk_in_transfer(uint8_t ep, int length, uint8_t * buffer, struct libusb_transfer *transfer){
-  return MAIN_THREAD_EM_ASM_INT({ return _submit_bulk_in_transfer($0, $1, $2, $3); }, ep, length, buffer, transfer);
-};
+EM_JS(int, control_transfer_batch, (int device_id, struct control_batch_entry *entries, int count, uint8_t *data), {
+  return _control_transfer_batch(device_id, entries, count, data);
+});
+
+
+EM_JS(int, clear_halt, (int device_id, unsigned char endpoint), {
+  return _clear_halt(device_id, endpoint);
+});
+
+
+EM_JS(int, reset_device, (int device_id), {
+  return _reset_device(device_id);
+});
+
+
+EM_JS(void, wait_async, (uint32_t *address, uint32_t value, double timeout_ms), {
+  return _wait_async(address, value, timeout_ms);
+});
+
+
+// wait for a wake on a futex word, or the timeout
+// - main() runs on the browser main thread in these builds, and so does the transfer
+//   engine that posts completions, so the main thread suspends instead of blocking
+void wait_on_address(uint32_t *address, uint32_t value, double timeout_ms) {
+  if(emscripten_is_main_browser_thread()) wait_async(address, value, timeout_ms);
+  else emscripten_futex_wait(address, value, timeout_ms);
+}
+
 
+// whether the USB entry points can reach the WebUSB devices from the calling thread
+// - the device table lives on the main thread, and other threads' JS contexts have
+//   none (e.g. libhackrf's event thread, which resubmits transfers)
+bool can_reach_devices() {
+  return emscripten_is_main_browser_thread();
+}
 
-int submit_bulk_out_transfer(uint8_t ep, int length, uint8_t * buffer, struct libusb_transfer *transfer){
-  return MAIN_THREAD_EM_ASM_INT({ return _submit_bulk_out_transfer($0, $1, $2, $3); }, ep, length, buffer, transfer);
+
+#else
+
+// futex builds (USB_BLOCKING=futex), without Asyncify: the USB entry points run on the
+// main thread, where the WebUSB devices live, while the calling pthread blocks
+
+// a call proxied to the main thread, settled by _complete_blocking_call in webusb.js
+struct blocking_call {
+  int32_t done;
+  int32_t result;
 };
 
+// wait for the main thread to settle a blocking call, returning its result
+static int wait_blocking_call(struct blocking_call *call) {
+  while(__atomic_load_n(&call->done, __ATOMIC_ACQUIRE) == 0) {
+    emscripten_futex_wait(&call->done, 0, INFINITY);
+  }
+  return call->result;
+}
+
+
+bool ensure_navigator_usb() {
+  return MAIN_THREAD_EM_ASM_INT({ return _usb() !== undefined; });
+}
+
+
+int get_device_descriptor(int device_id, struct libusb_device_descriptor *desc) {
+  return MAIN_THREAD_EM_ASM_INT({ return _get_device_descriptor($0, $1); }, device_id, desc);
+}
+
+
+int open_device(int device_id) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _open_device($1)); }, &call, device_id);
+  return wait_blocking_call(&call);
+}
+
+
+int enumerate_devices(uint16_t vid, uint16_t pid, int *ids, int max_ids) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _enumerate_devices($1, $2, $3, $4)); },
+                     &call, vid, pid, ids, max_ids);
+  return wait_blocking_call(&call);
+}
+
+
+void close_device(int device_id) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _close_device($1)); }, &call, device_id);
+  wait_blocking_call(&call);
+}
+
+
+int get_configuration(int device_id) {
+  return MAIN_THREAD_EM_ASM_INT({ return _get_configuration($0); }, device_id);
+}
+
+
+int get_string_descriptor(int device_id, uint8_t desc_index, uint8_t *data, int length) {
+  return MAIN_THREAD_EM_ASM_INT({ return _get_string_descriptor($0, $1, $2, $3); },
+                                device_id, desc_index, data, length);
+}
+
+
+uint8_t * get_config_descriptor(int device_id, int config_index) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _get_config_descriptor($1, $2)); },
+                     &call, device_id, config_index);
+  return (uint8_t *)(uintptr_t)wait_blocking_call(&call);
+}
+
+
+int select_configuration(int device_id, int configuration) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _select_configuration($1, $2)); },
+                     &call, device_id, configuration);
+  return wait_blocking_call(&call);
+}
+
+
+void claim_interface(int device_id, int interface_number) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _claim_interface($1, $2)); },
+                     &call, device_id, interface_number);
+  wait_blocking_call(&call);
+}
+
+
+void release_interface(int device_id, int interface_number) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _release_interface($1, $2)); },
+                     &call, device_id, interface_number);
+  wait_blocking_call(&call);
+}
+
+
+int control_transfer(int device_id, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                     uint8_t *data, uint16_t wLength, unsigned int timeout) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _control_transfer($1, $2, $3, $4, $5, $6, $7, $8)); },
+                     &call, device_id, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+  return wait_blocking_call(&call);
+}
+
+
+int control_transfer_batch(int device_id, struct control_batch_entry *entries, int count, uint8_t *data) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _control_transfer_batch($1, $2, $3, $4)); },
+                     &call, device_id, entries, count, data);
+  return wait_blocking_call(&call);
+}
+
+
+int clear_halt(int device_id, unsigned char endpoint) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _clear_halt($1, $2)); }, &call, device_id, endpoint);
+  return wait_blocking_call(&call);
+}
+
+
+int reset_device(int device_id) {
+  struct blocking_call call = { 0, 0 };
+  MAIN_THREAD_EM_ASM({ _complete_blocking_call($0, _reset_device($1)); }, &call, device_id);
+  return wait_blocking_call(&call);
+}
+
+
+// wait for a wake on a futex word, or the timeout
+// - main() runs on a pthread in these builds, which may block
+void wait_on_address(uint32_t *address, uint32_t value, double timeout_ms) {
+  emscripten_futex_wait(address, value, timeout_ms);
+}
+
+
+// whether the USB entry points can reach the WebUSB devices from the calling thread
+// - they're all proxied to the main thread in these builds
+bool can_reach_devices() {
+  return true;
+}
+
+#endif
+
+
+// share the libusb_transfer field offsets, the transfer rings and the statistics block
+// with the main thread, and start the JS transfer engine and device monitor
+// - the *_offset arguments locate shim fields relative to each libusb_transfer
+void init_webusb(struct transfer_ring *submitted, struct transfer_ring *completed, struct endpoint_stats *stats,
+                 struct hotplug_ring *hotplug, int device_id_offset, int stats_slot_offset, int submit_time_offset) {
+  MAIN_THREAD_EM_ASM({ _set_transfer_layout($0, $1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15); },
+                     device_id_offset,
+                     stats_slot_offset,
+                     submit_time_offset,
+                     offsetof(struct libusb_transfer, endpoint),
+                     offsetof(struct libusb_transfer, type),
+                     offsetof(struct libusb_transfer, status),
+                     offsetof(struct libusb_transfer, length),
+                     offsetof(struct libusb_transfer, actual_length),
+                     offsetof(struct libusb_transfer, buffer),
+                     offsetof(struct libusb_transfer, timeout),
+                     offsetof(struct libusb_transfer, num_iso_packets),
+                     offsetof(struct libusb_transfer, iso_packet_desc),
+                     sizeof(struct libusb_iso_packet_descriptor),
+                     offsetof(struct libusb_iso_packet_descriptor, length),
+                     offsetof(struct libusb_iso_packet_descriptor, actual_length),
+                     offsetof(struct libusb_iso_packet_descriptor, status));
+  MAIN_THREAD_EM_ASM({ _set_transfer_stats($0, $1, $2, $3, $4, $5); },
+                     stats,
+                     STATS_MAX_ENDPOINTS,
+                     sizeof(struct endpoint_stats),
+                     offsetof(struct endpoint_stats, latency_histogram),
+                     STATS_HISTOGRAM_BUCKETS,
+                     STATS_HISTOGRAM_SUB_BUCKETS);
+  MAIN_THREAD_EM_ASM({ _start_transfer_engine($0, $1, $2, $3, $4, $5); },
+                     submitted,
+                     completed,
+                     offsetof(struct transfer_ring, head),
+                     offsetof(struct transfer_ring, tail),
+                     offsetof(struct transfer_ring, entries),
+                     TRANSFER_RING_SIZE);
+  MAIN_THREAD_EM_ASM({ _start_device_monitor($0, $1, $2, $3, $4, $5, $6, $7); },
+                     hotplug,
+                     offsetof(struct hotplug_ring, head),
+                     offsetof(struct hotplug_ring, tail),
+                     offsetof(struct hotplug_ring, generation),
+                     offsetof(struct hotplug_ring, entries),
+                     HOTPLUG_RING_SIZE,
+                     HOTPLUG_EVENT_LEFT,
+                     &completed->tail);
+}
+
+
+// get the configured IQ sample conversion from the main thread
+void get_iq_conversion(int *format, bool *dc_removal, int *decimation) {
+  *format = MAIN_THREAD_EM_ASM_INT({ return _get_iq_format(); });
+  *dc_removal = MAIN_THREAD_EM_ASM_INT({ return _get_iq_dc_removal(); });
+  *decimation = MAIN_THREAD_EM_ASM_INT({ return _get_iq_decimation(); });
+}
+
 
-int request_device_access() {
+// get the configured VID/PID from the main thread
+void get_device_filter(uint16_t *vid, uint16_t *pid) {
+  *vid = MAIN_THREAD_EM_ASM_INT({ return _get_vid(); });
+  *pid = MAIN_THREAD_EM_ASM_INT({ return _get_pid(); });
+}
 
-  // get the configured VID/PID from the main thread
-  uint16_t vid = MAIN_THREAD_EM_ASM_INT({ return _get_vid(); });
-  uint16_t pid = MAIN_THREAD_EM_ASM_INT({ return _get_pid(); });
 
-  // request the USB device from the current thread
-  return open_device_with_vid_pid(vid, pid);
+// get whether control OUT transfers are batched, from the main thread
+bool get_batch_control() {
+  return MAIN_THREAD_EM_ASM_INT({ return _get_batch_control(); });
 }
\ No newline at end of file
@@ -1,18 +1,96 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// single-producer/single-consumer ring of transfer pointers in the wasm heap
+// - submissions: produced by libusb_submit_transfer, consumed by the JS transfer dispatcher
+// - completions: produced by the JS transfer handlers, consumed by the libusb event loop
+// - size must be a power of two
+#define TRANSFER_RING_SIZE 1024
+#define TRANSFER_RING_CANCEL 1 // tag bit on submission entries that cancel a pending transfer
+struct transfer_ring {
+  uint32_t head;
+  uint32_t tail;
+  struct libusb_transfer * entries[TRANSFER_RING_SIZE];
+};
+
+// single-producer/single-consumer ring of device connection events in the wasm heap
+// - produced by the navigator.usb connect/disconnect handlers, consumed by the libusb event loop
+// - entries are device ids, with HOTPLUG_EVENT_LEFT set for disconnections
+// - generation counts every event (including any dropped on overflow), and invalidates
+//   the enumeration cache
+// - size must be a power of two
+#define HOTPLUG_RING_SIZE 64
+#define HOTPLUG_EVENT_LEFT (1 << 16)
+struct hotplug_ring {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t generation;
+  int32_t entries[HOTPLUG_RING_SIZE];
+};
+
+// a control OUT transfer in a batch (see flush_control_batch in libusb.c)
+// - the 16-byte layout is read directly by _control_transfer_batch in webusb.js
+struct control_batch_entry {
+  uint8_t request_type;
+  uint8_t request;
+  uint16_t value;
+  uint16_t index;
+  uint16_t length;
+  uint32_t timeout;
+  int32_t result;   // bytes written or a libusb error, written by the JS side
+};
+
+// per-endpoint transfer statistics in the wasm heap, readable from JS while transfers run
+// - the key, submission and callback statistics are written by libusb, the rest by the JS transfer engine
+// - the latency histogram is log-linear (HDR-style): STATS_HISTOGRAM_SUB_BUCKETS buckets per power of two
+#define STATS_MAX_ENDPOINTS 32
+#define STATS_HISTOGRAM_SUB_BUCKETS 4
+#define STATS_HISTOGRAM_BUCKETS 96
+enum endpoint_stat {
+  STAT_KEY,              // (device id << 8) | endpoint address, or -1 for unused slots
+  STAT_SUBMITTED,        // transfers submitted
+  STAT_CALLBACK_MS,      // total time spent in completion callbacks
+  STAT_COMPLETED,        // transfers completed (including errors and cancellations)
+  STAT_ERRORS,           // transfers completed with an error status
+  STAT_CANCELLED,        // transfers cancelled
+  STAT_DROPPED,          // WebUSB results dropped after a cancellation or timeout
+  STAT_QUEUED,           // transfers waiting for an in-flight slot
+  STAT_IN_FLIGHT,        // WebUSB transfers in flight
+  STAT_MAX_IN_FLIGHT,    // peak WebUSB transfers in flight
+  STAT_BYTES,            // bytes transferred
+  STAT_FIRST_COMPLETION, // time of the first completion (ms)
+  STAT_LAST_COMPLETION,  // time of the last completion (ms)
+  STAT_DISPATCH_MS,      // total submission to dispatch time (the cross-thread hop)
+  STAT_WEBUSB_MS,        // total time waiting on WebUSB transfers
+  STAT_COPY_MS,          // total time copying data between the heap and WebUSB
+  STAT_CONVERT_MS,       // total time converting IQ samples (see iq-convert.h)
+  STAT_COUNT
+};
+struct endpoint_stats {
+  double values[STAT_COUNT];
+  uint32_t latency_histogram[STATS_HISTOGRAM_BUCKETS]; // submission to completion, in microseconds
+};
+
 bool ensure_navigator_usb();
-int request_device_access();
-int get_device_descriptor(struct libusb_device_descriptor *desc);
-void open_device();
-void close_device();
-int get_string_descriptor(uint8_t desc_index, uint8_t *data, int length);
-int get_configuration();
-struct libusb_config_descriptor * get_active_config_descriptor();
-void claim_interface(int interface_number);
-void release_interface(int interface_number);
-int control_transfer(uint8_t request_type, uint8_t bRequest, uint16_t wValue, 
+void init_webusb(struct transfer_ring *submitted, struct transfer_ring *completed, struct endpoint_stats *stats,
+                 struct hotplug_ring *hotplug, int device_id_offset, int stats_slot_offset, int submit_time_offset);
+void get_iq_conversion(int *format, bool *dc_removal, int *decimation);
+void get_device_filter(uint16_t *vid, uint16_t *pid);
+bool get_batch_control();
+int enumerate_devices(uint16_t vid, uint16_t pid, int *ids, int max_ids);
+int get_device_descriptor(int device_id, struct libusb_device_descriptor *desc);
+int open_device(int device_id);
+void close_device(int device_id);
+int get_string_descriptor(int device_id, uint8_t desc_index, uint8_t *data, int length);
+int get_configuration(int device_id);
+uint8_t * get_config_descriptor(int device_id, int config_index);
+int select_configuration(int device_id, int configuration);
+void claim_interface(int device_id, int interface_number);
+void release_interface(int device_id, int interface_number);
+int control_transfer(int device_id, uint8_t request_type, uint8_t bRequest, uint16_t wValue, 
                      uint16_t wIndex, uint8_t *data, uint16_t wLength, unsigned int timeout);
-int open_device_with_vid_pid(uint16_t vid, uint16_t pid);
-int submit_bulk_in_transfer(uint8_t ep, int length, uint8_t * buffer, struct libusb_transfer *transfer);
-int submit_bulk_out_transfer(uint8_t ep, int length, uint8_t * buffer, struct libusb_transfer *transfer);
+int control_transfer_batch(int device_id, struct control_batch_entry *entries, int count, uint8_t *data);
+int clear_halt(int device_id, unsigned char endpoint);
+int reset_device(int device_id);
+void wait_on_address(uint32_t *address, uint32_t value, double timeout_ms);
+bool can_reach_devices();
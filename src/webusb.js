@@ -6,13 +6,215 @@ const DESCRIPTOR_INDEX_CONFIG = 4;
 const DESCRIPTOR_INDEX_INTERFACE = 5;
 
 
-// active USB device
-var active_device = undefined;
+// table of WebUSB devices, indexed by the libusb device id
+// - in I/O worker mode, entries are proxies for the worker's devices (see _io_worker_device)
+var webusb_devices = [];
 
 
-// set the active USB device
-function _set_active_device(device) {
-  active_device = device;
+// device connection event ring (see struct hotplug_ring in webusb.h)
+var hotplug_ring = undefined;
+
+// number of getDevices() scans, for the enumeration benchmarks
+var device_scans = 0;
+
+
+// dedicated I/O worker (see webusb-io-worker.js)
+const IO_WORKER_URL = "webusb-io-worker.js";
+var io_worker = undefined;
+var io_worker_calls = new Map();
+var io_worker_next_call = 0;
+
+
+// add a WebUSB device to the device table, returning its device id
+function _register_device(device) {
+  let id = webusb_devices.findIndex((d) => d === device || d.device === device);
+  if(id < 0) {
+    id = webusb_devices.length;
+    webusb_devices.push(_io_worker_enabled() ? _io_worker_device(device, id) : _transport_device(device));
+  }
+  return id;
+}
+
+
+// start the transfer engine, on the main thread or in the dedicated I/O worker
+function _start_transfer_engine(submitted, completed, head_offset, tail_offset, entries_offset, size) {
+  _set_transfer_rings(submitted, completed, head_offset, tail_offset, entries_offset, size);
+  if(_io_worker_enabled()) {
+    _io_worker_call("start", {
+      memory: wasmMemory,
+      layout: transfer_layout,
+      rings: [submitted, completed, head_offset, tail_offset, entries_offset, size],
+      queue_depth: _get_queue_depth(),
+      coalesce: _get_coalesce(),
+      stats: transfer_stats,
+    });
+  } else {
+    _run_transfer_dispatcher();
+  }
+}
+
+
+// forward navigator.usb connect/disconnect events to the libusb event loop
+// - connected devices are added to the device table, so libusb can report them
+// - wake is the address the event loop waits on (the completion ring tail)
+function _start_device_monitor(ring, head_offset, tail_offset, generation_offset, entries_offset, size, left_flag, wake) {
+  hotplug_ring = {
+    head: ring + head_offset,
+    tail: ring + tail_offset,
+    generation: ring + generation_offset,
+    entries: ring + entries_offset,
+    size: size,
+    left_flag: left_flag,
+    wake: wake,
+  };
+
+  let usb = _usb();
+  if(usb === undefined || usb.addEventListener === undefined) return;
+  usb.addEventListener("connect", (event) => {
+    _post_hotplug_event(_register_device(event.device), false);
+  });
+  usb.addEventListener("disconnect", (event) => {
+    let id = webusb_devices.findIndex((d) => d === event.device || d.device === event.device);
+    if(id >= 0) _post_hotplug_event(id, true);
+  });
+}
+
+
+// publish a device connection event, and wake the event loop
+// - the generation always advances, so the enumeration cache is invalidated
+//   even if the ring is full and the event is dropped
+function _post_hotplug_event(device_id, left) {
+  let heap = _heap_i32();
+  let r = hotplug_ring;
+  Atomics.add(heap, r.generation >> 2, 1);
+
+  let head = Atomics.load(heap, r.head >> 2);
+  let tail = Atomics.load(heap, r.tail >> 2);
+  if(((tail - head) >>> 0) < r.size) {
+    heap[(r.entries >> 2) + (tail & (r.size - 1))] = device_id | (left ? r.left_flag : 0);
+    Atomics.store(heap, r.tail >> 2, (tail + 1) | 0);
+  } else {
+    console.warn(`dropped USB ${left ? "disconnect" : "connect"} event for device ${device_id}`);
+  }
+  Atomics.notify(heap, r.wake >> 2);
+}
+
+
+// I/O worker mode moves all WebUSB I/O off the main thread
+// - the main thread only handles device permission (requestDevice)
+// - not used when recording or replaying a USB trace (see webusb-trace.js)
+function _io_worker_enabled() {
+  if(typeof runtime_config === "undefined" || runtime_config.usb.io_worker !== true) return false;
+  if(runtime_config.usb.record === true || trace_replay !== undefined) {
+    console.warn("USB trace record/replay is not supported in I/O worker mode, using the main thread");
+    runtime_config.usb.io_worker = false;
+    return false;
+  }
+  return true;
+}
+
+
+// send a command to the I/O worker, returning a promise for its result
+function _io_worker_call(cmd, args) {
+  if(io_worker === undefined) {
+    io_worker = new Worker(IO_WORKER_URL);
+    io_worker.onmessage = (event) => {
+      let call = io_worker_calls.get(event.data.id);
+      io_worker_calls.delete(event.data.id);
+      if(event.data.error !== undefined) call.reject(event.data.error);
+      else call.resolve(event.data.result);
+    };
+  }
+  return new Promise((resolve, reject) => {
+    let id = io_worker_next_call++;
+    io_worker_calls.set(id, { resolve: resolve, reject: reject });
+    io_worker.postMessage(Object.assign({ id: id, cmd: cmd }, args));
+  });
+}
+
+
+// proxy a WebUSB device that is owned by the I/O worker
+// - the worker re-acquires the device with getDevices(), and handles every
+//   operation that touches the device; descriptor attributes are read locally
+// - the local device is never opened, so opened tracks the worker's open and close
+function _io_worker_device(device, device_id) {
+  const FORWARDED_METHODS = ["open", "close", "selectConfiguration", "claimInterface", "releaseInterface",
+                             "controlTransferIn", "controlTransferOut", "transferIn", "transferOut",
+                             "clearHalt", "reset"];
+  _io_worker_call("add_device", {
+    device_id: device_id,
+    vendor_id: device.vendorId,
+    product_id: device.productId,
+    serial_number: device.serialNumber,
+  });
+  let opened = false;
+  return new Proxy(device, {
+    get(target, prop) {
+      if(prop === "device") return target;
+      if(prop === "opened") return opened;
+      if(prop === "open" || prop === "close") {
+        return async () => {
+          await _io_worker_call("device", { device_id: device_id, method: prop, args: [] });
+          opened = (prop === "open");
+        };
+      }
+      if(FORWARDED_METHODS.includes(prop)) {
+        return (...args) => _io_worker_call("device", { device_id: device_id, method: prop, args: args });
+      }
+      if(prop === "controlTransferOutBatch") {
+        return (transfers) => _io_worker_call("control_batch", { device_id: device_id, transfers: transfers });
+      }
+      if(prop === "resetAfterTimeout") {
+        return () => _io_worker_call("reset_after_timeout", { device_id: device_id });
+      }
+      return target[prop];
+    },
+  });
+}
+
+
+// run the async part of a blocking libusb entry point
+// - Asyncify and JSPI builds suspend the wasm stack until the operation settles
+// - builds without Asyncify (USB_BLOCKING=futex) return the promise, which webusb.c
+//   passes to _complete_blocking_call while the calling pthread waits
+function _blocking(operation) {
+  if(typeof Asyncify === "undefined") return operation();
+  return Asyncify.handleAsync(operation);
+}
+
+
+// wait on the main thread for a futex word to be woken (see wait_on_address in webusb.c)
+// - suspends instead of blocking, so the transfer engine and WebUSB promises (which
+//   also run on this thread) can post the completion being waited for
+// - falls back to polling once per task without Atomics.waitAsync
+function _wait_async(address, value, timeout_ms) {
+  return _blocking(async () => {
+    let heap = _heap_i32();
+    if(Atomics.waitAsync !== undefined) {
+      let wait = Atomics.waitAsync(heap, address >> 2, value | 0, timeout_ms);
+      if(wait.async) await wait.value;
+      return;
+    }
+    let deadline = performance.now() + timeout_ms;
+    while(Atomics.load(heap, address >> 2) == (value | 0) && performance.now() < deadline) {
+      await new Promise((resolve) => setTimeout(resolve, 0));
+    }
+  });
+}
+
+
+// settle a blocking call made from a pthread (see struct blocking_call in webusb.c)
+// - writes the result, then wakes the waiting thread through the call's done flag
+function _complete_blocking_call(call, result) {
+  Promise.resolve(result).catch((error) => {
+    console.error(`USB call failed: ${error}`);
+    return LIBUSB_ERROR_IO;
+  }).then((value) => {
+    let heap = _heap_i32();
+    heap[(call >> 2) + 1] = value;
+    Atomics.store(heap, call >> 2, 1);
+    Atomics.notify(heap, call >> 2);
+  });
 }
 
 
@@ -20,74 +222,137 @@ function _set_active_device(device) {
 // - to be run on the main thread context
 function _get_vid() { return runtime_config.usb.vid; }
 function _get_pid() { return runtime_config.usb.pid; }
+function _get_batch_control() { return runtime_config.usb.batch_control === true; }
 
 
-// open the active device
-function _open_device() {
-  return Asyncify.handleAsync(async () => {
-    await active_device.open();
+// helper functions to retrieve the IQ sample conversion settings (see iq-convert.h)
+// - to be run on the main thread context
+const IQ_FORMATS = ["none", "s16", "f32"];
+function _get_iq_conversion() { return runtime_config.usb.iq_conversion || {}; }
+function _get_iq_format() { return Math.max(IQ_FORMATS.indexOf(_get_iq_conversion().format), 0); }
+function _get_iq_dc_removal() { return _get_iq_conversion().dc_removal === true; }
+function _get_iq_decimation() { return _get_iq_conversion().decimation || 1; }
+
+
+// open a device
+function _open_device(device_id) {
+  return _blocking(async () => {
+    try {
+      await webusb_devices[device_id].open();
+    } catch (error) {
+      console.error(`Failed to open USB device ${device_id}: ${error}`);
+      return -1;
+    }
+    return 0;
   });
 }
 
 
-// open a device by vid/pid
-function _open_device_by_vid_pid(vid, pid) {
-  return Asyncify.handleAsync(async () => {
-    if(await _request_usb_device_async(vid, pid) == 0) {
-      return -1;
+// find the authorized devices matching a vid/pid, and write their device ids to the heap
+function _enumerate_devices(vid, pid, ids, max_ids) {
+  return _blocking(async () => {
+    let device_ids = await _request_usb_device_async(vid, pid);
+    let count = Math.min(device_ids.length, max_ids);
+    let heap = _heap_i32();
+    for(let x = 0; x < count; x++) {
+      heap[(ids >> 2) + x] = device_ids[x];
     }
-    await active_device.open();
-    return 1;
+    return count;
   });
 }
 
 
-// close the active device
-function _close_device() {
-  return Asyncify.handleAsync(async () => {
-    return await active_device.close();
+// close a device
+function _close_device(device_id) {
+  return _blocking(async () => {
+    return await webusb_devices[device_id].close();
   });
 }
 
 
 // claim an interface
-function _claim_interface(interface_number) {
-  return Asyncify.handleAsync(async () => {
-    return await active_device.claimInterface(interface_number);
+function _claim_interface(device_id, interface_number) {
+  return _blocking(async () => {
+    return await webusb_devices[device_id].claimInterface(interface_number);
   });
 }
 
 
 // release an interface
-function _release_interface(interface_number) {
-  return Asyncify.handleAsync(async () => {
-    return await active_device.releaseInterface(interface_number);
+function _release_interface(device_id, interface_number) {
+  return _blocking(async () => {
+    return await webusb_devices[device_id].releaseInterface(interface_number);
   });
 }
 
 
-// get the current configuration value
-function _get_configuration() {
-  return active_device.configuration.configurationValue;
+// clear an endpoint's halt (aborting its outstanding transfers), returning a libusb error code
+function _clear_halt(device_id, endpoint) {
+  return _blocking(async () => {
+    try {
+      await webusb_devices[device_id].clearHalt((endpoint & 0x80) ? "in" : "out", endpoint & 0x7f);
+    } catch (error) {
+      console.error(`Failed to clear the halt on endpoint ${endpoint}: ${error}`);
+      return (error.name == "NotFoundError") ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+    }
+    return 0;
+  });
+}
+
+
+// reset a device (aborting its outstanding transfers), returning a libusb error code
+function _reset_device(device_id) {
+  return _blocking(async () => {
+    try {
+      await webusb_devices[device_id].reset();
+    } catch (error) {
+      console.error(`Failed to reset USB device ${device_id}: ${error}`);
+      return (error.name == "NotFoundError") ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+    }
+    return 0;
+  });
+}
+
+
+// get the current configuration value, or 0 if the device is unconfigured (as libusb reports it)
+function _get_configuration(device_id) {
+  let configuration = webusb_devices[device_id].configuration;
+  if(configuration === null || configuration === undefined) return 0;
+  return configuration.configurationValue;
+}
+
+
+// select a configuration
+function _select_configuration(device_id, configuration) {
+  return _blocking(async () => {
+    try {
+      await webusb_devices[device_id].selectConfiguration(configuration);
+    } catch (error) {
+      console.error(`Failed to select configuration ${configuration}: ${error}`);
+      return -1;
+    }
+    return 0;
+  });
 }
 
 
 // find and authorize a USB device
 function _request_usb_device() {
-  return Asyncify.handleAsync(async () => {
-    return await _request_usb_device_async(runtime_config.usb.vid, runtime_config.usb.pid);
+  return _blocking(async () => {
+    let device_ids = await _request_usb_device_async(runtime_config.usb.vid, runtime_config.usb.pid);
+    return device_ids.length;
   });
 }
 
 
-// find and authorize a USB device - async
+// find and authorize the USB devices matching a vid/pid, returning their device ids - async
 async function  _request_usb_device_async(vendor_id, product_id) {
   if(vendor_id === undefined) vendor_id = runtime_config.usb.vid;
-  if(product_id === undefined) vendor_id = runtime_config.usb.pid;
+  if(product_id === undefined) product_id = runtime_config.usb.pid;
 
   // get the list of authorized devices
-  let devices = await navigator.usb.getDevices();
-  console.log(devices);
+  let devices = await _usb().getDevices();
+  device_scans++;
 
   // filter for the specified VID/PID
   let filtered = devices.filter(function(d) {
@@ -95,38 +360,36 @@ async function  _request_usb_device_async(vendor_id, product_id) {
   });
 
   // if we found one or more matching devices, 
-  // set the first one as the active device
+  // add them all to the device table
   if(filtered.length > 0) {
-    _set_active_device(filtered[0]);
-    console.debug(`The requested USB device ${vendor_id.toString(16)}:${product_id.toString(16)} was found.`);
-    return 1;
+    console.debug(`${filtered.length} requested USB device(s) ${vendor_id.toString(16)}:${product_id.toString(16)} found.`);
+    return filtered.map(_register_device);
   }
 
   // request access if we didn't find a matching device
   let f = { vendorId: vendor_id, productId: product_id };
-  let device = await navigator.usb.requestDevice({filters: [f]});
+  let device = await _usb().requestDevice({filters: [f]});
 
   // if we were granted access to a device, 
-  // set it as the active device
+  // add it to the device table
   if(device !== undefined) {
-    _set_active_device(device);
     console.debug(`The requested USB device ${vendor_id.toString(16)}:${product_id.toString(16)} was found.`);
-    return 1;
+    return [_register_device(device)];
   }
 
   // handle failures
   console.error("Failed to find/authorize USB device.");
-  return 0;
+  return [];
 }
 
 
 // generate the device descriptor
-function _get_device_descriptor(desc) {
+function _get_device_descriptor(device_id, desc) {
 
   const DEVICE_DESCRIPTOR_LENGTH = 18;
   const LIBUSB_DT_DEVICE = 1;
 
-  let d = active_device;
+  let d = webusb_devices[device_id];
 
   // serialize a libusb_device_descriptor blob
   let data = new Uint8Array(DEVICE_DESCRIPTOR_LENGTH);
@@ -155,23 +418,26 @@ function _get_device_descriptor(desc) {
 
 
 // get a string descriptor by index
-function _get_string_descriptor(index, buffer, length) {
-  
+function _get_string_descriptor(device_id, index, buffer, length) {
+
+  let device = webusb_devices[device_id];
+
   // lookup the descriptor 
   let desc = null;
   switch(index) {
     case DESCRIPTOR_INDEX_SERIAL_NUMBER:
-      desc = active_device.serialNumber;
+      desc = device.serialNumber;
       break;
     case DESCRIPTOR_INDEX_PRODUCT:
-      desc = active_device.productName;
+      desc = device.productName;
       break;
     case DESCRIPTOR_INDEX_MANUFACTURER:
-      desc = active_device.manufacturerName;
+      desc = device.manufacturerName;
       break;
     default:
       throw `Unhandled string descriptor, index ${index}`;
   }
+  if(desc === null || desc === undefined) desc = "";
 
   // copy the descriptor to the heap
   let len = Math.min(lengthBytesUTF8(desc)+1, length);
@@ -182,8 +448,18 @@ function _get_string_descriptor(index, buffer, length) {
 }
 
 
-// get the active configuration descriptor
-function _get_active_config_descriptor() {
+// get a configuration descriptor by index
+function _get_config_descriptor(device_id, config_index) {
+  return _blocking(async () => {
+    let intervals = await _get_endpoint_intervals(device_id, config_index);
+    return _build_config_descriptor(device_id, config_index, intervals);
+  });
+}
+
+
+// synthesize a configuration descriptor from the WebUSB configuration
+// - intervals maps endpoint addresses to their bInterval, which WebUSB doesn't expose
+function _build_config_descriptor(device_id, config_index, intervals) {
 
   const CONFIG_DESCRIPTOR_LENGTH = 9;
   const INTERFACE_DESCRIPTOR_LENGTH = 9;
@@ -191,13 +467,14 @@ function _get_active_config_descriptor() {
   const LIBUSB_DT_CONFIG = 2;
   const LIBUSB_DT_INTERFACE = 4;
   const LIBUSB_DT_ENDPOINT = 5;
+  const ENDPOINT_TRANSFER_TYPES = { isochronous: 1, bulk: 2, interrupt: 3 };
 
-  let device = active_device;
+  let configuration = webusb_devices[device_id].configurations[config_index];
 
-  // compute the number of endpoints in the current configuration
+  // compute the number of endpoints in the configuration
   let num_interfaces = 0;
   let num_endpoints = 0;
-  for(let i of device.configuration.interfaces) {
+  for(let i of configuration.interfaces) {
     num_interfaces += i.alternates.length;
     for(let alt of i.alternates) {
       num_endpoints += alt.endpoints.length;
@@ -216,14 +493,14 @@ function _get_active_config_descriptor() {
   data[2] = descriptor_length & 0xff;
   data[3] = descriptor_length >> 8;
   data[4] = num_interfaces;
-  data[5] = device.configuration.configurationValue;
+  data[5] = configuration.configurationValue;
   data[6] = DESCRIPTOR_INDEX_CONFIG;
   data[7] = 0; // bmAttributes
   data[8] = 0; // MaxPower
 
   // libusb_interface_descriptors
   let offset = 9;
-  for(let i of device.configuration.interfaces) {
+  for(let i of configuration.interfaces) {
     for(let alt of i.alternates) {
       data[offset+0] = INTERFACE_DESCRIPTOR_LENGTH;
       data[offset+1] = LIBUSB_DT_INTERFACE;
@@ -243,10 +520,10 @@ function _get_active_config_descriptor() {
         data[offset+0] = ENDPOINT_DESCRIPTOR_LENGTH;
         data[offset+1] = LIBUSB_DT_ENDPOINT;
         data[offset+2] = ep_addr;
-        data[offset+3] = 0; // bmAttributes
+        data[offset+3] = ENDPOINT_TRANSFER_TYPES[ep.type]; // bmAttributes
         data[offset+4] = ep.packetSize & 0xff;
         data[offset+5] = ep.packetSize >> 8;
-        data[offset+6] = 0; // bInterval
+        data[offset+6] = intervals.get(ep_addr) ?? 0; // bInterval
         offset += ENDPOINT_DESCRIPTOR_LENGTH;
       }
     }
@@ -262,141 +539,92 @@ function _get_active_config_descriptor() {
 
 
 // run a control transfer
-function _control_transfer(bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout) { 
-  
-  if(timeout != 0) {
-    throw "TODO implement control transfer timeout handling";
-  }
-
-  return Asyncify.handleAsync(async () => {
-
-    // transfer option lookup tables
-    let libusb_request_type = ["standard", "class", "vendor"];
-    let libusb_request_recipient = ["device", "interface", "endpoint", "other"];
-
-    // parse the request type
-    let req_type = libusb_request_type[(bmRequestType & 0x60) >> 5];
-
-    // parse the recipient type
-    let rec_type = libusb_request_recipient[(bmRequestType & 0x1f)];
-
-    // parse the request direction
-    let dir_in = (bmRequestType & 0x80) == 0x80;
-
-    // configure the transfer options
-    let setup = {
-      requestType: req_type,
-      recipient: rec_type,
-      request: bRequest,
-      value: wValue,
-      index: wIndex,
-    };
-
-    // input transfer
-    if(dir_in) {
+// - returns the number of bytes transferred, or a libusb error code
+function _control_transfer(device_id, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout) { 
 
-      // perform the transfer
-      let result = await active_device.controlTransferIn(setup, wLength);
-      if(result.status != "ok") {
-        throw `controlTransferIn response: ${result}`;
-      }
+  let device = webusb_devices[device_id];
+  if(device === undefined) return LIBUSB_ERROR_NO_DEVICE;
 
-      // copy the data to the buffer on the heap
-      let view = new Uint8Array(result.data.buffer);
-      writeArrayToMemory(view, data);
+  return _blocking(async () => {
+    let setup = _control_setup(bmRequestType, bRequest, wValue, wIndex);
 
-      // return the length of data read
-      return result.data.buffer.byteLength;
+    // input transfer: copy the data to the buffer on the heap and return the length of data read
+    if((bmRequestType & 0x80) == 0x80) {
+      let result = await _control_transfer_in(device, setup, wLength, timeout);
+      if(typeof result == "number") return result;
+      return _write_data_to_heap(result, data);
     }
 
     // output transfer
-    else {
-
-      // fill the output buffer
-      let buffer = new Uint8Array(wLength);
-      for(let x = 0; x < wLength; x++) {
-        buffer[x] = getValue(data+x, "i8");
-      }
-
-      // perform the transfer
-      let result = await active_device.controlTransferOut(setup, buffer);
-      if(result.status != "ok") {
-        throw `controlTransferOut response: ${result}`;
-      }
-
-      // return the length of data written
-      return result.bytesWritten;
-    }
+    return await _control_transfer_out(device, setup, _get_out_data(data, wLength), timeout);
   });
 }
 
 
-// submit an asynchronous bulk input transfer
-async function _submit_bulk_in_transfer(ep, len, buffer, transfer) {
-       
-  const LIBUSB_TRANSFER_COMPLETED = 0;
-  const LIBUSB_TRANSFER_CANCELLED = 3;
-  const LIBUSB_SUCCESS = 0;
-
-  if(active_device === undefined) {
-    console.warn("_submit_bulk_in_transfer called when active_device === undefined");
-    return false;
-  }
+// build the WebUSB setup of a control transfer
+function _control_setup(bmRequestType, bRequest, wValue, wIndex) {
 
-  // perform the transfer
-  let result;
-  try {
-    result = await active_device.transferIn(ep, len);
-  } catch (error) {
-    console.warn("transfer error in _submit_bulk_in_transfer");
-    return false;
-  } 
-
-  // write the received data to the heap buffer
-  let data = new Uint8Array(result.data.buffer);
-  writeArrayToMemory(data, buffer);
+  // transfer option lookup tables
+  let libusb_request_type = ["standard", "class", "vendor"];
+  let libusb_request_recipient = ["device", "interface", "endpoint", "other"];
 
-  // set the transfer status to completed
-  setValue(transfer+20, data.length, "i32");                      // actualLength
-  if(getValue(transfer+12, "i32") != LIBUSB_TRANSFER_CANCELLED) { // status
-    setValue(transfer+12, LIBUSB_TRANSFER_COMPLETED, "i32");      // status
-  }
-
-  return LIBUSB_SUCCESS;
+  return {
+    requestType: libusb_request_type[(bmRequestType & 0x60) >> 5],
+    recipient: libusb_request_recipient[(bmRequestType & 0x1f)],
+    request: bRequest,
+    value: wValue,
+    index: wIndex,
+  };
 }
 
 
-// submit an asynchronous bulk output transfer
-async function _submit_bulk_out_transfer(ep, len, buffer, transfer) {
-
-  const LIBUSB_TRANSFER_COMPLETED = 0;
-  const LIBUSB_TRANSFER_CANCELLED = 3;
-  const LIBUSB_SUCCESS = 0;
-
-  if(active_device === undefined) {
-    console.warn("_submit_bulk_in_transfer called when active_device === undefined");
-    return false;
-  }
-
-  // perform the transfer
-  let result;
-  let data;
-  try {
-    data = new Uint8Array(len);
-    for(let x = 0; x < len; x++) {
-      data[x] = getValue(buffer+x, "i8");
+// run a batch of control OUT transfers (see flush_control_batch in libusb.c)
+// - entries is an array of struct control_batch_entry, and their data is packed in order at data
+// - the transfers are pipelined (see _control_transfer_out_batch); in I/O worker mode the
+//   whole batch is forwarded to the worker as one command
+// - each entry's result is written back to it, and the first error (or 0) is returned
+function _control_transfer_batch(device_id, entries, count, data) {
+
+  const ENTRY_SIZE = 16;
+
+  let device = webusb_devices[device_id];
+  if(device === undefined) return LIBUSB_ERROR_NO_DEVICE;
+
+  return _blocking(async () => {
+
+    // read the transfers
+    let view = new DataView(wasmMemory.buffer);
+    let offset = data;
+    let transfers = [];
+    for(let x = 0; x < count; x++) {
+      let entry = entries + x * ENTRY_SIZE;
+      let length = view.getUint16(entry+6, true);
+      transfers.push({
+        setup: _control_setup(view.getUint8(entry), view.getUint8(entry+1),
+                              view.getUint16(entry+2, true), view.getUint16(entry+4, true)),
+        data: _get_out_data(offset, length),
+        timeout: view.getUint32(entry+8, true),
+      });
+      offset += length;
     }
-    result = await active_device.transferOut(ep, data);
-  } catch (error) {
-    console.warn("transfer error in _submit_bulk_out_transfer");
-    return false;
-  } 
-
-  // set the transfer status to completed
-  setValue(transfer+20, result.bytesWritten, "i32");                      // actualLength
-  if(getValue(transfer+12, "i32") != LIBUSB_TRANSFER_CANCELLED) { // status
-    setValue(transfer+12, LIBUSB_TRANSFER_COMPLETED, "i32");      // status
-  }
 
-  return LIBUSB_SUCCESS;
+    // run them, and report the results in one go
+    let results;
+    if(device.controlTransferOutBatch !== undefined) {
+      try {
+        results = await device.controlTransferOutBatch(transfers);
+      } catch (error) {
+        console.warn(`control transfer batch failed: ${error}`);
+        results = transfers.map(() => LIBUSB_ERROR_IO);
+      }
+      for(let t of transfers) _release_out_data(t.data);
+    } else {
+      results = await _control_transfer_out_batch(device, transfers);
+    }
+    let heap = _heap_i32();
+    for(let x = 0; x < count; x++) {
+      heap[(entries + x * ENTRY_SIZE + 12) >> 2] = results[x];
+    }
+    return results.find((r) => r < 0) || 0;
+  });
 }